@@ -660,6 +660,21 @@ RTLSDR_API int rtlsdr_set_gpio_status(rtlsdr_dev_t *dev, int *status );
  *   '0' to deactivate, '1' or 'i' for I-ADC input, '2' or 'q' for Q-ADC input
  * option 't' or 'T' for enabling bias tee on GPIO PIN 0 as with rtlsdr_set_bias_tee():
  *   '1' for Bias T on. '0' for Bias T off.
+ * options 'bufhuge', 'buflock' and 'bufnuma' control allocation of the transfer
+ *   buffers for rtlsdr_read_async(), which are allocated as one cache line aligned
+ *   region: '1' requests huge pages, locked memory or binding to the NUMA node
+ *   of the thread calling rtlsdr_read_async(). These are Linux only.
+ * option 'dsreal' sets the output of rtlsdr_read_async() in direct sampling mode:
+ *   '0' I/Q as captured. '1' packed real ADC samples: 1 byte per sample at the sample rate.
+ *   '2' I/Q at half the sample rate, centered at sample rate / 4. In both real modes,
+ *   the center frequency isn't mixed: the band 0 .. sample rate / 2 is delivered,
+ *   with half the number of bytes of the captured block.
+ * option 'stats' activates measurement of signal statistics on every N'th block
+ *   delivered by rtlsdr_read_async(). see rtlsdr_get_signal_stats(). '0' deactivates.
+ * option 'iqc' activates DC offset and I/Q imbalance correction of the samples
+ *   delivered by rtlsdr_read_async(): '0' off, '1' remove DC, '2' remove DC and
+ *   correct gain/phase imbalance. Options 'iqcdec' and 'iqcavg' parametrize
+ *   the running estimator: every N'th I/Q pair is used and averaged over N blocks.
  *
  * \param dev the device handle given by rtlsdr_open()
  * \param opts described option string
@@ -723,6 +738,87 @@ RTLSDR_API const char * rtlsdr_get_ver_id();
 RTLSDR_API uint32_t rtlsdr_get_version();
 
 
+/*!
+ * one entry of a hop schedule. see rtlsdr_set_hop_schedule()
+ */
+typedef struct rtlsdr_hop_entry {
+	uint64_t freq;		/* center frequency in Hz */
+	int      gain;		/* tuner gain in tenth dB. RTLSDR_HOP_KEEP_GAIN keeps the current gain */
+	uint32_t bandwidth;	/* tuner bandwidth in Hz. 0 keeps the current bandwidth */
+	uint32_t dwell;		/* number of settled I/Q samples to deliver before next hop */
+	uint32_t settle;	/* number of I/Q samples after retuning, delivered as unsettled.
+				 * 0 for the library default of 10 ms */
+} rtlsdr_hop_entry_t;
+
+#define RTLSDR_HOP_KEEP_GAIN	(-32768)
+
+/*!
+ * tag of a block delivered to the rtlsdr_read_async() callback. see rtlsdr_get_block_tag()
+ */
+typedef struct rtlsdr_block_tag {
+	int      hop_index;	/* index into hop schedule. -1 without active schedule or before its first hop.
+				 * until a requested hop is executed, blocks keep the previous entry */
+	int      settled;	/* 1 when all samples of block are captured after settling. 0 otherwise */
+	uint64_t freq;		/* center frequency in Hz of the hop entry */
+	uint32_t sweep;		/* number of completed passes through the hop schedule */
+} rtlsdr_block_tag_t;
+
+/*!
+ * Set a hop schedule, which is executed by the library in rtlsdr_read_async().
+ * The entries are visited round robin: frequency, gain and bandwidth are applied
+ * on the USB thread between handling of the transfers - without the application
+ * needing to retune from the callback or an extra thread.
+ * Blocks get tagged with the entry index and their settled state,
+ * see rtlsdr_get_block_tag().
+ * Hops happen at block boundaries, thus dwell is rounded up to a multiple of
+ * the buf_len given to rtlsdr_read_async(): use smaller buffers for short dwell times.
+ * The schedule can be set/replaced before or while streaming;
+ * a new schedule starts with it's first entry.
+ *
+ * \param dev the device handle given by rtlsdr_open()
+ * \param entries array of hop entries. the library keeps a copy
+ * \param num_entries number of entries. 0 deactivates the schedule
+ * \return 0 on success. -1 if device is not initialized or on invalid parameters.
+ */
+RTLSDR_API int rtlsdr_set_hop_schedule(rtlsdr_dev_t *dev, const rtlsdr_hop_entry_t *entries, int num_entries);
+
+/*!
+ * Get the tag of the block currently delivered to the rtlsdr_read_async() callback.
+ * Only valid when called from inside the callback.
+ *
+ * \param dev the device handle given by rtlsdr_open()
+ * \param tag pointer to tag structure to fill
+ * \return 0 on success. -1 if device is not initialized
+ */
+RTLSDR_API int rtlsdr_get_block_tag(rtlsdr_dev_t *dev, rtlsdr_block_tag_t *tag);
+
+
+/*!
+ * signal statistics measured by the library. see rtlsdr_get_signal_stats()
+ */
+typedef struct rtlsdr_signal_stats {
+	uint64_t block_count;	/* number of measured blocks since start */
+	uint32_t sample_count;	/* number of I/Q samples in last measured block */
+	float    mean_power;	/* mean power |I+jQ|^2 relative to full scale: 1.0 = 0 dBFS */
+	float    peak;		/* peak magnitude of I or Q relative to full scale */
+	float    clip_rate;	/* fraction of I and Q values at ADC limits 0 or 255 */
+	float    dc_i;		/* mean of I relative to full scale */
+	float    dc_q;		/* mean of Q relative to full scale */
+} rtlsdr_signal_stats_t;
+
+/*!
+ * Get signal statistics of the last measured block in rtlsdr_read_async().
+ * Measurement is activated with option 'stats=<N>' of rtlsdr_set_opt_string():
+ * then every N'th block is measured on the USB thread - before
+ * DC/I/Q correction. This function does not lock and can be called from any thread.
+ *
+ * \param dev the device handle given by rtlsdr_open()
+ * \param stats pointer to statistics structure to fill
+ * \return 0 on success. 1 if no block was measured yet. -1 if device is not initialized
+ */
+RTLSDR_API int rtlsdr_get_signal_stats(rtlsdr_dev_t *dev, rtlsdr_signal_stats_t *stats);
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,146 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "channelizer.h"
+
+#include <stdlib.h>
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define MIXER_TABLE_LEN		(1 << CHAN_MIXER_TABLE_BITS)
+#define MIXER_COEF_BITS		14
+
+static int16_t mixer_cos[MIXER_TABLE_LEN];
+static int mixer_table_ready = 0;
+
+
+int chan_power_init(struct chan_power *c, int n)
+{
+	int i;
+	double wsum = 0.0;
+	c->window = NULL;
+	c->work = NULL;
+	c->bins = NULL;
+	if (fft_plan_init(&c->plan, n) < 0)
+		return -1;
+	c->n = n;
+	c->window = malloc(sizeof(float) * n);
+	c->work = malloc(sizeof(float) * 2 * n);
+	c->bins = malloc(sizeof(float) * n);
+	if (!c->window || !c->work || !c->bins) {
+		chan_power_free(c);
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		c->window[i] = (float)(0.5 - 0.5 * cos(2.0 * M_PI * i / n));
+		wsum += (double)c->window[i] * c->window[i];
+	}
+	/* Parseval: sum of all bins = n * sum |x w|^2 */
+	c->norm = 1.0 / (n * wsum);
+	return 0;
+}
+
+void chan_power_free(struct chan_power *c)
+{
+	fft_plan_free(&c->plan);
+	free(c->window);
+	free(c->work);
+	free(c->bins);
+	c->window = c->work = c->bins = NULL;
+}
+
+void chan_power_spectrum(struct chan_power *c, const int16_t *iq, int segments)
+{
+	int i, k;
+	float *w = c->work;
+	float scale;
+	if (segments < 1)
+		segments = 1;
+	scale = 1.0f / segments;
+	for (k = 0; k < segments; k++, iq += 2 * c->n) {
+		for (i = 0; i < c->n; i++) {
+			w[2*i]   = iq[2*i]   * c->window[i];
+			w[2*i+1] = iq[2*i+1] * c->window[i];
+		}
+		fft_forward(&c->plan, w);
+		if (!k) {
+			for (i = 0; i < c->n; i++) {
+				c->bins[i] = w[2*i] * w[2*i] + w[2*i+1] * w[2*i+1];}
+		} else {
+			for (i = 0; i < c->n; i++) {
+				c->bins[i] += w[2*i] * w[2*i] + w[2*i+1] * w[2*i+1];}
+		}
+	}
+	if (segments > 1) {
+		for (i = 0; i < c->n; i++) {
+			c->bins[i] *= scale;}
+	}
+}
+
+double chan_power_band(const struct chan_power *c, double f_lo, double f_hi)
+{
+	int k, k_lo, k_hi;
+	double sum = 0.0;
+	k_lo = (int)ceil(f_lo * c->n);
+	k_hi = (int)floor(f_hi * c->n);
+	if (k_lo < -c->n/2)
+		k_lo = -c->n/2;
+	if (k_hi > c->n/2 - 1)
+		k_hi = c->n/2 - 1;
+	if (k_hi < k_lo)
+		k_hi = k_lo;	/* narrower than a bin */
+	for (k = k_lo; k <= k_hi; k++) {
+		sum += c->bins[k & (c->n - 1)];}
+	return sum * c->norm;
+}
+
+static void mixer_table_init(void)
+{
+	int i;
+	for (i = 0; i < MIXER_TABLE_LEN; i++) {
+		mixer_cos[i] = (int16_t)lrint(cos(2.0 * M_PI * i / MIXER_TABLE_LEN) * ((1 << MIXER_COEF_BITS) - 1));}
+	mixer_table_ready = 1;
+}
+
+void chan_mixer_set(struct chan_mixer *m, double freq)
+{
+	if (!mixer_table_ready)
+		mixer_table_init();
+	/* negative step: multiply with exp(-j 2 pi freq t) */
+	m->step = (uint32_t)(int64_t)floor(-freq * 4294967296.0 + 0.5);
+}
+
+void chan_mixer_process(struct chan_mixer *m, int16_t *iq, int len)
+{
+	int i, k;
+	int32_t re, im, c, s;
+	uint32_t phase = m->phase;
+	if (!m->step)
+		return;
+	for (i = 0; i < len; i += 2) {
+		k = phase >> (32 - CHAN_MIXER_TABLE_BITS);
+		c = mixer_cos[k];
+		s = mixer_cos[(k + 3*MIXER_TABLE_LEN/4) & (MIXER_TABLE_LEN - 1)];	/* sin(x) = cos(x + 3/2 pi) */
+		re = iq[i];
+		im = iq[i+1];
+		iq[i]   = (int16_t)((re * c - im * s) >> MIXER_COEF_BITS);
+		iq[i+1] = (int16_t)((re * s + im * c) >> MIXER_COEF_BITS);
+		phase += m->step;
+	}
+	m->phase = phase;
+}
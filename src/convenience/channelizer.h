@@ -0,0 +1,110 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __CHANNELIZER_H
+#define __CHANNELIZER_H
+
+#include <stdint.h>
+#include "fft.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* power of many channels within one capture, from a single windowed FFT,
+ * and a mixer moving one of them to 0 Hz for demodulation.
+ * frequencies are given relative to the samplerate: -0.5 .. +0.5
+ */
+
+#define CHAN_MIXER_TABLE_BITS	12	/* spurs ~ -72 dB */
+
+struct chan_power
+{
+	struct fft_plan plan;
+	int	n;		/* fft length = I/Q pairs per measurement */
+	float	*window;	/* hann */
+	float	*work;		/* 2n floats */
+	float	*bins;		/* n power values, natural fft order */
+	double	norm;		/* bin sum -> mean square of I/Q pairs */
+};
+
+struct chan_mixer
+{
+	uint32_t phase;
+	uint32_t step;
+};
+
+/*!
+ * Setup channel power measurement
+ *
+ * \param c state
+ * \param n fft length, power of 2
+ * \return 0 on success, -1 on error
+ */
+
+int chan_power_init(struct chan_power *c, int n);
+
+/*!
+ * Free memory of channel power measurement
+ *
+ * \param c state
+ */
+
+void chan_power_free(struct chan_power *c);
+
+/*!
+ * Compute power spectrum of n I/Q pairs, averaged over consecutive segments
+ *
+ * \param c state
+ * \param iq interleaved 16 bit I/Q data, segments * n pairs
+ * \param segments number of spectra to average, 1 for a single one
+ */
+
+void chan_power_spectrum(struct chan_power *c, const int16_t *iq, int segments);
+
+/*!
+ * Sum power of a band from the last spectrum
+ *
+ * \param c state
+ * \param f_lo lower edge, relative to samplerate
+ * \param f_hi upper edge, relative to samplerate
+ * \return mean square of the band's I/Q pairs, same scale as a time domain average of I*I + Q*Q
+ */
+
+double chan_power_band(const struct chan_power *c, double f_lo, double f_hi);
+
+/*!
+ * Set mixer to move a frequency to 0 Hz. phase is kept
+ *
+ * \param m mixer
+ * \param freq frequency relative to samplerate
+ */
+
+void chan_mixer_set(struct chan_mixer *m, double freq);
+
+/*!
+ * Mix a block of I/Q data, in place
+ *
+ * \param m mixer
+ * \param iq interleaved 16 bit I/Q data
+ * \param len number of int16_t values in iq
+ */
+
+void chan_mixer_process(struct chan_mixer *m, int16_t *iq, int len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__CHANNELIZER_H*/
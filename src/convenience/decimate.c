@@ -0,0 +1,358 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "decimate.h"
+#include "simd.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+
+const int cic_9_tables[][10] = {
+	{0,},
+	{9, -156,  -97, 2798, -15489, 61019, -15489, 2798,  -97, -156},
+	{9, -128, -568, 5593, -24125, 74126, -24125, 5593, -568, -128},
+	{9, -129, -639, 6187, -26281, 77511, -26281, 6187, -639, -129},
+	{9, -122, -612, 6082, -26353, 77818, -26353, 6082, -612, -122},
+	{9, -120, -602, 6015, -26269, 77757, -26269, 6015, -602, -120},
+	{9, -120, -582, 5951, -26128, 77542, -26128, 5951, -582, -120},
+	{9, -119, -580, 5931, -26094, 77505, -26094, 5931, -580, -119},
+	{9, -119, -578, 5921, -26077, 77484, -26077, 5921, -578, -119},
+	{9, -119, -577, 5917, -26067, 77473, -26067, 5917, -577, -119},
+	{9, -199, -362, 5303, -25505, 77489, -25505, 5303, -362, -199},
+};
+
+
+static inline int16_t sat16(int v)
+{
+	if (v > 32767)
+		return 32767;
+	if (v < -32768)
+		return -32768;
+	return (int16_t)v;
+}
+
+
+/* ---------------------------------------------------------------------------
+ * 2:1 CIC decimator
+ *
+ * with z[k] = (in[2k], in[2k+1]) output m is
+ *   y[m] = ( z[2m-5] + 5 z[2m-4] + 10 z[2m-3] + 10 z[2m-2] + 5 z[2m-1] + z[2m] ) >> 4
+ * and written to out[2m], out[2m+1].
+ * the SIMD kernels treat adjacent pairs (z[2n-1], z[2n]) as one unit:
+ * shuffled to (I, I, Q, Q) a single multiply-add applies two taps to I and Q.
+ * cic5_run() is only called for m >= 5, where all reads are at or behind
+ * the written output - allowing in place operation.
+ */
+
+static void cic5_run_scalar(int16_t *out, const int16_t *in, int m, int m_end)
+{
+	const int16_t *z;
+	int c;
+	for (; m < m_end; m++) {
+		z = in + 4*m - 10;	/* z[2m-5] */
+		for (c = 0; c < 2; c++) {
+			/* a downsample should improve resolution, so don't fully shift */
+			out[2*m+c] = sat16( (z[c] + (z[2+c] + z[8+c])*5 + (z[4+c] + z[6+c])*10 + z[10+c]) >> 4 );
+		}
+	}
+}
+
+#if defined(RTL_SIMD_SSE2)
+/* I0 Q0 I1 Q1 -> I0 I1 Q0 Q1 within each 64 bit */
+static inline __m128i cic5_pairs_sse2(const int16_t *p)
+{
+	__m128i v = _mm_loadu_si128((const __m128i *)p);
+	v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(3,1,2,0));
+	return _mm_shufflehi_epi16(v, _MM_SHUFFLE(3,1,2,0));
+}
+#endif
+
+#if defined(RTL_SIMD_AVX2)
+static inline __m256i cic5_pairs_avx2(const int16_t *p)
+{
+	__m256i v = _mm256_loadu_si256((const __m256i *)p);
+	v = _mm256_shufflelo_epi16(v, _MM_SHUFFLE(3,1,2,0));
+	return _mm256_shufflehi_epi16(v, _MM_SHUFFLE(3,1,2,0));
+}
+
+static inline __m256i cic5_four_avx2(const int16_t *p, __m256i h0, __m256i h1, __m256i h2)
+{
+	__m256i acc = _mm256_madd_epi16(cic5_pairs_avx2(p), h0);
+	acc = _mm256_add_epi32(acc, _mm256_madd_epi16(cic5_pairs_avx2(p + 4), h1));
+	acc = _mm256_add_epi32(acc, _mm256_madd_epi16(cic5_pairs_avx2(p + 8), h2));
+	return _mm256_srai_epi32(acc, 4);
+}
+#endif
+
+static void cic5_run(int16_t *out, const int16_t *in, int m, int m_end)
+{
+#if defined(RTL_SIMD_AVX2)
+	{
+	const __m256i h0 = _mm256_set1_epi32((5 << 16) | 1);
+	const __m256i h1 = _mm256_set1_epi32((10 << 16) | 10);
+	const __m256i h2 = _mm256_set1_epi32((1 << 16) | 5);
+	__m256i a, b;
+	for (; m + 8 <= m_end; m += 8) {
+		a = cic5_four_avx2(in + 4*m - 10, h0, h1, h2);
+		b = cic5_four_avx2(in + 4*m + 6, h0, h1, h2);
+		/* packs works per 128 bit lane */
+		a = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), _MM_SHUFFLE(3,1,2,0));
+		_mm256_storeu_si256((__m256i *)(out + 2*m), a);
+	}
+	}
+#endif
+#if defined(RTL_SIMD_SSE2)
+	{
+	const __m128i h0 = _mm_set1_epi32((5 << 16) | 1);
+	const __m128i h1 = _mm_set1_epi32((10 << 16) | 10);
+	const __m128i h2 = _mm_set1_epi32((1 << 16) | 5);
+	__m128i a, b;
+	for (; m + 4 <= m_end; m += 4) {
+		const int16_t *p = in + 4*m - 10;
+		a = _mm_madd_epi16(cic5_pairs_sse2(p), h0);
+		a = _mm_add_epi32(a, _mm_madd_epi16(cic5_pairs_sse2(p + 4), h1));
+		a = _mm_add_epi32(a, _mm_madd_epi16(cic5_pairs_sse2(p + 8), h2));
+		b = _mm_madd_epi16(cic5_pairs_sse2(p + 8), h0);
+		b = _mm_add_epi32(b, _mm_madd_epi16(cic5_pairs_sse2(p + 12), h1));
+		b = _mm_add_epi32(b, _mm_madd_epi16(cic5_pairs_sse2(p + 16), h2));
+		a = _mm_packs_epi32(_mm_srai_epi32(a, 4), _mm_srai_epi32(b, 4));
+		_mm_storeu_si128((__m128i *)(out + 2*m), a);
+	}
+	}
+#elif defined(RTL_SIMD_NEON)
+	{
+	int16x8x4_t v;
+	int16x8x2_t r;
+	int32x4_t il, ih, ql, qh;
+	int t;
+	static const int16_t taps[6] = {1, 5, 10, 10, 5, 1};
+	for (; m + 8 <= m_end; m += 8) {
+		/* val[0] = I(2n-1), val[1] = Q(2n-1), val[2] = I(2n), val[3] = Q(2n) */
+		il = ih = ql = qh = vdupq_n_s32(0);
+		for (t = 0; t < 3; t++) {
+			v = vld4q_s16(in + 4*(m-2+t) - 2);
+			il = vmlal_n_s16(il, vget_low_s16(v.val[0]),  taps[2*t]);
+			ih = vmlal_n_s16(ih, vget_high_s16(v.val[0]), taps[2*t]);
+			ql = vmlal_n_s16(ql, vget_low_s16(v.val[1]),  taps[2*t]);
+			qh = vmlal_n_s16(qh, vget_high_s16(v.val[1]), taps[2*t]);
+			il = vmlal_n_s16(il, vget_low_s16(v.val[2]),  taps[2*t+1]);
+			ih = vmlal_n_s16(ih, vget_high_s16(v.val[2]), taps[2*t+1]);
+			ql = vmlal_n_s16(ql, vget_low_s16(v.val[3]),  taps[2*t+1]);
+			qh = vmlal_n_s16(qh, vget_high_s16(v.val[3]), taps[2*t+1]);
+		}
+		r.val[0] = vcombine_s16(vqshrn_n_s32(il, 4), vqshrn_n_s32(ih, 4));
+		r.val[1] = vcombine_s16(vqshrn_n_s32(ql, 4), vqshrn_n_s32(qh, 4));
+		vst2q_s16(out + 2*m, r);
+	}
+	}
+#endif
+	cic5_run_scalar(out, in, m, m_end);
+}
+
+void cic5_init(struct cic5_state *s)
+{
+	memset(s->hist, 0, sizeof(s->hist));
+	s->phase = 0;
+}
+
+int cic5_decimate(struct cic5_state *s, int16_t *data, int len)
+{
+	/* history + first 10 pairs: enough for the first 5 outputs */
+	int16_t tmp[2 * (5 + 10)];
+	int16_t head[2 * 5];
+	int16_t newhist[10];
+	int n = len / 2;
+	int p = s->phase;
+	int nout, nhead, k;
+
+	nout = (n > p) ? (n - p + 1) / 2 : 0;
+	k = (n < 10) ? n : 10;
+	memcpy(tmp, s->hist, sizeof(s->hist));
+	memcpy(tmp + 10, data, 2 * k * sizeof(int16_t));
+	/* last 5 pairs of history + data, before data is overwritten */
+	if (n >= 5)
+		memcpy(newhist, data + 2*(n-5), sizeof(newhist));
+	else
+		memcpy(newhist, tmp + 2*n, sizeof(newhist));
+
+	/* outputs reading the history can't be written in place right away */
+	nhead = (nout < 5) ? nout : 5;
+	cic5_run_scalar(head, tmp + 10 + 2*p, 0, nhead);
+	if (nout > 5)
+		cic5_run(data, data + 2*p, 5, nout);
+	memcpy(data, head, 2 * nhead * sizeof(int16_t));
+
+	memcpy(s->hist, newhist, sizeof(newhist));
+	s->phase = (p + n) & 1;
+	return 2 * nout;
+}
+
+
+/* ---------------------------------------------------------------------------
+ * fir filter: y[k] = sum_t coef[t] * z[k - num_taps + 1 + t]
+ * work holds num_taps-1 pairs of history followed by the block,
+ * so output k reads work pairs k .. k+num_taps-1.
+ * SIMD: even outputs (k, k+2, ..) get tap pairs (coef[2j], coef[2j+1])
+ * from work pairs starting at k+2j, odd outputs from k+1+2j.
+ */
+
+static void cfir_run_scalar(const struct cfir_state *s, int16_t *out, int k, int k_end)
+{
+	const int16_t *w;
+	int t, sum_i, sum_q;
+	for (; k < k_end; k++) {
+		w = s->work + 2*k;
+		sum_i = sum_q = 0;
+		for (t = 0; t < s->num_taps; t++) {
+			sum_i += s->coef[t] * w[2*t];
+			sum_q += s->coef[t] * w[2*t+1];
+		}
+		out[2*k]   = sat16(sum_i >> s->shift);
+		out[2*k+1] = sat16(sum_q >> s->shift);
+	}
+}
+
+#if defined(RTL_SIMD_SSE2)
+static inline __m128i cfir_tap_pair(const int16_t *coef)
+{
+	return _mm_set1_epi32( (int)(((uint32_t)(uint16_t)coef[1] << 16) | (uint16_t)coef[0]) );
+}
+#endif
+
+#if defined(RTL_SIMD_AVX2)
+static inline __m256i cfir_tap_pair256(const int16_t *coef)
+{
+	return _mm256_set1_epi32( (int)(((uint32_t)(uint16_t)coef[1] << 16) | (uint16_t)coef[0]) );
+}
+#endif
+
+static void cfir_run(const struct cfir_state *s, int16_t *out, int n)
+{
+	int k = 0, j;
+#if defined(RTL_SIMD_AVX2)
+	for (; k + 8 <= n; k += 8) {
+		__m256i ev = _mm256_setzero_si256();
+		__m256i od = _mm256_setzero_si256();
+		const int16_t *w = s->work + 2*k;
+		for (j = 0; j < s->num_taps; j += 2) {
+			__m256i c = cfir_tap_pair256(s->coef + j);
+			ev = _mm256_add_epi32(ev, _mm256_madd_epi16(cic5_pairs_avx2(w + 2*j), c));
+			od = _mm256_add_epi32(od, _mm256_madd_epi16(cic5_pairs_avx2(w + 2*j + 2), c));
+		}
+		ev = _mm256_srai_epi32(ev, s->shift);
+		od = _mm256_srai_epi32(od, s->shift);
+		/* per lane: k, k+2, k+1, k+3 -> k .. k+3 */
+		ev = _mm256_shuffle_epi32(_mm256_packs_epi32(ev, od), _MM_SHUFFLE(3,1,2,0));
+		_mm256_storeu_si256((__m256i *)(out + 2*k), ev);
+	}
+#endif
+#if defined(RTL_SIMD_SSE2)
+	for (; k + 4 <= n; k += 4) {
+		__m128i ev = _mm_setzero_si128();
+		__m128i od = _mm_setzero_si128();
+		const int16_t *w = s->work + 2*k;
+		for (j = 0; j < s->num_taps; j += 2) {
+			__m128i c = cfir_tap_pair(s->coef + j);
+			ev = _mm_add_epi32(ev, _mm_madd_epi16(cic5_pairs_sse2(w + 2*j), c));
+			od = _mm_add_epi32(od, _mm_madd_epi16(cic5_pairs_sse2(w + 2*j + 2), c));
+		}
+		ev = _mm_srai_epi32(ev, s->shift);
+		od = _mm_srai_epi32(od, s->shift);
+		ev = _mm_shuffle_epi32(_mm_packs_epi32(ev, od), _MM_SHUFFLE(3,1,2,0));
+		_mm_storeu_si128((__m128i *)(out + 2*k), ev);
+	}
+#elif defined(RTL_SIMD_NEON)
+	{
+		const int32x4_t sh = vdupq_n_s32(-s->shift);
+		int16x8x2_t v, r;
+		int32x4_t il, ih, ql, qh;
+		for (; k + 8 <= n; k += 8) {
+			il = ih = ql = qh = vdupq_n_s32(0);
+			for (j = 0; j < s->num_taps; j++) {
+				v = vld2q_s16(s->work + 2*(k+j));
+				il = vmlal_n_s16(il, vget_low_s16(v.val[0]),  s->coef[j]);
+				ih = vmlal_n_s16(ih, vget_high_s16(v.val[0]), s->coef[j]);
+				ql = vmlal_n_s16(ql, vget_low_s16(v.val[1]),  s->coef[j]);
+				qh = vmlal_n_s16(qh, vget_high_s16(v.val[1]), s->coef[j]);
+			}
+			r.val[0] = vcombine_s16(vqmovn_s32(vshlq_s32(il, sh)), vqmovn_s32(vshlq_s32(ih, sh)));
+			r.val[1] = vcombine_s16(vqmovn_s32(vshlq_s32(ql, sh)), vqmovn_s32(vshlq_s32(qh, sh)));
+			vst2q_s16(out + 2*k, r);
+		}
+	}
+#endif
+	cfir_run_scalar(s, out, k, n);
+}
+
+int cfir_init(struct cfir_state *s, const int *coef, int num_taps, int coef_bits)
+{
+	int t, pad, maxc = 0, red = 0;
+	memset(s, 0, sizeof(*s));
+	if (num_taps <= 0)
+		return -1;
+	/* pad to even number with a leading zero tap */
+	pad = num_taps & 1;
+	for (t = 0; t < num_taps; t++) {
+		int a = coef[t] < 0 ? -coef[t] : coef[t];
+		if (a > maxc)
+			maxc = a;
+	}
+	/* reduce precision until all coefficients fit into int16_t */
+	while (red < coef_bits && ((maxc + ((1 << red) >> 1)) >> red) > 32767)
+		++red;
+	s->num_taps = num_taps + pad;
+	s->shift = coef_bits - red;
+	s->coef = calloc(s->num_taps, sizeof(int16_t));
+	if (!s->coef)
+		return -1;
+	for (t = 0; t < num_taps; t++)
+		s->coef[pad + t] = (int16_t)((coef[t] + ((1 << red) >> 1)) >> red);
+	return 0;
+}
+
+void cfir_reset(struct cfir_state *s)
+{
+	if (s->work)
+		memset(s->work, 0, 2 * (s->num_taps - 1) * sizeof(int16_t));
+}
+
+void cfir_free(struct cfir_state *s)
+{
+	free(s->coef);
+	free(s->work);
+	memset(s, 0, sizeof(*s));
+}
+
+int cfir_filter(struct cfir_state *s, int16_t *data, int len)
+{
+	int n = len / 2;
+	int nhist = 2 * (s->num_taps - 1);
+	if (!s->num_taps)
+		return -1;
+	if (nhist + 2*n > s->work_len) {
+		int16_t *w = realloc(s->work, (nhist + 2*n) * sizeof(int16_t));
+		if (!w)
+			return -1;
+		if (!s->work)
+			memset(w, 0, nhist * sizeof(int16_t));
+		s->work = w;
+		s->work_len = nhist + 2*n;
+	}
+	memcpy(s->work + nhist, data, 2 * n * sizeof(int16_t));
+	cfir_run(s, data, n);
+	memmove(s->work, s->work + 2*n, nhist * sizeof(int16_t));
+	return 0;
+}
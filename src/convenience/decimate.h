@@ -0,0 +1,115 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __DECIMATE_H
+#define __DECIMATE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* decimation and fir helpers for interleaved 16 bit I/Q data,
+ * shared by rtl_fm and rtl_power.
+ * all lengths are counted in int16_t values (= 2 * number of I/Q pairs).
+ * I and Q are always filtered together, state is kept across blocks.
+ */
+
+/* {length, coef, coef, coef}  and scaled by 2^15
+   droop compensation after N passes of cic5_decimate(), optimal way to get +85% bandwidth */
+#define CIC_TABLE_MAX 10
+extern const int cic_9_tables[][10];
+
+/* 2:1 decimator with taps 1,5,10,10,5,1 (5th order CIC), gain 2 */
+struct cic5_state
+{
+	int16_t hist[10];	/* last 5 I/Q pairs of previous block */
+	int	phase;		/* 1: 1st pair of next block does not produce an output */
+};
+
+/*!
+ * Reset state of decimator
+ *
+ * \param s decimator state
+ */
+
+void cic5_init(struct cic5_state *s);
+
+/*!
+ * Decimate interleaved I/Q data by 2 - in place
+ *
+ * \param s decimator state
+ * \param data interleaved I/Q data
+ * \param len number of int16_t values in data
+ * \return number of int16_t values written to data
+ */
+
+int cic5_decimate(struct cic5_state *s, int16_t *data, int len);
+
+
+/* fir filter with arbitrary number of real taps on I/Q data */
+struct cfir_state
+{
+	int	num_taps;	/* internal number: padded to an even number, 0 = not initialized */
+	int	shift;		/* fixed point scaling of coef */
+	int16_t	*coef;		/* num_taps coefficients, oldest input first */
+	int16_t	*work;		/* history of num_taps-1 I/Q pairs, followed by input block */
+	int	work_len;	/* allocated int16_t's in work */
+};
+
+/*!
+ * Setup fir filter
+ *
+ * \param s filter state
+ * \param coef num_taps coefficients, scaled by 2^coef_bits
+ * \param num_taps number of coefficients
+ * \param coef_bits fixed point scaling of coef, e.g. 15 for cic_9_tables
+ * \return 0 on success
+ */
+
+int cfir_init(struct cfir_state *s, const int *coef, int num_taps, int coef_bits);
+
+/*!
+ * Clear history of fir filter
+ *
+ * \param s filter state
+ */
+
+void cfir_reset(struct cfir_state *s);
+
+/*!
+ * Free memory of fir filter
+ *
+ * \param s filter state
+ */
+
+void cfir_free(struct cfir_state *s);
+
+/*!
+ * Filter interleaved I/Q data - in place
+ *
+ * \param s filter state
+ * \param data interleaved I/Q data
+ * \param len number of int16_t values in data
+ * \return 0 on success
+ */
+
+int cfir_filter(struct cfir_state *s, int16_t *data, int len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__DECIMATE_H*/
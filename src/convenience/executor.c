@@ -0,0 +1,246 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE	/* pthread_setaffinity_np */
+#endif
+
+#include "executor.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#define DEQUE_INIT_CAP	64
+
+
+int exec_cpu_count(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return si.dwNumberOfProcessors > 0 ? (int)si.dwNumberOfProcessors : 1;
+#elif defined(_SC_NPROCESSORS_ONLN)
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (int)n : 1;
+#else
+	return 1;
+#endif
+}
+
+/* deque: owner pushes and pops at the tail, thieves take from the head */
+
+static int deque_push(struct exec_deque *q, exec_fn fn, void *arg)
+{
+	struct exec_task *t;
+	int i, cap;
+	if (q->len == q->cap) {
+		cap = q->cap ? 2 * q->cap : DEQUE_INIT_CAP;
+		t = malloc(cap * sizeof(struct exec_task));
+		if (!t)
+			return -1;
+		for (i = 0; i < q->len; i++) {
+			t[i] = q->tasks[(q->head + i) % q->cap];}
+		free(q->tasks);
+		q->tasks = t;
+		q->cap = cap;
+		q->head = 0;
+	}
+	t = &q->tasks[(q->head + q->len) % q->cap];
+	t->fn = fn;
+	t->arg = arg;
+	q->len++;
+	return 0;
+}
+
+static int deque_pop_tail(struct exec_deque *q, struct exec_task *t)
+{
+	int r = 0;
+	pthread_mutex_lock(&q->m);
+	if (q->len) {
+		q->len--;
+		*t = q->tasks[(q->head + q->len) % q->cap];
+		r = 1;
+	}
+	pthread_mutex_unlock(&q->m);
+	return r;
+}
+
+static int deque_steal_head(struct exec_deque *q, struct exec_task *t)
+{
+	int r = 0;
+	/* don't wait for a busy victim, try the next one */
+	if (pthread_mutex_trylock(&q->m))
+		return 0;
+	if (q->len) {
+		*t = q->tasks[q->head];
+		q->head = (q->head + 1) % q->cap;
+		q->len--;
+		r = 1;
+	}
+	pthread_mutex_unlock(&q->m);
+	return r;
+}
+
+static void pin_worker(struct exec_worker *w)
+{
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(w->index % exec_cpu_count(), &set);
+	pthread_setaffinity_np(w->thread, sizeof(set), &set);
+#else
+	(void)w;
+#endif
+}
+
+static void *worker_fn(void *arg)
+{
+	struct exec_worker *w = arg;
+	struct executor *ex = w->ex;
+	struct exec_task t;
+	int i, victim, stolen;
+	while (1) {
+		pthread_mutex_lock(&ex->m);
+		while (!ex->queued && !ex->exit_flag)
+			pthread_cond_wait(&ex->work, &ex->m);
+		if (!ex->queued) {
+			pthread_mutex_unlock(&ex->m);
+			break;
+		}
+		/* one of the queued tasks is ours now, wherever it is */
+		ex->queued--;
+		ex->running++;
+		pthread_mutex_unlock(&ex->m);
+		i = 0;
+		stolen = 0;
+		while (!deque_pop_tail(&ex->deque[w->index], &t)) {
+			victim = (w->index + 1 + i) % ex->workers;
+			i++;
+			if (victim != w->index && deque_steal_head(&ex->deque[victim], &t)) {
+				stolen = 1;
+				break;
+			}
+		}
+		t.fn(t.arg, w->index);
+		pthread_mutex_lock(&ex->m);
+		ex->steals += stolen;
+		ex->running--;
+		if (!ex->queued && !ex->running)
+			pthread_cond_broadcast(&ex->idle);
+		pthread_mutex_unlock(&ex->m);
+	}
+	return 0;
+}
+
+int executor_init(struct executor *ex, int workers, int pin_cpus)
+{
+	int i;
+	memset(ex, 0, sizeof(*ex));
+	if (workers <= 0)
+		workers = exec_cpu_count();
+	if (workers > EXEC_MAX_WORKERS)
+		workers = EXEC_MAX_WORKERS;
+	pthread_mutex_init(&ex->m, NULL);
+	pthread_cond_init(&ex->work, NULL);
+	pthread_cond_init(&ex->idle, NULL);
+	for (i = 0; i < EXEC_MAX_WORKERS; i++) {
+		pthread_mutex_init(&ex->deque[i].m, NULL);}
+	for (i = 0; i < workers; i++) {
+		ex->worker[i].ex = ex;
+		ex->worker[i].index = i;
+		if (pthread_create(&ex->worker[i].thread, NULL, worker_fn, &ex->worker[i])) {
+			fprintf(stderr, "error: can't start worker thread %d!\n", i);
+			break;
+		}
+		ex->workers = i + 1;
+		if (pin_cpus)
+			pin_worker(&ex->worker[i]);
+	}
+	if (!ex->workers) {
+		executor_free(ex);
+		return -1;
+	}
+	return 0;
+}
+
+void executor_free(struct executor *ex)
+{
+	int i;
+	pthread_mutex_lock(&ex->m);
+	ex->exit_flag = 1;
+	pthread_cond_broadcast(&ex->work);
+	pthread_mutex_unlock(&ex->m);
+	for (i = 0; i < ex->workers; i++) {
+		pthread_join(ex->worker[i].thread, NULL);}
+	for (i = 0; i < EXEC_MAX_WORKERS; i++) {
+		pthread_mutex_destroy(&ex->deque[i].m);
+		free(ex->deque[i].tasks);
+		ex->deque[i].tasks = NULL;
+	}
+	pthread_cond_destroy(&ex->idle);
+	pthread_cond_destroy(&ex->work);
+	pthread_mutex_destroy(&ex->m);
+	ex->workers = 0;
+}
+
+static void run_inline(struct executor *ex, exec_fn fn, void *arg)
+{
+	/* out of memory for the queue: better late than never.
+	 * once the workers are idle, worker 0's scratch is free */
+	executor_wait(ex);
+	fn(arg, 0);
+}
+
+void executor_submit(struct executor *ex, exec_fn fn, void *arg, int hint)
+{
+	struct exec_deque *q;
+	int r;
+	if (hint < 0) {
+		/* concurrent submitters may pick the same worker: no harm */
+		hint = ex->next++;
+		if (ex->next >= ex->workers)
+			ex->next = 0;
+	}
+	q = &ex->deque[hint % ex->workers];
+	pthread_mutex_lock(&q->m);
+	r = deque_push(q, fn, arg);
+	pthread_mutex_unlock(&q->m);
+	if (r < 0) {
+		run_inline(ex, fn, arg);
+		return;
+	}
+	pthread_mutex_lock(&ex->m);
+	ex->queued++;
+	pthread_cond_signal(&ex->work);
+	pthread_mutex_unlock(&ex->m);
+}
+
+void executor_wait(struct executor *ex)
+{
+	pthread_mutex_lock(&ex->m);
+	while (ex->queued || ex->running)
+		pthread_cond_wait(&ex->idle, &ex->m);
+	pthread_mutex_unlock(&ex->m);
+}
@@ -0,0 +1,123 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __EXECUTOR_H
+#define __EXECUTOR_H
+
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* thread pool for per-block or per-channel work.
+ * every worker owns a deque: it runs its newest task first, while cache
+ * is warm, idle workers steal the oldest tasks of others.
+ * tasks get the index of the running worker, for per-worker scratch buffers.
+ *
+ * results complete out of order: the submitter waits with executor_wait()
+ * and passes them on in its own order.
+ */
+
+#define EXEC_MAX_WORKERS	64
+
+typedef void (*exec_fn)(void *arg, int worker);
+
+struct exec_task
+{
+	exec_fn	fn;
+	void	*arg;
+};
+
+struct exec_deque
+{
+	pthread_mutex_t m;
+	struct exec_task *tasks;	/* ring */
+	int	cap, head, len;		/* head: oldest task */
+};
+
+struct exec_worker
+{
+	struct executor *ex;
+	int	index;
+	pthread_t thread;
+};
+
+struct executor
+{
+	int	workers;
+	struct exec_deque deque[EXEC_MAX_WORKERS];
+	struct exec_worker worker[EXEC_MAX_WORKERS];
+	int	next;		/* round robin for tasks without hint */
+	int	queued;		/* tasks in all deques */
+	int	running;
+	int	exit_flag;
+	unsigned steals;
+	pthread_mutex_t m;
+	pthread_cond_t work;
+	pthread_cond_t idle;
+};
+
+/*!
+ * Number of online cpus
+ *
+ * \return cpus, at least 1
+ */
+
+int exec_cpu_count(void);
+
+/*!
+ * Start worker threads
+ *
+ * \param ex executor
+ * \param workers number of threads, <= 0 for one per cpu
+ * \param pin_cpus affinity: bind worker i to cpu i (linux only, else ignored)
+ * \return 0 on success, -1 on error
+ */
+
+int executor_init(struct executor *ex, int workers, int pin_cpus);
+
+/*!
+ * Run remaining tasks and stop the worker threads
+ *
+ * \param ex executor
+ */
+
+void executor_free(struct executor *ex);
+
+/*!
+ * Queue a task
+ *
+ * \param ex executor
+ * \param fn function
+ * \param arg argument
+ * \param hint preferred worker, e.g. the channel number to keep a channel's
+ *   state in one cache. -1: round robin
+ */
+
+void executor_submit(struct executor *ex, exec_fn fn, void *arg, int hint);
+
+/*!
+ * Wait until all queued tasks are done
+ *
+ * \param ex executor
+ */
+
+void executor_wait(struct executor *ex);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__EXECUTOR_H*/
@@ -0,0 +1,250 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "fft.h"
+#include "simd.h"
+
+#include <stdlib.h>
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+
+int fft_plan_init(struct fft_plan *p, int n)
+{
+	static const int tw_power[3] = { 2, 1, 3 };
+	int i, b, h, log2n = 0;
+	uint32_t r;
+	float *tw;
+	p->tw = NULL;
+	p->rev = NULL;
+	while ((1 << log2n) < n)
+		log2n++;
+	if (n < 2 || (1 << log2n) != n || log2n > FFT_MAX_LOG2)
+		return -1;
+	p->n = n;
+	p->log2n = log2n;
+	/* 6h floats per radix-4 stage: less than 2n in total */
+	p->tw = malloc(sizeof(float) * 2 * n);
+	p->rev = malloc(sizeof(uint32_t) * n);
+	if (!p->tw || !p->rev) {
+		fft_plan_free(p);
+		return -1;
+	}
+	tw = p->tw;
+	for (h = (log2n & 1) ? 2 : 1; 4*h <= n; h *= 4) {
+		/* w^2j, w^j, w^3j: in the order radix4_*() multiply them */
+		for (b = 0; b < 3; b++) {
+			for (i = 0; i < h; i++, tw += 2) {
+				/* in double: errors of the recurrence would add up */
+				tw[0] = (float)cos(-2.0 * M_PI * tw_power[b] * i / (4*h));
+				tw[1] = (float)sin(-2.0 * M_PI * tw_power[b] * i / (4*h));
+			}
+		}
+	}
+	for (i = 0; i < n; i++) {
+		r = 0;
+		for (b = 0; b < log2n; b++) {
+			r |= ((i >> b) & 1) << (log2n - 1 - b);}
+		p->rev[i] = r;
+	}
+	return 0;
+}
+
+void fft_plan_free(struct fft_plan *p)
+{
+	free(p->tw);
+	free(p->rev);
+	p->tw = NULL;
+	p->rev = NULL;
+}
+
+static void bit_reverse(const struct fft_plan *p, float *d)
+{
+	int i;
+	uint32_t j;
+	float t;
+	for (i = 0; i < p->n; i++) {
+		j = p->rev[i];
+		if ((uint32_t)i >= j)
+			continue;
+		t = d[2*i];   d[2*i]   = d[2*j];   d[2*j]   = t;
+		t = d[2*i+1]; d[2*i+1] = d[2*j+1]; d[2*j+1] = t;
+	}
+}
+
+/* 1st stage for odd log2 n: radix-2, all twiddles 1 */
+static void radix2_first(float *d, int len)
+{
+	int i;
+	float xr, xi;
+	for (i = 0; i < len; i += 2) {
+		xr = d[2*i+2];
+		xi = d[2*i+3];
+		d[2*i+2] = d[2*i]   - xr;
+		d[2*i+3] = d[2*i+1] - xi;
+		d[2*i]   += xr;
+		d[2*i+1] += xi;
+	}
+}
+
+/* radix-4 decimation in time on bit reversed data, two radix-2 stages in one:
+ * c1 = w^2j x1, c2 = w^j x2, c3 = w^3j x3
+ * y0 = x0 + c1 + (c2 + c3)     y1 = x0 - c1 - i (c2 - c3)
+ * y2 = x0 + c1 - (c2 + c3)     y3 = x0 - c1 + i (c2 - c3)
+ * x0..x3, y0..y3 are h apart. w^2j comes first: it's the inner stage's twiddle */
+static void radix4_scalar(float *d, const float *tw, int h, int len)
+{
+	const float *w1 = tw, *w2 = tw + 2*h, *w3 = tw + 4*h;
+	float *x0, *x1, *x2, *x3;
+	float c1r, c1i, c2r, c2i, c3r, c3i, t0r, t0i, t1r, t1i, t2r, t2i, t3r, t3i;
+	int i, j;
+	for (i = 0; i < len; i += 4*h) {
+		for (j = 0; j < h; j++) {
+			x0 = d + 2*(i+j);
+			x1 = x0 + 2*h;
+			x2 = x1 + 2*h;
+			x3 = x2 + 2*h;
+			c1r = x1[0] * w1[2*j] - x1[1] * w1[2*j+1];
+			c1i = x1[0] * w1[2*j+1] + x1[1] * w1[2*j];
+			c2r = x2[0] * w2[2*j] - x2[1] * w2[2*j+1];
+			c2i = x2[0] * w2[2*j+1] + x2[1] * w2[2*j];
+			c3r = x3[0] * w3[2*j] - x3[1] * w3[2*j+1];
+			c3i = x3[0] * w3[2*j+1] + x3[1] * w3[2*j];
+			t0r = x0[0] + c1r;  t0i = x0[1] + c1i;
+			t1r = x0[0] - c1r;  t1i = x0[1] - c1i;
+			t2r = c2r + c3r;    t2i = c2i + c3i;
+			t3r = c2r - c3r;    t3i = c2i - c3i;
+			x0[0] = t0r + t2r;  x0[1] = t0i + t2i;
+			x2[0] = t0r - t2r;  x2[1] = t0i - t2i;
+			/* -i (t3r + i t3i) = t3i - i t3r */
+			x1[0] = t1r + t3i;  x1[1] = t1i - t3r;
+			x3[0] = t1r - t3i;  x3[1] = t1i + t3r;
+		}
+	}
+}
+
+#if defined(RTL_SIMD_SSE2)
+static inline __m128 cmul_sse2(__m128 a, __m128 w)
+{
+	const __m128 neg_re = _mm_castsi128_ps(_mm_set_epi32(0, (int)0x80000000, 0, (int)0x80000000));
+	__m128 wr = _mm_shuffle_ps(w, w, _MM_SHUFFLE(2,2,0,0));
+	__m128 wi = _mm_shuffle_ps(w, w, _MM_SHUFFLE(3,3,1,1));
+	__m128 as = _mm_shuffle_ps(a, a, _MM_SHUFFLE(2,3,0,1));
+	return _mm_add_ps(_mm_mul_ps(a, wr), _mm_xor_ps(_mm_mul_ps(as, wi), neg_re));
+}
+
+/* two butterflies (j, j+1) per iteration, h >= 2 */
+static void radix4_simd(float *d, const float *tw, int h, int len)
+{
+	const __m128 neg_im = _mm_castsi128_ps(_mm_set_epi32((int)0x80000000, 0, (int)0x80000000, 0));
+	const float *w1 = tw, *w2 = tw + 2*h, *w3 = tw + 4*h;
+	__m128 x0, x1, x2, x3, t0, t1, t2, t3;
+	float *p;
+	int i, j;
+	for (i = 0; i < len; i += 4*h) {
+		for (j = 0; j < h; j += 2) {
+			p = d + 2*(i+j);
+			x0 = _mm_loadu_ps(p);
+			x1 = cmul_sse2(_mm_loadu_ps(p + 2*h), _mm_loadu_ps(w1 + 2*j));
+			x2 = cmul_sse2(_mm_loadu_ps(p + 4*h), _mm_loadu_ps(w2 + 2*j));
+			x3 = cmul_sse2(_mm_loadu_ps(p + 6*h), _mm_loadu_ps(w3 + 2*j));
+			t0 = _mm_add_ps(x0, x1);
+			t1 = _mm_sub_ps(x0, x1);
+			t2 = _mm_add_ps(x2, x3);
+			t3 = _mm_sub_ps(x2, x3);
+			/* -i t3 */
+			t3 = _mm_xor_ps(_mm_shuffle_ps(t3, t3, _MM_SHUFFLE(2,3,0,1)), neg_im);
+			_mm_storeu_ps(p,         _mm_add_ps(t0, t2));
+			_mm_storeu_ps(p + 4*h,   _mm_sub_ps(t0, t2));
+			_mm_storeu_ps(p + 2*h,   _mm_add_ps(t1, t3));
+			_mm_storeu_ps(p + 6*h,   _mm_sub_ps(t1, t3));
+		}
+	}
+}
+#elif defined(RTL_SIMD_NEON)
+static inline float32x4_t cmul_neon(float32x4_t a, float32x4_t w)
+{
+	static const float neg_re_f[4] = { -1.0f, 1.0f, -1.0f, 1.0f };
+	float32x4x2_t t = vtrnq_f32(w, w);	/* wr wr, wi wi */
+	float32x4_t as = vrev64q_f32(a);
+	return vaddq_f32(vmulq_f32(a, t.val[0]), vmulq_f32(vmulq_f32(as, t.val[1]), vld1q_f32(neg_re_f)));
+}
+
+static void radix4_simd(float *d, const float *tw, int h, int len)
+{
+	static const float neg_im_f[4] = { 1.0f, -1.0f, 1.0f, -1.0f };
+	const float32x4_t neg_im = vld1q_f32(neg_im_f);
+	const float *w1 = tw, *w2 = tw + 2*h, *w3 = tw + 4*h;
+	float32x4_t x0, x1, x2, x3, t0, t1, t2, t3;
+	float *p;
+	int i, j;
+	for (i = 0; i < len; i += 4*h) {
+		for (j = 0; j < h; j += 2) {
+			p = d + 2*(i+j);
+			x0 = vld1q_f32(p);
+			x1 = cmul_neon(vld1q_f32(p + 2*h), vld1q_f32(w1 + 2*j));
+			x2 = cmul_neon(vld1q_f32(p + 4*h), vld1q_f32(w2 + 2*j));
+			x3 = cmul_neon(vld1q_f32(p + 6*h), vld1q_f32(w3 + 2*j));
+			t0 = vaddq_f32(x0, x1);
+			t1 = vsubq_f32(x0, x1);
+			t2 = vaddq_f32(x2, x3);
+			t3 = vsubq_f32(x2, x3);
+			t3 = vmulq_f32(vrev64q_f32(t3), neg_im);
+			vst1q_f32(p,       vaddq_f32(t0, t2));
+			vst1q_f32(p + 4*h, vsubq_f32(t0, t2));
+			vst1q_f32(p + 2*h, vaddq_f32(t1, t3));
+			vst1q_f32(p + 6*h, vsubq_f32(t1, t3));
+		}
+	}
+}
+#endif
+
+/* all stages over len complex values: blocks of n are independent */
+static void fft_stages(const struct fft_plan *p, float *data, int len)
+{
+	const float *tw = p->tw;
+	int h = 1;
+	if (p->log2n & 1) {
+		radix2_first(data, len);
+		h = 2;
+	}
+	for (; 4*h <= p->n; h *= 4) {
+#if defined(RTL_SIMD_SSE2) || defined(RTL_SIMD_NEON)
+		if (h >= 2)
+			radix4_simd(data, tw, h, len);
+		else
+#endif
+			radix4_scalar(data, tw, h, len);
+		tw += 6*h;
+	}
+}
+
+void fft_forward(const struct fft_plan *p, float *data)
+{
+	bit_reverse(p, data);
+	fft_stages(p, data, p->n);
+}
+
+void fft_forward_batch(const struct fft_plan *p, float *data, int count)
+{
+	int k;
+	for (k = 0; k < count; k++) {
+		bit_reverse(p, data + 2 * k * p->n);}
+	fft_stages(p, data, count * p->n);
+}
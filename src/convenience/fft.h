@@ -0,0 +1,85 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __FFT_H
+#define __FFT_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* complex float32 FFT of power of 2 length.
+ * twiddles and bit reversal are computed once per plan.
+ * data is interleaved re/im, bin k is at frequency k/n of the samplerate,
+ * bins n/2 .. n-1 are the negative frequencies.
+ * radix-4 butterflies (after one radix-2 stage for odd log2 n), with
+ * SSE2/NEON kernels for two butterflies at a time.
+ */
+
+#define FFT_MAX_LOG2	22
+
+struct fft_plan
+{
+	int	n;
+	int	log2n;
+	float	*tw;		/* per radix-4 stage of span h: h twiddles w^2j, then w^j, then w^3j,
+				 * w = exp(-2 pi i/4h), interleaved */
+	uint32_t *rev;		/* bit reversal permutation */
+};
+
+/*!
+ * Setup plan
+ *
+ * \param p plan
+ * \param n length, power of 2 from 2 to 1<<FFT_MAX_LOG2
+ * \return 0 on success, -1 on error
+ */
+
+int fft_plan_init(struct fft_plan *p, int n);
+
+/*!
+ * Free memory of plan
+ *
+ * \param p plan
+ */
+
+void fft_plan_free(struct fft_plan *p);
+
+/*!
+ * Forward transform, in place
+ *
+ * \param p plan
+ * \param data n complex values, interleaved re/im
+ */
+
+void fft_forward(const struct fft_plan *p, float *data);
+
+/*!
+ * Forward transforms of consecutive blocks, in place.
+ * the stages run over all blocks at once: cheaper than single calls for short ones
+ *
+ * \param p plan
+ * \param data count * n complex values, interleaved re/im
+ * \param count number of blocks
+ */
+
+void fft_forward_batch(const struct fft_plan *p, float *data, int count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__FFT_H*/
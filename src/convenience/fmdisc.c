@@ -0,0 +1,561 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fmdisc.h"
+#include "simd.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/* output scaling: pi = 1<<14 */
+#define DISC_PI		(1<<14)
+
+/* atan(a) ~ a + a*s*(P1 + s*(P2 + s*P3)), s = a*a, 0 <= a <= 1. max error ~ 1E-5 rad */
+#define ATAN_P1		-0.327622764f
+#define ATAN_P2		0.15931422f
+#define ATAN_P3		-0.0464964749f
+
+/* same in Q15 */
+#define ATAN_P1_Q15	-10736
+#define ATAN_P2_Q15	5220
+#define ATAN_P3_Q15	-1524
+
+/* interpolated table: atan(k / 2^LUT_BITS) for k = 0 .. 2^LUT_BITS, scaled to pi = 1<<14 */
+#define LUT_BITS	8
+static int16_t atan_lut[(1 << LUT_BITS) + 2];
+static int atan_lut_ready = 0;
+
+static const char * mode_names[FMDISC_NUM_MODES] = {
+	"std", "fast", "lut", "ale", "poly", "polyfix"
+};
+
+
+static void atan_lut_init(void)
+{
+	int k;
+	if (atan_lut_ready)
+		return;
+	for (k = 0; k <= (1 << LUT_BITS); k++)
+		atan_lut[k] = (int16_t)floor(atan((double)k / (1 << LUT_BITS)) / M_PI * DISC_PI + 0.5);
+	atan_lut[(1 << LUT_BITS) + 1] = atan_lut[1 << LUT_BITS];
+	atan_lut_ready = 1;
+}
+
+int fmdisc_init(struct fmdisc_state *s, enum fmdisc_mode mode)
+{
+	memset(s, 0, sizeof(*s));
+	if ((int)mode < 0 || mode >= FMDISC_NUM_MODES)
+		return -1;
+	s->mode = mode;
+	if (mode == FMDISC_LUT)
+		atan_lut_init();
+	return 0;
+}
+
+void fmdisc_free(struct fmdisc_state *s)
+{
+	free(s->cr);
+	free(s->cj);
+	free(s->tmp);
+	s->cr = s->cj = NULL;
+	s->tmp = NULL;
+	s->work_len = 0;
+}
+
+const char * fmdisc_mode_name(enum fmdisc_mode mode)
+{
+	if ((int)mode < 0 || mode >= FMDISC_NUM_MODES)
+		return "?";
+	return mode_names[mode];
+}
+
+
+/* ---------------------------------------------------------------------------
+ * 1st pass: c[k] = s[k] * conj(s[k-1])
+ *   cr = ar*br + aj*bj,  cj = aj*br - ar*bj  with a = s[k], b = s[k-1]
+ * on x86 a single pmaddwd per term: (ar,aj).(br,bj) and (ar,aj).(-bj,br)
+ */
+
+static void conj_products(const int16_t *iq, int n, int32_t *cr, int32_t *cj)
+{
+	int k = 1;
+#if defined(RTL_SIMD_AVX2)
+	{
+	const __m256i neg = _mm256_set1_epi32(0x0001FFFF);	/* int16: -1, 1 */
+	__m256i a, b;
+	for (; k + 8 <= n; k += 8) {
+		a = _mm256_loadu_si256((const __m256i *)(iq + 2*k));
+		b = _mm256_loadu_si256((const __m256i *)(iq + 2*k - 2));
+		_mm256_storeu_si256((__m256i *)(cr + k), _mm256_madd_epi16(a, b));
+		b = _mm256_shufflelo_epi16(b, _MM_SHUFFLE(2,3,0,1));
+		b = _mm256_shufflehi_epi16(b, _MM_SHUFFLE(2,3,0,1));
+		b = _mm256_mullo_epi16(b, neg);
+		_mm256_storeu_si256((__m256i *)(cj + k), _mm256_madd_epi16(a, b));
+	}
+	}
+#endif
+#if defined(RTL_SIMD_SSE2)
+	{
+	const __m128i neg = _mm_set1_epi32(0x0001FFFF);
+	__m128i a, b;
+	for (; k + 4 <= n; k += 4) {
+		a = _mm_loadu_si128((const __m128i *)(iq + 2*k));
+		b = _mm_loadu_si128((const __m128i *)(iq + 2*k - 2));
+		_mm_storeu_si128((__m128i *)(cr + k), _mm_madd_epi16(a, b));
+		b = _mm_shufflelo_epi16(b, _MM_SHUFFLE(2,3,0,1));
+		b = _mm_shufflehi_epi16(b, _MM_SHUFFLE(2,3,0,1));
+		b = _mm_mullo_epi16(b, neg);
+		_mm_storeu_si128((__m128i *)(cj + k), _mm_madd_epi16(a, b));
+	}
+	}
+#elif defined(RTL_SIMD_NEON)
+	{
+	int16x4x2_t a, b;
+	int32x4_t r, j;
+	for (; k + 4 <= n; k += 4) {
+		a = vld2_s16(iq + 2*k);
+		b = vld2_s16(iq + 2*k - 2);
+		r = vmull_s16(a.val[0], b.val[0]);
+		r = vmlal_s16(r, a.val[1], b.val[1]);
+		j = vmull_s16(a.val[1], b.val[0]);
+		j = vmlsl_s16(j, a.val[0], b.val[1]);
+		vst1q_s32(cr + k, r);
+		vst1q_s32(cj + k, j);
+	}
+	}
+#endif
+	for (; k < n; k++) {
+		cr[k] = iq[2*k] * iq[2*k-2] + iq[2*k+1] * iq[2*k-1];
+		cj[k] = iq[2*k+1] * iq[2*k-2] - iq[2*k] * iq[2*k-1];
+	}
+}
+
+
+/* ---------------------------------------------------------------------------
+ * 2nd pass variants
+ */
+
+static void atan_std(const int32_t *cr, const int32_t *cj, int16_t *out, int n)
+{
+	int k;
+	for (k = 0; k < n; k++)
+		out[k] = (int16_t)(atan2((double)cj[k], (double)cr[k]) / M_PI * DISC_PI);
+}
+
+static void atan_fast(const int32_t *cr, const int32_t *cj, int16_t *out, int n)
+{
+	int k, x, y, yabs, angle;
+	const int pi4 = (1<<12), pi34 = 3*(1<<12);
+	for (k = 0; k < n; k++) {
+		x = cr[k];
+		y = cj[k];
+		if (x == 0 && y == 0) {
+			out[k] = 0;
+			continue;
+		}
+		/* keep pi4 * (..) within int */
+		while (x > 0x3FFFF || x < -0x3FFFF || y > 0x3FFFF || y < -0x3FFFF) {
+			x /= 2;
+			y /= 2;
+		}
+		yabs = (y < 0) ? -y : y;
+		if (x >= 0)
+			angle = pi4  - pi4 * (x-yabs) / (x+yabs);
+		else
+			angle = pi34 - pi4 * (x+yabs) / (yabs-x);
+		out[k] = (int16_t)((y < 0) ? -angle : angle);
+	}
+}
+
+/* |x|, |y| -> min/max ratio in Q15, ratio 0 .. 32768 */
+static inline int ratio_q15(unsigned ax, unsigned ay, int *swapped)
+{
+	unsigned mn, mx;
+	if (ay > ax) {
+		mn = ax; mx = ay; *swapped = 1;
+	} else {
+		mn = ay; mx = ax; *swapped = 0;
+	}
+	if (!mx)
+		return 0;
+	while (mx >= 0x10000) {
+		mx >>= 1;
+		mn >>= 1;
+	}
+	return (int)((mn << 15) / mx);
+}
+
+/* octant -> full circle, angle in output units */
+static inline int16_t unfold(int angle, int swapped, int32_t x, int32_t y)
+{
+	if (swapped)
+		angle = DISC_PI/2 - angle;
+	if (x < 0)
+		angle = DISC_PI - angle;
+	return (int16_t)((y < 0) ? -angle : angle);
+}
+
+static void atan_lut_interp(const int32_t *cr, const int32_t *cj, int16_t *out, int n)
+{
+	int k, a, i, f, sw;
+	unsigned ax, ay;
+	for (k = 0; k < n; k++) {
+		ax = (cr[k] < 0) ? -(unsigned)cr[k] : (unsigned)cr[k];
+		ay = (cj[k] < 0) ? -(unsigned)cj[k] : (unsigned)cj[k];
+		a = ratio_q15(ax, ay, &sw);
+		i = a >> (15 - LUT_BITS);
+		f = a & ((1 << (15 - LUT_BITS)) - 1);
+		a = atan_lut[i] + (((atan_lut[i+1] - atan_lut[i]) * f + (1 << (14 - LUT_BITS))) >> (15 - LUT_BITS));
+		out[k] = unfold(a, sw, cr[k], cj[k]);
+	}
+}
+
+static void atan_poly_fixed(const int32_t *cr, const int32_t *cj, int16_t *out, int n)
+{
+	int k, a, s, r, sw;
+	unsigned ax, ay;
+	for (k = 0; k < n; k++) {
+		ax = (cr[k] < 0) ? -(unsigned)cr[k] : (unsigned)cr[k];
+		ay = (cj[k] < 0) ? -(unsigned)cj[k] : (unsigned)cj[k];
+		a = ratio_q15(ax, ay, &sw);
+		s = (a * a) >> 15;
+		r = ATAN_P2_Q15 + ((s * ATAN_P3_Q15) >> 15);
+		r = ATAN_P1_Q15 + ((s * r) >> 15);
+		r = a + (int)(((int64_t)a * ((s * r) >> 15)) >> 15);
+		/* radians in Q15 -> pi = 1<<14: * 2^14/pi / 2^15 */
+		r = (r * 10430 + (1 << 15)) >> 16;
+		out[k] = unfold(r, sw, cr[k], cj[k]);
+	}
+}
+
+static inline float atan2_poly(float y, float x)
+{
+	float ax = fabsf(x), ay = fabsf(y);
+	float mx = (ax > ay) ? ax : ay;
+	float mn = (ax > ay) ? ay : ax;
+	float a = (mx > 0.0f) ? mn / mx : 0.0f;
+	float s = a * a;
+	float r = a + a * s * (ATAN_P1 + s * (ATAN_P2 + s * ATAN_P3));
+	if (ay > ax)
+		r = (float)(M_PI / 2) - r;
+	if (x < 0.0f)
+		r = (float)M_PI - r;
+	return (y < 0.0f) ? -r : r;
+}
+
+/* 4 x atan2(cj, cr) in output units */
+#if defined(RTL_SIMD_SSE2)
+static inline __m128 atan2_poly4(const int32_t *cr, const int32_t *cj)
+{
+	const __m128 sign = _mm_set1_ps(-0.0f);
+	const __m128 pi = _mm_set1_ps((float)M_PI), pi2 = _mm_set1_ps((float)(M_PI / 2));
+	__m128 x, y, ax, ay, a, s, r, m;
+	x = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)cr));
+	y = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)cj));
+	ax = _mm_andnot_ps(sign, x);
+	ay = _mm_andnot_ps(sign, y);
+	a = _mm_div_ps(_mm_min_ps(ax, ay), _mm_max_ps(_mm_max_ps(ax, ay), _mm_set1_ps(1E-30f)));
+	s = _mm_mul_ps(a, a);
+	r = _mm_add_ps(_mm_set1_ps(ATAN_P2), _mm_mul_ps(s, _mm_set1_ps(ATAN_P3)));
+	r = _mm_add_ps(_mm_set1_ps(ATAN_P1), _mm_mul_ps(s, r));
+	r = _mm_add_ps(a, _mm_mul_ps(_mm_mul_ps(a, s), r));
+	/* ay > ax: pi/2 - r */
+	m = _mm_cmpgt_ps(ay, ax);
+	r = _mm_or_ps(_mm_and_ps(m, _mm_sub_ps(pi2, r)), _mm_andnot_ps(m, r));
+	/* x < 0: pi - r */
+	m = _mm_cmplt_ps(x, _mm_setzero_ps());
+	r = _mm_or_ps(_mm_and_ps(m, _mm_sub_ps(pi, r)), _mm_andnot_ps(m, r));
+	/* sign of y */
+	r = _mm_xor_ps(r, _mm_and_ps(sign, y));
+	return _mm_mul_ps(r, _mm_set1_ps((float)(DISC_PI / M_PI)));
+}
+#elif defined(RTL_SIMD_NEON)
+static inline float32x4_t atan2_poly4(const int32_t *cr, const int32_t *cj)
+{
+	const float32x4_t zero = vdupq_n_f32(0.0f);
+	float32x4_t x, y, ax, ay, mx, a, s, r, inv;
+	x = vcvtq_f32_s32(vld1q_s32(cr));
+	y = vcvtq_f32_s32(vld1q_s32(cj));
+	ax = vabsq_f32(x);
+	ay = vabsq_f32(y);
+	mx = vmaxq_f32(vmaxq_f32(ax, ay), vdupq_n_f32(1E-30f));
+	/* reciprocal estimate + 2 newton steps */
+	inv = vrecpeq_f32(mx);
+	inv = vmulq_f32(vrecpsq_f32(mx, inv), inv);
+	inv = vmulq_f32(vrecpsq_f32(mx, inv), inv);
+	a = vmulq_f32(vminq_f32(ax, ay), inv);
+	s = vmulq_f32(a, a);
+	r = vmlaq_f32(vdupq_n_f32(ATAN_P2), s, vdupq_n_f32(ATAN_P3));
+	r = vmlaq_f32(vdupq_n_f32(ATAN_P1), s, r);
+	r = vmlaq_f32(a, vmulq_f32(a, s), r);
+	r = vbslq_f32(vcgtq_f32(ay, ax), vsubq_f32(vdupq_n_f32((float)(M_PI / 2)), r), r);
+	r = vbslq_f32(vcltq_f32(x, zero), vsubq_f32(vdupq_n_f32((float)M_PI), r), r);
+	r = vbslq_f32(vcltq_f32(y, zero), vnegq_f32(r), r);
+	return vmulq_n_f32(r, (float)(DISC_PI / M_PI));
+}
+
+/* round to nearest */
+static inline int32x4_t round_s32(float32x4_t r)
+{
+	r = vaddq_f32(r, vbslq_f32(vcltq_f32(r, vdupq_n_f32(0.0f)), vdupq_n_f32(-0.5f), vdupq_n_f32(0.5f)));
+	return vcvtq_s32_f32(r);
+}
+#endif
+
+static void atan_poly(const int32_t *cr, const int32_t *cj, int16_t *out, int n)
+{
+	const float scale = (float)(DISC_PI / M_PI);
+	int k = 0;
+#if defined(RTL_SIMD_SSE2)
+	for (; k + 8 <= n; k += 8) {
+		_mm_storeu_si128((__m128i *)(out + k), _mm_packs_epi32(
+			_mm_cvtps_epi32(atan2_poly4(cr + k, cj + k)),
+			_mm_cvtps_epi32(atan2_poly4(cr + k + 4, cj + k + 4)) ));
+	}
+#elif defined(RTL_SIMD_NEON)
+	for (; k + 8 <= n; k += 8) {
+		vst1q_s16(out + k, vcombine_s16(
+			vqmovn_s32(round_s32(atan2_poly4(cr + k, cj + k))),
+			vqmovn_s32(round_s32(atan2_poly4(cr + k + 4, cj + k + 4))) ));
+	}
+#endif
+	for (; k < n; k++)
+		out[k] = (int16_t)lrintf(atan2_poly((float)cj[k], (float)cr[k]) * scale);
+}
+
+static void atan_poly_f(const int32_t *cr, const int32_t *cj, float *out, int n)
+{
+	const float scale = (float)(DISC_PI / M_PI);
+	int k = 0;
+#if defined(RTL_SIMD_SSE2)
+	for (; k + 4 <= n; k += 4)
+		_mm_storeu_ps(out + k, atan2_poly4(cr + k, cj + k));
+#elif defined(RTL_SIMD_NEON)
+	for (; k + 4 <= n; k += 4)
+		vst1q_f32(out + k, atan2_poly4(cr + k, cj + k));
+#endif
+	for (; k < n; k++)
+		out[k] = atan2_poly((float)cj[k], (float)cr[k]) * scale;
+}
+
+static void atan_std_f(const int32_t *cr, const int32_t *cj, float *out, int n)
+{
+	int k;
+	for (k = 0; k < n; k++)
+		out[k] = (float)(atan2((double)cj[k], (double)cr[k]) / M_PI * DISC_PI);
+}
+
+static void esbensen(const int16_t *iq, const int32_t *cj, int16_t *out, int n)
+/*
+  input signal: s(t) = a*exp(-i*w*t+p)
+  a = amplitude, w = angular freq, p = phase difference
+  solve w
+  s' = -i(w)*a*exp(-i*w*t+p)
+  s'*conj(s) = -i*w*a*a
+  s'*conj(s) / |s|^2 = -i*w
+  imag(ds * conj(s)) with ds = 2*(s[k-1] - s[k]) equals -2 * cj
+*/
+{
+	const int scaled_pi = 2608; /* 1<<14 / (2*pi) */
+	int k;
+	int64_t ar, aj;
+	for (k = 0; k < n; k++) {
+		ar = iq[2*k];
+		aj = iq[2*k+1];
+		out[k] = (int16_t)(scaled_pi * 2 * (int64_t)cj[k] / (ar*ar + aj*aj + 1));
+	}
+}
+
+static void esbensen_f(const int16_t *iq, const int32_t *cj, float *out, int n)
+{
+	const float scale = (float)(DISC_PI / M_PI);
+	float ar, aj;
+	int k;
+	for (k = 0; k < n; k++) {
+		ar = iq[2*k];
+		aj = iq[2*k+1];
+		out[k] = scale * (float)cj[k] / (ar*ar + aj*aj + 1.0f);
+	}
+}
+
+/* 1st pass for a block: returns number of output samples */
+static int prepare(struct fmdisc_state *s, const int16_t *iq, int len)
+{
+	int n = len / 2;
+	if (n <= 0)
+		return 0;
+	if (n > s->work_len) {
+		int32_t *r = realloc(s->cr, n * sizeof(int32_t));
+		int32_t *j;
+		int16_t *t;
+		if (!r)
+			return -1;
+		s->cr = r;
+		j = realloc(s->cj, n * sizeof(int32_t));
+		if (!j)
+			return -1;
+		s->cj = j;
+		t = realloc(s->tmp, n * sizeof(int16_t));
+		if (!t)
+			return -1;
+		s->tmp = t;
+		s->work_len = n;
+	}
+	s->cr[0] = iq[0] * s->pre_r + iq[1] * s->pre_j;
+	s->cj[0] = iq[1] * s->pre_r - iq[0] * s->pre_j;
+	conj_products(iq, n, s->cr, s->cj);
+	s->pre_r = iq[len - 2];
+	s->pre_j = iq[len - 1];
+	return n;
+}
+
+int fmdisc_demod(struct fmdisc_state *s, const int16_t *iq, int len, int16_t *out)
+{
+	int n = prepare(s, iq, len);
+	if (n <= 0)
+		return n;
+
+	switch (s->mode) {
+	case FMDISC_STD:
+		atan_std(s->cr, s->cj, out, n);
+		break;
+	case FMDISC_FAST:
+		atan_fast(s->cr, s->cj, out, n);
+		break;
+	case FMDISC_LUT:
+		atan_lut_interp(s->cr, s->cj, out, n);
+		break;
+	case FMDISC_ESBENSEN:
+		esbensen(iq, s->cj, out, n);
+		break;
+	case FMDISC_POLY:
+		atan_poly(s->cr, s->cj, out, n);
+		break;
+	case FMDISC_POLY_FIXED:
+		atan_poly_fixed(s->cr, s->cj, out, n);
+		break;
+	default:
+		return -1;
+	}
+	return n;
+}
+
+int fmdisc_demod_f(struct fmdisc_state *s, const int16_t *iq, int len, float *out)
+{
+	int k, n = prepare(s, iq, len);
+	if (n <= 0)
+		return n;
+
+	switch (s->mode) {
+	case FMDISC_STD:
+		atan_std_f(s->cr, s->cj, out, n);
+		break;
+	case FMDISC_ESBENSEN:
+		esbensen_f(iq, s->cj, out, n);
+		break;
+	case FMDISC_POLY:
+		atan_poly_f(s->cr, s->cj, out, n);
+		break;
+	default:
+		/* integer only variants */
+		switch (s->mode) {
+		case FMDISC_FAST:
+			atan_fast(s->cr, s->cj, s->tmp, n);
+			break;
+		case FMDISC_LUT:
+			atan_lut_interp(s->cr, s->cj, s->tmp, n);
+			break;
+		case FMDISC_POLY_FIXED:
+			atan_poly_fixed(s->cr, s->cj, s->tmp, n);
+			break;
+		default:
+			return -1;
+		}
+		for (k = 0; k < n; k++)
+			out[k] = s->tmp[k];
+		break;
+	}
+	return n;
+}
+
+
+void fmdisc_benchmark(FILE *f, int num_samples)
+{
+	struct fmdisc_state s;
+	int16_t *iq, *out;
+	double *ref, phase = 0.0, err, maxErr, sumErr, secs, d;
+	int k, m, rep, reps;
+	clock_t t0;
+
+	iq = malloc(2 * num_samples * sizeof(int16_t));
+	out = malloc(num_samples * sizeof(int16_t));
+	ref = malloc(num_samples * sizeof(double));
+	if (!iq || !out || !ref) {
+		free(iq); free(out); free(ref);
+		return;
+	}
+	/* random amplitude and phase steps, steps within +-pi/2 like an oversampled fm signal */
+	srand(1);
+	for (k = 0; k < num_samples; k++) {
+		double amp = 64.0 + (rand() % 8000);
+		phase += ((double)rand() / RAND_MAX - 0.5) * M_PI;
+		iq[2*k]   = (int16_t)floor(amp * cos(phase) + 0.5);
+		iq[2*k+1] = (int16_t)floor(amp * sin(phase) + 0.5);
+	}
+	for (k = 0; k < num_samples; k++) {
+		double br = k ? iq[2*k-2] : 0.0, bj = k ? iq[2*k-1] : 0.0;
+		double cr = iq[2*k] * br + iq[2*k+1] * bj;
+		double cj = iq[2*k+1] * br - iq[2*k] * bj;
+		ref[k] = atan2(cj, cr) / M_PI * DISC_PI;
+	}
+	/* about 50 M samples per mode */
+	reps = 50000000 / num_samples;
+	if (reps < 1)
+		reps = 1;
+
+	fprintf(f, "fm discriminator: %d samples, %d repetitions, error in output units (pi = %d)\n",
+		num_samples, reps, DISC_PI);
+	fprintf(f, "%-8s %10s %10s %12s\n", "mode", "max err", "rms err", "Msamples/s");
+	for (m = 0; m < FMDISC_NUM_MODES; m++) {
+		fmdisc_init(&s, (enum fmdisc_mode)m);
+		fmdisc_demod(&s, iq, 2 * num_samples, out);
+		maxErr = sumErr = 0.0;
+		for (k = 1; k < num_samples; k++) {
+			err = fabs(out[k] - ref[k]);
+			if (err > DISC_PI)
+				err = 2 * DISC_PI - err;
+			sumErr += err * err;
+			if (err > maxErr)
+				maxErr = err;
+		}
+		t0 = clock();
+		for (rep = 0; rep < reps; rep++)
+			fmdisc_demod(&s, iq, 2 * num_samples, out);
+		secs = (double)(clock() - t0) / CLOCKS_PER_SEC;
+		d = secs > 0.0 ? (double)reps * num_samples / secs * 1E-6 : 0.0;
+		fprintf(f, "%-8s %10.1f %10.2f %12.1f\n", fmdisc_mode_name((enum fmdisc_mode)m),
+			maxErr, sqrt(sumErr / (num_samples - 1)), d);
+		fmdisc_free(&s);
+	}
+	free(iq);
+	free(out);
+	free(ref);
+}
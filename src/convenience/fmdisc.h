@@ -0,0 +1,115 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __FMDISC_H
+#define __FMDISC_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* block oriented FM discriminator for interleaved 16 bit I/Q data.
+ * 1st pass computes the conjugate products s[n] * conj(s[n-1]) of the whole block,
+ * 2nd pass converts all of them to angles with the selected atan2 variant.
+ * output is the phase difference scaled to pi = 1<<14.
+ */
+
+enum fmdisc_mode
+{
+	FMDISC_STD = 0,		/* libm atan2() */
+	FMDISC_FAST,		/* coarse rational approximation */
+	FMDISC_LUT,		/* small interpolated table, fits into L1 cache */
+	FMDISC_ESBENSEN,	/* small angle approximation, no atan at all */
+	FMDISC_POLY,		/* float polynomial, SIMD */
+	FMDISC_POLY_FIXED,	/* fixed point polynomial, for cpus without float */
+	FMDISC_NUM_MODES
+};
+
+struct fmdisc_state
+{
+	enum fmdisc_mode mode;
+	int16_t	pre_r, pre_j;	/* last I/Q pair of previous block */
+	int32_t	*cr, *cj;	/* conjugate products of current block */
+	int16_t	*tmp;		/* integer results for fmdisc_demod_f() */
+	int	work_len;
+};
+
+/*!
+ * Setup discriminator
+ *
+ * \param s discriminator state
+ * \param mode one of enum fmdisc_mode
+ * \return 0 on success
+ */
+
+int fmdisc_init(struct fmdisc_state *s, enum fmdisc_mode mode);
+
+/*!
+ * Free memory of discriminator
+ *
+ * \param s discriminator state
+ */
+
+void fmdisc_free(struct fmdisc_state *s);
+
+/*!
+ * Get name of a mode, as used for rtl_fm's option -A
+ *
+ * \param mode one of enum fmdisc_mode
+ * \return name
+ */
+
+const char * fmdisc_mode_name(enum fmdisc_mode mode);
+
+/*!
+ * Demodulate a block
+ *
+ * \param s discriminator state
+ * \param iq interleaved I/Q data
+ * \param len number of int16_t values in iq
+ * \param out len/2 output samples. may be the same buffer as iq
+ * \return number of output samples, -1 on error
+ */
+
+int fmdisc_demod(struct fmdisc_state *s, const int16_t *iq, int len, int16_t *out);
+
+/*!
+ * Demodulate a block to float32, same scale as fmdisc_demod()
+ *
+ * \param s discriminator state
+ * \param iq interleaved I/Q data
+ * \param len number of int16_t values in iq
+ * \param out len/2 output samples
+ * \return number of output samples, -1 on error
+ */
+
+int fmdisc_demod_f(struct fmdisc_state *s, const int16_t *iq, int len, float *out);
+
+/*!
+ * Measure accuracy and throughput of all modes and print a table
+ *
+ * \param f output stream, e.g. stderr
+ * \param num_samples number of I/Q pairs in test signal
+ */
+
+void fmdisc_benchmark(FILE *f, int num_samples);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__FMDISC_H*/
@@ -0,0 +1,266 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "measstream.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#define closesocket close
+#else
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <io.h>
+#pragma comment(lib, "ws2_32.lib")
+#define open _open
+#define write _write
+#define close _close
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#define MEAS_FILE_BATCH		65536
+#define MEAS_PIPE_BATCH		4096	/* PIPE_BUF on linux: written atomically */
+#define MEAS_UDP_BATCH		1400	/* no ip fragmentation on ethernet */
+#define MEAS_JSON_MAX		256	/* longest ndjson line */
+
+
+double meas_time(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + 1E-6 * tv.tv_usec;
+}
+
+float meas_db(double level)
+{
+	return (float)(20.0 * log10(1E-10 + level));
+}
+
+static void make_header(struct meas_header *h)
+{
+	memset(h, 0, sizeof(*h));
+	memcpy(h->magic, MEAS_MAGIC, sizeof(MEAS_MAGIC));
+	h->version = MEAS_VERSION;
+	h->record_size = sizeof(struct meas_record);
+	h->byte_order = MEAS_BYTE_ORDER;
+}
+
+static void put_header(struct meas_stream *m)
+{
+	struct meas_header h;
+	make_header(&h);
+	memcpy(m->buf + m->len, &h, sizeof(h));
+	m->len += sizeof(h);
+}
+
+static int open_udp(struct meas_stream *m, const char *target)
+{
+	char host[256];
+	const char *port;
+	struct addrinfo hints, *res = NULL;
+	int fd;
+#ifdef _WIN32
+	WSADATA wsd;
+	WSAStartup(MAKEWORD(2,2), &wsd);
+#endif
+	port = strrchr(target, ':');
+	if (!port || port == target || port - target >= (int)sizeof(host)) {
+		fprintf(stderr, "error: measurement stream '%s' needs udp:host:port\n", target);
+		return -1;
+	}
+	memcpy(host, target, port - target);
+	host[port - target] = 0;
+	port++;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	if (getaddrinfo(host, port, &hints, &res) || !res) {
+		fprintf(stderr, "error: can't resolve measurement stream host '%s'\n", host);
+		return -1;
+	}
+	fd = (int)socket(res->ai_family, SOCK_DGRAM, 0);
+	if (fd < 0 || res->ai_addrlen > sizeof(m->addr)) {
+		freeaddrinfo(res);
+		return -1;
+	}
+	memcpy(m->addr, res->ai_addr, res->ai_addrlen);
+	m->addr_len = (int)res->ai_addrlen;
+	freeaddrinfo(res);
+	return fd;
+}
+
+static void close_fd(struct meas_stream *m)
+{
+	if (m->udp)
+		closesocket(m->fd);
+	else
+		close(m->fd);
+	m->fd = -1;
+}
+
+int meas_stream_open(struct meas_stream *m, const char *target, int format)
+{
+#ifndef _WIN32
+	struct stat st;
+#endif
+	memset(m, 0, sizeof(*m));
+	m->fd = -1;
+	m->format = format;
+	m->second = -1;
+	if (!strncmp(target, "udp:", 4)) {
+		m->udp = 1;
+		m->fd = open_udp(m, target + 4);
+		m->cap = MEAS_UDP_BATCH;
+	} else {
+#ifndef _WIN32
+		/* nonblocking: a slow reader costs records, not time.
+		 * read-write: opens without a reader - O_WRONLY fails with ENXIO -
+		 * and there is no SIGPIPE when a reader goes away */
+		if (!stat(target, &st) && S_ISFIFO(st.st_mode)) {
+			m->fd = open(target, O_RDWR | O_NONBLOCK);
+			m->cap = MEAS_PIPE_BATCH;
+		} else
+#endif
+		{
+			m->fd = open(target, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+			m->cap = MEAS_FILE_BATCH;
+		}
+	}
+	if (m->fd < 0) {
+		fprintf(stderr, "error: can't open measurement stream '%s'\n", target);
+		return -1;
+	}
+#ifndef _WIN32
+	/* not for trigger commands or other children */
+	fcntl(m->fd, F_SETFD, FD_CLOEXEC);
+#endif
+	m->buf = malloc(m->cap);
+	if (!m->buf) {
+		close_fd(m);
+		return -1;
+	}
+	pthread_mutex_init(&m->m, NULL);
+	/* binary: the header once, written before the first batch,
+	 * except for udp where every datagram gets it */
+	if (format == MEAS_BINARY && m->udp)
+		put_header(m);
+	m->header_pending = (format == MEAS_BINARY && !m->udp);
+	m->rec_start = m->len;
+	return 0;
+}
+
+static int write_batch(struct meas_stream *m, const char *p, int len)
+{
+	int r;
+	if (m->udp)
+		return sendto(m->fd, p, len, 0, (const struct sockaddr *)m->addr, m->addr_len) == len ? 0 : -1;
+	while (len) {
+		r = (int)write(m->fd, p, len);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return -1;
+		p += r;
+		len -= r;
+	}
+	return 0;
+}
+
+static void flush_locked(struct meas_stream *m)
+{
+	struct meas_header h;
+	if (m->header_pending) {
+		/* until it is written: records without it can't be parsed */
+		make_header(&h);
+		if (write_batch(m, (const char *)&h, sizeof(h)) == 0)
+			m->header_pending = 0;
+	}
+	if (m->len <= m->rec_start)
+		return;
+	if (m->header_pending || write_batch(m, m->buf, m->len) < 0)
+		m->dropped += m->batch;
+	m->len = m->rec_start;
+	m->batch = 0;
+}
+
+void meas_stream_flush(struct meas_stream *m)
+{
+	if (m->fd < 0)
+		return;
+	pthread_mutex_lock(&m->m);
+	flush_locked(m);
+	pthread_mutex_unlock(&m->m);
+}
+
+void meas_stream_tick(struct meas_stream *m, double now)
+{
+	if (m->fd < 0)
+		return;
+	pthread_mutex_lock(&m->m);
+	if (m->batch && (long)floor(now) != m->second)
+		flush_locked(m);
+	pthread_mutex_unlock(&m->m);
+}
+
+void meas_stream_add(struct meas_stream *m, const struct meas_record *r)
+{
+	static const char *trig[] = { "none", "off", "on", "hold" };
+	long second = (long)floor(r->ts);
+	int need = (m->format == MEAS_BINARY) ? (int)sizeof(*r) : MEAS_JSON_MAX;
+	if (m->fd < 0)
+		return;
+	pthread_mutex_lock(&m->m);
+	if ((m->second >= 0 && second != m->second) || m->len + need > m->cap)
+		flush_locked(m);
+	m->second = second;
+	if (m->format == MEAS_BINARY) {
+		memcpy(m->buf + m->len, r, sizeof(*r));
+		m->len += sizeof(*r);
+	} else {
+		m->len += snprintf(m->buf + m->len, m->cap - m->len,
+			"{\"ts\":%.3f,\"freq\":%.0f,\"rms\":%.2f,\"peak\":%.2f,"
+			"\"adc_max\":%.0f,\"adc_rms\":%.1f,\"trigger\":\"%s\",\"line\":%d}\n",
+			r->ts, (double)r->freq, r->rms, r->peak, r->adc_max, r->adc_rms,
+			trig[(r->trigger >= 0 && r->trigger <= MEAS_TRIG_HOLD) ? r->trigger : 0], (int)r->line);
+	}
+	m->batch++;
+	m->records++;
+	pthread_mutex_unlock(&m->m);
+}
+
+void meas_stream_close(struct meas_stream *m)
+{
+	if (m->fd < 0)
+		return;
+	meas_stream_flush(m);
+	close_fd(m);
+	free(m->buf);
+	m->buf = NULL;
+	pthread_mutex_destroy(&m->m);
+}
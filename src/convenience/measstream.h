@@ -0,0 +1,156 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __MEASSTREAM_H
+#define __MEASSTREAM_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* stream of level measurements, for machines instead of humans.
+ * records are collected and written once per second - or earlier, when a
+ * batch reaches the size written atomically: 4 kB for pipes, 1400 bytes
+ * for udp datagrams, 64 kB else. meas_stream_tick() writes the batch of a
+ * past second when no more records arrive.
+ *
+ * binary format, host byte order:
+ *   struct meas_header once at the start of a file or pipe and at the start
+ *   of every udp datagram, followed by struct meas_record's.
+ * ndjson format:
+ *   one JSON object per line and record, no header.
+ *
+ * target: "udp:host:port" or the path of a file or fifo.
+ */
+
+#define MEAS_MAGIC		"RTLMEAS"
+#define MEAS_VERSION		1
+#define MEAS_BYTE_ORDER		0x01020304
+
+enum meas_format { MEAS_BINARY = 0, MEAS_NDJSON };
+
+enum meas_trigger {
+	MEAS_TRIG_NONE = 0,	/* no trigger criterion, e.g. levels of -l */
+	MEAS_TRIG_OFF,		/* criterion not met */
+	MEAS_TRIG_ON,		/* criterion met: trigger activated */
+	MEAS_TRIG_HOLD		/* criterion met, but blocked after a recent trigger */
+};
+
+struct meas_header
+{
+	char	magic[8];	/* MEAS_MAGIC, 0 terminated */
+	uint16_t version;	/* MEAS_VERSION */
+	uint16_t record_size;	/* sizeof(struct meas_record) */
+	uint32_t byte_order;	/* MEAS_BYTE_ORDER as written by the host */
+};
+
+struct meas_record
+{
+	double	ts;		/* unix time */
+	uint64_t freq;		/* Hz */
+	float	rms;		/* dB: rms level, averaged over the measurement */
+	float	peak;		/* dB: highest block rms of the measurement */
+	float	adc_max;	/* highest ADC value - 127, < 0: not measured */
+	float	adc_rms;	/* ADC rms, < 0: not measured */
+	int32_t	trigger;	/* enum meas_trigger */
+	int32_t	line;		/* of the command file, 0 without */
+};
+
+struct meas_stream
+{
+	int	fd;		/* -1: closed */
+	int	udp;
+	int	format;		/* enum meas_format */
+	unsigned char addr[128];	/* udp destination */
+	int	addr_len;
+	char	*buf;
+	int	len, cap;
+	int	rec_start;	/* where records start in buf: after a udp header */
+	int	batch;		/* records in buf */
+	int	header_pending;	/* binary file or fifo: header not written yet */
+	long	second;		/* of the batch in buf */
+	unsigned records, dropped;
+	pthread_mutex_t m;
+};
+
+/*!
+ * Open a measurement stream
+ *
+ * \param m state
+ * \param target "udp:host:port", path of file or fifo
+ * \param format enum meas_format
+ * \return 0 on success, -1 on error
+ */
+
+int meas_stream_open(struct meas_stream *m, const char *target, int format);
+
+/*!
+ * Add a record. thread safe, writes when a second or batch is full
+ *
+ * \param m state
+ * \param r record
+ */
+
+void meas_stream_add(struct meas_stream *m, const struct meas_record *r);
+
+/*!
+ * Write the collected records when their second is over. call periodically
+ *
+ * \param m state
+ * \param now unix time, e.g. meas_time()
+ */
+
+void meas_stream_tick(struct meas_stream *m, double now);
+
+/*!
+ * Write all collected records
+ *
+ * \param m state
+ */
+
+void meas_stream_flush(struct meas_stream *m);
+
+/*!
+ * Flush and close
+ *
+ * \param m state
+ */
+
+void meas_stream_close(struct meas_stream *m);
+
+/*!
+ * Current unix time
+ *
+ * \return seconds since 1970 as double
+ */
+
+double meas_time(void);
+
+/*!
+ * Convert a linear level to dB, for the record fields
+ *
+ * \param level rms, > 0
+ * \return 20 log10(level)
+ */
+
+float meas_db(double level);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__MEASSTREAM_H*/
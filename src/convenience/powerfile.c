@@ -0,0 +1,120 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "powerfile.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+
+static uint32_t values_size(const struct power_header *h)
+{
+	uint32_t n = h->tune_count * h->bins;
+	n *= (h->format == POWER_U16) ? sizeof(uint16_t) : sizeof(float);
+	return (n + 7) & ~7u;
+}
+
+int power_file_open(struct power_file *p, FILE *f, const char *index_path,
+	int format, const struct power_tune *tunes, int tune_count, int bins)
+{
+	struct power_header *h = &p->h;
+	memset(p, 0, sizeof(*p));
+	memcpy(h->magic, POWER_MAGIC, sizeof(POWER_MAGIC));
+	h->version = POWER_VERSION;
+	h->format = (uint16_t)format;
+	h->byte_order = POWER_BYTE_ORDER;
+	h->tune_count = (uint32_t)tune_count;
+	h->bins = (uint32_t)bins;
+	h->header_size = sizeof(struct power_header) + tune_count * sizeof(struct power_tune);
+	h->record_size = sizeof(struct power_record) + ((tune_count * sizeof(uint32_t) + 7) & ~7u)
+		+ values_size(h);
+	if (format == POWER_U16) {
+		h->q_offset = POWER_Q_OFFSET;
+		h->q_step = POWER_Q_STEP;
+	}
+	p->rec = calloc(1, h->record_size);
+	if (!p->rec)
+		return -1;
+	p->f = f;
+	if (fwrite(h, sizeof(*h), 1, f) != 1 ||
+	    fwrite(tunes, sizeof(struct power_tune), tune_count, f) != (size_t)tune_count) {
+		fprintf(stderr, "Error: can't write the log header.\n");
+		power_file_close(p);
+		return -1;
+	}
+	p->offset = h->header_size;
+	if (index_path) {
+		p->idx = fopen(index_path, "wb");
+		if (!p->idx) {
+			fprintf(stderr, "Failed to open %s\n", index_path);
+			power_file_close(p);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void power_file_put(struct power_file *p, int tune, uint32_t samples, const float *db)
+{
+	const struct power_header *h = &p->h;
+	unsigned char *v;
+	uint16_t *q;
+	float x;
+	uint32_t i;
+	memcpy(p->rec + sizeof(struct power_record) + tune * sizeof(uint32_t),
+		&samples, sizeof(uint32_t));
+	v = p->rec + h->record_size - values_size(h);
+	if (h->format != POWER_U16) {
+		memcpy(v + tune * h->bins * sizeof(float), db, h->bins * sizeof(float));
+		return;
+	}
+	q = (uint16_t *)v + tune * h->bins;
+	for (i = 0; i < h->bins; i++) {
+		/* clamps, also -inf and nan of empty bins to 0 */
+		x = (db[i] - POWER_Q_OFFSET) / POWER_Q_STEP + 0.5f;
+		q[i] = (x >= 65535.0f) ? 65535 : ((x > 0.0f) ? (uint16_t)x : 0);
+	}
+}
+
+int power_file_sweep(struct power_file *p, double ts)
+{
+	struct power_record *r = (struct power_record *)p->rec;
+	struct power_index e;
+	r->ts = ts;
+	r->sweep = p->sweep;
+	r->tune_count = p->h.tune_count;
+	if (fwrite(p->rec, p->h.record_size, 1, p->f) != 1)
+		return -1;
+	fflush(p->f);
+	/* index after the record: an entry always points at a whole record */
+	if (p->idx) {
+		e.ts = ts;
+		e.offset = p->offset;
+		fwrite(&e, sizeof(e), 1, p->idx);
+		fflush(p->idx);
+	}
+	p->offset += p->h.record_size;
+	p->sweep++;
+	return 0;
+}
+
+void power_file_close(struct power_file *p)
+{
+	if (p->idx)
+		fclose(p->idx);
+	p->idx = NULL;
+	free(p->rec);
+	p->rec = NULL;
+}
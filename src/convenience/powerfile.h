@@ -0,0 +1,141 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __POWERFILE_H
+#define __POWERFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* binary spectrum log of rtl_power, host byte order:
+ *   struct power_header
+ *   struct power_tune, tune_count times: the tune plan
+ *   sweep records of record_size bytes, from offset header_size:
+ *     struct power_record
+ *     uint32_t samples[tune_count]
+ *     dB values, [tune_count][bins] of float or uint16, padded to 8 bytes
+ *
+ * records have a fixed size, sweep n starts at header_size + n * record_size.
+ * the index sidecar holds one struct power_index per sweep, to find a time
+ * range without reading the log, or to check for a truncated last record.
+ */
+
+#define POWER_MAGIC		"RTLPOWR"
+#define POWER_VERSION		1
+#define POWER_BYTE_ORDER	0x01020304
+
+/* uint16 dB = POWER_Q_OFFSET + value * POWER_Q_STEP */
+#define POWER_Q_OFFSET		-200.0f
+#define POWER_Q_STEP		0.01f
+
+enum power_format { POWER_F32 = 1, POWER_U16 };
+
+struct power_header
+{
+	char	magic[8];	/* POWER_MAGIC, 0 terminated */
+	uint16_t version;	/* POWER_VERSION */
+	uint16_t format;	/* enum power_format */
+	uint32_t byte_order;	/* POWER_BYTE_ORDER as written by the host */
+	uint32_t tune_count;
+	uint32_t bins;		/* per tune, after cropping */
+	uint32_t header_size;	/* bytes up to the first record */
+	uint32_t record_size;
+	float	q_offset;	/* POWER_U16: POWER_Q_OFFSET */
+	float	q_step;		/* POWER_U16: POWER_Q_STEP */
+};
+
+struct power_tune
+{
+	double	hz_low;		/* as the csv columns */
+	double	hz_high;
+	double	hz_step;
+};
+
+struct power_record
+{
+	double	ts;		/* unix time of the output */
+	uint32_t sweep;		/* counted from 0 */
+	uint32_t tune_count;	/* to check the alignment */
+};
+
+struct power_index
+{
+	double	ts;
+	uint64_t offset;	/* of the record in the log */
+};
+
+struct power_file
+{
+	FILE	*f;
+	FILE	*idx;		/* NULL: no index */
+	struct power_header h;
+	uint64_t offset;	/* of the next record */
+	uint32_t sweep;
+	unsigned char *rec;	/* record being collected */
+};
+
+/*!
+ * Write the header and tune plan
+ *
+ * \param p state
+ * \param f opened log, e.g. stdout
+ * \param index_path path of the index sidecar, NULL for none
+ * \param format enum power_format
+ * \param tunes tune plan
+ * \param tune_count number of tunes
+ * \param bins dB values per tune
+ * \return 0 on success, -1 on error
+ */
+
+int power_file_open(struct power_file *p, FILE *f, const char *index_path,
+	int format, const struct power_tune *tunes, int tune_count, int bins);
+
+/*!
+ * Set the values of one tune in the current sweep
+ *
+ * \param p state
+ * \param tune index in the tune plan
+ * \param samples samples integrated for the tune
+ * \param db bins dB values
+ */
+
+void power_file_put(struct power_file *p, int tune, uint32_t samples, const float *db);
+
+/*!
+ * Write the current sweep and its index entry
+ *
+ * \param p state
+ * \param ts unix time
+ * \return 0 on success, -1 on error
+ */
+
+int power_file_sweep(struct power_file *p, double ts);
+
+/*!
+ * Free the state and close the index. the log stays open
+ *
+ * \param p state
+ */
+
+void power_file_close(struct power_file *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__POWERFILE_H*/
@@ -0,0 +1,340 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "resample.h"
+#include "simd.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define RESAMPLE_COEF_BITS	14
+#define RESAMPLE_TAP_ALIGN	16	/* int16_t's per AVX2 register */
+#define RESAMPLE_KAISER_BETA	7.0	/* ~ 70 dB stopband */
+#define RESAMPLE_CUTOFF		0.9	/* relative to the lower nyquist frequency */
+
+
+static int gcd(int a, int b)
+{
+	int t;
+	while (b) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/* best rational approximation num/den of x with num <= max_num,
+ * from the continued fraction's convergents */
+static void approximate_ratio(double x, int max_num, int *num, int *den)
+{
+	long p0 = 0, q0 = 1, p1 = 1, q1 = 0, p2, q2, a;
+	double f = x;
+	int k;
+	*num = 1;
+	*den = (int)(1.0 / x + 0.5);
+	for (k = 0; k < 32; k++) {
+		a = (long)floor(f);
+		p2 = a * p1 + p0;
+		q2 = a * q1 + q0;
+		if (p2 > max_num || q2 > 0x7FFFFFL)
+			break;
+		if (p2 > 0) {
+			*num = (int)p2;
+			*den = (int)q2;
+		}
+		p0 = p1; q0 = q1;
+		p1 = p2; q1 = q2;
+		if (f - (double)a < 1E-9)
+			break;
+		f = 1.0 / (f - (double)a);
+	}
+	if (*den < 1)
+		*den = 1;
+}
+
+/* zeroth order modified bessel function of the first kind */
+static double bessel_i0(double x)
+{
+	double sum = 1.0, term = 1.0, h = x * 0.5;
+	int k;
+	for (k = 1; k < 64; k++) {
+		term *= (h / k) * (h / k);
+		sum += term;
+		if (term < sum * 1E-12)
+			break;
+	}
+	return sum;
+}
+
+static inline int16_t sat16(int v)
+{
+	if (v > 32767)
+		return 32767;
+	if (v < -32768)
+		return -32768;
+	return (int16_t)v;
+}
+
+/* sum_t c[t] * x[t], n multiple of RESAMPLE_TAP_ALIGN */
+static int dot16(const int16_t *c, const int16_t *x, int n)
+{
+	int t = 0, sum = 0;
+#if defined(RTL_SIMD_AVX2)
+	__m256i acc = _mm256_setzero_si256();
+	__m128i a4;
+	for (; t + 16 <= n; t += 16) {
+		acc = _mm256_add_epi32(acc, _mm256_madd_epi16(
+			_mm256_loadu_si256((const __m256i *)(x + t)),
+			_mm256_loadu_si256((const __m256i *)(c + t)) ));
+	}
+	a4 = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+	a4 = _mm_add_epi32(a4, _mm_shuffle_epi32(a4, _MM_SHUFFLE(1,0,3,2)));
+	a4 = _mm_add_epi32(a4, _mm_shuffle_epi32(a4, _MM_SHUFFLE(2,3,0,1)));
+	sum = _mm_cvtsi128_si32(a4);
+#elif defined(RTL_SIMD_SSE2)
+	__m128i acc = _mm_setzero_si128();
+	for (; t + 8 <= n; t += 8) {
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(
+			_mm_loadu_si128((const __m128i *)(x + t)),
+			_mm_loadu_si128((const __m128i *)(c + t)) ));
+	}
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1,0,3,2)));
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2,3,0,1)));
+	sum = _mm_cvtsi128_si32(acc);
+#elif defined(RTL_SIMD_NEON)
+	int32x4_t acc = vdupq_n_s32(0);
+	int32x2_t a2;
+	int16x8_t vx, vc;
+	for (; t + 8 <= n; t += 8) {
+		vx = vld1q_s16(x + t);
+		vc = vld1q_s16(c + t);
+		acc = vmlal_s16(acc, vget_low_s16(vx), vget_low_s16(vc));
+		acc = vmlal_s16(acc, vget_high_s16(vx), vget_high_s16(vc));
+	}
+	a2 = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+	sum = vget_lane_s32(vpadd_s32(a2, a2), 0);
+#endif
+	for (; t < n; t++)
+		sum += c[t] * x[t];
+	return sum;
+}
+
+/* sum_t c[t] * x[t], n multiple of RESAMPLE_TAP_ALIGN */
+static float dotf(const float *c, const float *x, int n)
+{
+	int t = 0;
+	float sum = 0.0f;
+#if defined(RTL_SIMD_AVX2)
+	__m256 acc = _mm256_setzero_ps();
+	__m128 a4;
+	for (; t + 8 <= n; t += 8)
+		acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(x + t), _mm256_loadu_ps(c + t)));
+	a4 = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+	a4 = _mm_add_ps(a4, _mm_movehl_ps(a4, a4));
+	a4 = _mm_add_ss(a4, _mm_shuffle_ps(a4, a4, 1));
+	sum = _mm_cvtss_f32(a4);
+#elif defined(RTL_SIMD_SSE2)
+	__m128 acc = _mm_setzero_ps();
+	for (; t + 4 <= n; t += 4)
+		acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(x + t), _mm_loadu_ps(c + t)));
+	acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+	acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+	sum = _mm_cvtss_f32(acc);
+#elif defined(RTL_SIMD_NEON)
+	float32x4_t acc = vdupq_n_f32(0.0f);
+	float32x2_t a2;
+	for (; t + 4 <= n; t += 4)
+		acc = vmlaq_f32(acc, vld1q_f32(x + t), vld1q_f32(c + t));
+	a2 = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+	sum = vget_lane_f32(vpadd_f32(a2, a2), 0);
+#endif
+	for (; t < n; t++)
+		sum += c[t] * x[t];
+	return sum;
+}
+
+int resampler_init(struct resampler *r, int rate_in, int rate_out, int zeros)
+{
+	double *h, fc, center, arg, beta_i0, sum, v;
+	int g, N, j, p, k, ret = 0;
+
+	memset(r, 0, sizeof(*r));
+	if (rate_in <= 0 || rate_out <= 0)
+		return -1;
+	if (zeros <= 0)
+		zeros = RESAMPLE_DEFAULT_ZEROS;
+	g = gcd(rate_in, rate_out);
+	r->L = rate_out / g;
+	r->M = rate_in / g;
+	if (r->L > RESAMPLE_MAX_PHASES) {
+		approximate_ratio((double)rate_out / rate_in, RESAMPLE_MAX_PHASES, &r->L, &r->M);
+		ret = 1;
+	}
+	r->rate_out = (double)rate_in * r->L / r->M;
+
+	/* prototype lowpass at rate_in * L: cutoff below the lower nyquist frequency */
+	k = (r->L > r->M) ? r->L : r->M;
+	r->taps = (2 * zeros * k + r->L - 1) / r->L;
+	r->taps_pad = (r->taps + RESAMPLE_TAP_ALIGN - 1) / RESAMPLE_TAP_ALIGN * RESAMPLE_TAP_ALIGN;
+	N = r->taps * r->L;
+	fc = RESAMPLE_CUTOFF * 0.5 / k;
+	center = 0.5 * (N - 1);
+	beta_i0 = bessel_i0(RESAMPLE_KAISER_BETA);
+
+	h = malloc(N * sizeof(double));
+	r->bank = calloc((size_t)r->L * r->taps_pad, sizeof(int16_t));
+	r->fbank = calloc((size_t)r->L * r->taps_pad, sizeof(float));
+	if (!h || !r->bank || !r->fbank) {
+		free(h);
+		resampler_free(r);
+		return -1;
+	}
+	for (j = 0; j < N; j++) {
+		v = 2.0 * fc;
+		arg = M_PI * 2.0 * fc * (j - center);
+		if (fabs(arg) > 1E-12)
+			v *= sin(arg) / arg;
+		arg = 2.0 * (j - center) / (N - 1);
+		arg = 1.0 - arg * arg;
+		v *= bessel_i0(RESAMPLE_KAISER_BETA * sqrt(arg > 0.0 ? arg : 0.0)) / beta_i0;
+		h[j] = v;
+	}
+	/* phase p: coefficients h[p + k*L], reversed to run forward over the input.
+	 * each phase is normalized to unity gain at DC */
+	for (p = 0; p < r->L; p++) {
+		sum = 0.0;
+		for (k = 0; k < r->taps; k++)
+			sum += h[p + k * r->L];
+		if (fabs(sum) < 1E-12)
+			sum = 1.0;
+		for (k = 0; k < r->taps; k++) {
+			v = h[p + (r->taps - 1 - k) * r->L] / sum;
+			r->bank[p * r->taps_pad + k] = sat16((int)floor(v * (1 << RESAMPLE_COEF_BITS) + 0.5));
+			r->fbank[p * r->taps_pad + k] = (float)v;
+		}
+	}
+	free(h);
+	return ret;
+}
+
+void resampler_reset(struct resampler *r)
+{
+	if (r->work)
+		memset(r->work, 0, r->work_len * sizeof(int16_t));
+	if (r->fwork)
+		memset(r->fwork, 0, r->fwork_len * sizeof(float));
+	r->pos = 0;
+}
+
+void resampler_free(struct resampler *r)
+{
+	free(r->bank);
+	free(r->work);
+	free(r->fbank);
+	free(r->fwork);
+	memset(r, 0, sizeof(*r));
+}
+
+int resampler_max_output(const struct resampler *r, int len)
+{
+	if (!r->M)
+		return 0;
+	return (int)(((int64_t)len * r->L + r->M - 1) / r->M) + 1;
+}
+
+int resampler_process(struct resampler *r, const int16_t *in, int len, int16_t *out, int max_out)
+{
+	const int nhist = r->taps - 1;
+	const int step_i = r->M / r->L;
+	const int step_p = r->M % r->L;
+	const int round = 1 << (RESAMPLE_COEF_BITS - 1);
+	int need, i, p, n = 0;
+
+	if (!r->bank)
+		return -1;
+	/* zero padded tail: the kernels read taps_pad values */
+	need = nhist + len + r->taps_pad;
+	if (need > r->work_len) {
+		int16_t *w = realloc(r->work, need * sizeof(int16_t));
+		if (!w)
+			return -1;
+		memset(w + r->work_len, 0, (need - r->work_len) * sizeof(int16_t));
+		r->work = w;
+		r->work_len = need;
+	}
+	memcpy(r->work + nhist, in, len * sizeof(int16_t));
+	memset(r->work + nhist + len, 0, r->taps_pad * sizeof(int16_t));
+
+	/* output from input sample i (history included) at phase p */
+	i = r->pos / r->L;
+	p = r->pos % r->L;
+	while (i < len) {
+		if (n < max_out)
+			out[n++] = sat16((dot16(r->bank + p * r->taps_pad, r->work + i, r->taps_pad) + round) >> RESAMPLE_COEF_BITS);
+		i += step_i;
+		p += step_p;
+		if (p >= r->L) {
+			p -= r->L;
+			i++;
+		}
+	}
+	r->pos = (i - len) * r->L + p;
+	memmove(r->work, r->work + len, nhist * sizeof(int16_t));
+	return n;
+}
+
+int resampler_process_f(struct resampler *r, const float *in, int len, float *out, int max_out)
+{
+	const int nhist = r->taps - 1;
+	const int step_i = r->M / r->L;
+	const int step_p = r->M % r->L;
+	int need, i, p, n = 0;
+
+	if (!r->fbank)
+		return -1;
+	need = nhist + len + r->taps_pad;
+	if (need > r->fwork_len) {
+		float *w = realloc(r->fwork, need * sizeof(float));
+		if (!w)
+			return -1;
+		memset(w + r->fwork_len, 0, (need - r->fwork_len) * sizeof(float));
+		r->fwork = w;
+		r->fwork_len = need;
+	}
+	memcpy(r->fwork + nhist, in, len * sizeof(float));
+	memset(r->fwork + nhist + len, 0, r->taps_pad * sizeof(float));
+
+	i = r->pos / r->L;
+	p = r->pos % r->L;
+	while (i < len) {
+		if (n < max_out)
+			out[n++] = dotf(r->fbank + p * r->taps_pad, r->fwork + i, r->taps_pad);
+		i += step_i;
+		p += step_p;
+		if (p >= r->L) {
+			p -= r->L;
+			i++;
+		}
+	}
+	r->pos = (i - len) * r->L + p;
+	memmove(r->fwork, r->fwork + len, nhist * sizeof(float));
+	return n;
+}
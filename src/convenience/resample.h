@@ -0,0 +1,118 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __RESAMPLE_H
+#define __RESAMPLE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* polyphase rational resampler (L/M) for real 16 bit samples,
+ * e.g. 170 kHz -> 32 kHz (L = 16, M = 85) or 1.024 MHz -> 44.1 kHz (L = 441, M = 10240).
+ * the filter bank is computed once in resampler_init(),
+ * history and fractional position are kept across blocks.
+ */
+
+#define RESAMPLE_MAX_PHASES		1024	/* larger L are approximated */
+#define RESAMPLE_DEFAULT_ZEROS	24		/* zero crossings per side of prototype */
+
+struct resampler
+{
+	int	L;		/* interpolation factor = number of phases */
+	int	M;		/* decimation factor */
+	int	taps;		/* taps per phase */
+	int	taps_pad;	/* taps rounded up for the SIMD kernels */
+	double	rate_out;	/* effective output rate: rate_in * L / M */
+	int16_t	*bank;		/* L * taps_pad coefficients, scaled by 2^14 */
+	int16_t	*work;		/* taps-1 history, followed by input block */
+	int	work_len;
+	float	*fbank;		/* same coefficients in float32, for resampler_process_f() */
+	float	*fwork;
+	int	fwork_len;
+	int	pos;		/* next output at input (pos / L), relative to block start */
+};
+
+/*!
+ * Setup resampler and compute its filter bank
+ *
+ * \param r resampler state
+ * \param rate_in input sample rate
+ * \param rate_out requested output sample rate
+ * \param zeros filter quality: zero crossings per side, 0 for RESAMPLE_DEFAULT_ZEROS
+ * \return 0 on success, 1 when the ratio had to be approximated, -1 on error
+ */
+
+int resampler_init(struct resampler *r, int rate_in, int rate_out, int zeros);
+
+/*!
+ * Clear history and position of resampler
+ *
+ * \param r resampler state
+ */
+
+void resampler_reset(struct resampler *r);
+
+/*!
+ * Free memory of resampler
+ *
+ * \param r resampler state
+ */
+
+void resampler_free(struct resampler *r);
+
+/*!
+ * Maximum number of output samples for a block of input samples
+ *
+ * \param r resampler state
+ * \param len number of input samples
+ * \return maximum number of output samples
+ */
+
+int resampler_max_output(const struct resampler *r, int len);
+
+/*!
+ * Resample a block. in and out may be the same buffer
+ *
+ * \param r resampler state
+ * \param in input samples
+ * \param len number of input samples
+ * \param out output samples
+ * \param max_out capacity of out; further outputs are dropped
+ * \return number of samples written to out, -1 on error
+ */
+
+int resampler_process(struct resampler *r, const int16_t *in, int len, int16_t *out, int max_out);
+
+/*!
+ * Resample a block of float32 samples. in and out may be the same buffer.
+ * don't mix with resampler_process() on the same state
+ *
+ * \param r resampler state
+ * \param in input samples
+ * \param len number of input samples
+ * \param out output samples
+ * \param max_out capacity of out; further outputs are dropped
+ * \return number of samples written to out, -1 on error
+ */
+
+int resampler_process_f(struct resampler *r, const float *in, int len, float *out, int max_out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__RESAMPLE_H*/
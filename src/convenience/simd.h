@@ -0,0 +1,36 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __RTL_SIMD_H
+#define __RTL_SIMD_H
+
+/* compile time selection of the SIMD kernels in the tools' DSP helpers.
+ * AVX2 requires building with -mavx2 (cmake -DENABLE_AVX2=ON),
+ * SSE2 is always available on x86_64, NEON on aarch64 / armv7 with -mfpu=neon.
+ * every kernel has a scalar fallback / tail.
+ */
+
+#if defined(__AVX2__)
+#define RTL_SIMD_AVX2	1
+#define RTL_SIMD_SSE2	1
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RTL_SIMD_SSE2	1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define RTL_SIMD_NEON	1
+#include <arm_neon.h>
+#endif
+
+#endif /*__RTL_SIMD_H*/
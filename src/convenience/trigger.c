@@ -0,0 +1,363 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "trigger.h"
+#include "convenience.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#else
+#include <io.h>
+#define open _open
+#define write _write
+#define close _close
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+
+void trigger_execute(const struct trigger_event *ev)
+{
+	char acRepFreq[32], acRepGain[32], acRepMLevel[32], acRepRefLevel[32], acRepRefTolerance[32];
+	char * execSearchStrings[7] = { "!freq!", "!gain!", "!mlevel!", "!crit!", "!reflevel!", "!reftol!", NULL };
+	char * execReplaceStrings[7] = { acRepFreq, acRepGain, acRepMLevel, NULL, acRepRefLevel, acRepRefTolerance, NULL };
+	char command[TRIGGER_CMD_LEN];
+	char args[TRIGGER_ARGS_LEN];
+	char crit[8];
+	if (!ev->command[0])
+		return;
+	/* executeInBackground() tokenizes args in place */
+	memcpy(command, ev->command, sizeof(command));
+	memcpy(args, ev->args, sizeof(args));
+	memcpy(crit, ev->crit, sizeof(crit));
+	command[TRIGGER_CMD_LEN - 1] = 0;
+	args[TRIGGER_ARGS_LEN - 1] = 0;
+	crit[sizeof(crit) - 1] = 0;
+	snprintf(acRepFreq, 32, "%.0f", (double)ev->freq);
+	snprintf(acRepGain, 32, "%d", ev->gain);
+	snprintf(acRepMLevel, 32, "%d", (int)(0.5 + ev->level*10.0) );
+	execReplaceStrings[3] = crit;
+	snprintf(acRepRefLevel, 32, "%d", (int)(0.5 + ev->refLevel*10.0) );
+	snprintf(acRepRefTolerance, 32, "%d", (int)(0.5 + ev->refLevelTol*10.0) );
+	executeInBackground( command, (args[0] ? args : NULL), execSearchStrings, execReplaceStrings );
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	int r;
+	while (len) {
+		r = (int)write(fd, p, (unsigned)len);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return -1;
+		p += r;
+		len -= r;
+	}
+	return 0;
+}
+
+#ifndef _WIN32
+
+static int read_full(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t r;
+	while (len) {
+		r = read(fd, p, len);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return -1;	/* eof: the parent has gone */
+		p += r;
+		len -= r;
+	}
+	return 0;
+}
+
+static void reap_children(void)
+{
+	while (waitpid(-1, NULL, WNOHANG) > 0)
+		;
+}
+
+static void helper_sighandler(int signum)
+{
+	(void)signum;
+}
+
+/* the helper process: small, single threaded - forking it is cheap */
+static void helper_main(int fd)
+{
+	struct trigger_event ev;
+	struct pollfd pfd;
+	struct sigaction sigact;
+	/* a ctrl-c to the process group: the parent still sends its queued events.
+	 * caught, not ignored: exec resets handlers, so the trigger commands
+	 * still stop on SIGINT and SIGTERM */
+	sigact.sa_handler = helper_sighandler;
+	sigemptyset(&sigact.sa_mask);
+	sigact.sa_flags = 0;
+	sigaction(SIGINT, &sigact, NULL);
+	sigaction(SIGQUIT, &sigact, NULL);
+	sigaction(SIGTERM, &sigact, NULL);
+	signal(SIGPIPE, SIG_DFL);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while (1) {
+		pfd.revents = 0;
+		if (poll(&pfd, 1, 1000) > 0) {
+			if (read_full(fd, &ev, sizeof(ev)) < 0)
+				break;
+			trigger_execute(&ev);
+		}
+		reap_children();
+	}
+	reap_children();
+	_exit(0);
+}
+
+static int start_helper(struct trigger_dispatch *t)
+{
+	int p[2];
+	pid_t pid;
+	if (pipe(p) < 0) {
+		fprintf(stderr, "error: pipe for trigger helper failed!\n");
+		return -1;
+	}
+	fflush(NULL);
+	pid = fork();
+	if (pid < 0) {
+		fprintf(stderr, "error: fork of trigger helper failed!\n");
+		close(p[0]);
+		close(p[1]);
+		return -1;
+	}
+	if (pid == 0) {
+		close(p[1]);
+		helper_main(p[0]);
+	}
+	close(p[0]);
+	fcntl(p[1], F_SETFD, FD_CLOEXEC);
+	t->fd = p[1];
+	t->helper_pid = (int)pid;
+	return 0;
+}
+
+#endif
+
+static int open_sink(struct trigger_dispatch *t)
+{
+	int fd;
+#ifndef _WIN32
+	struct stat st;
+	struct sockaddr_un addr;
+	if (!stat(t->sink, &st) && S_ISSOCK(st.st_mode)) {
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+			return -1;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, t->sink, sizeof(addr.sun_path) - 1);
+		if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+			close(fd);
+			return -1;
+		}
+		return fd;
+	}
+	/* nonblocking: a fifo without reader fails instead of hanging */
+	fd = open(t->sink, O_WRONLY | O_APPEND | O_CREAT | O_NONBLOCK, 0644);
+	if (fd >= 0)
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+#else
+	fd = open(t->sink, O_WRONLY | O_APPEND | O_CREAT | O_BINARY, 0644);
+#endif
+	return fd;
+}
+
+static void json_string(char *dst, int n, const char *src)
+{
+	int k = 0;
+	for (; *src && k < n - 7; src++) {
+		unsigned char ch = (unsigned char)*src;
+		if (ch == '"' || ch == '\\') {
+			dst[k++] = '\\';
+			dst[k++] = (char)ch;
+		} else if (ch < 0x20) {
+			k += sprintf(dst + k, "\\u%04x", ch);
+		} else {
+			dst[k++] = (char)ch;}
+	}
+	dst[k] = 0;
+}
+
+static int send_sink(struct trigger_dispatch *t, const struct trigger_event *ev)
+{
+	char cmd[2 * TRIGGER_CMD_LEN], args[2 * TRIGGER_ARGS_LEN], crit[16];
+	char line[sizeof(cmd) + sizeof(args) + 256];
+	int len;
+	if (t->fd < 0)
+		t->fd = open_sink(t);
+	if (t->fd < 0)
+		return -1;
+	json_string(cmd, sizeof(cmd), ev->command);
+	json_string(args, sizeof(args), ev->args);
+	json_string(crit, sizeof(crit), ev->crit);
+	len = snprintf(line, sizeof(line),
+		"{\"ts\":%.3f,\"line\":%d,\"freq\":%.0f,\"gain\":%.1f,\"level\":%.1f,"
+		"\"crit\":\"%s\",\"reflevel\":%.1f,\"reftol\":%.1f,\"command\":\"%s\",\"args\":\"%s\"}\n",
+		ev->ts, ev->lineNo, (double)ev->freq, 0.1 * ev->gain, ev->level,
+		crit, ev->refLevel, ev->refLevelTol, cmd, args);
+	if (write_full(t->fd, line, len) < 0) {
+		/* reader has gone: reopen with the next event */
+		close(t->fd);
+		t->fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+static int deliver(struct trigger_dispatch *t, const struct trigger_event *ev)
+{
+	if (t->sink)
+		return send_sink(t, ev);
+#ifndef _WIN32
+	if (t->fd < 0)
+		return -1;
+	/* events are smaller than PIPE_BUF: written atomically */
+	return write_full(t->fd, ev, sizeof(*ev));
+#else
+	/* spawn doesn't fork: no helper needed */
+	trigger_execute(ev);
+	return 0;
+#endif
+}
+
+static void *dispatch_thread_fn(void *arg)
+{
+	struct trigger_dispatch *t = arg;
+	struct trigger_event ev;
+	int r;
+#ifndef _WIN32
+	sigset_t set;
+	/* a closed sink: EPIPE instead of the process' SIGPIPE handler */
+	sigemptyset(&set);
+	sigaddset(&set, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+#endif
+	pthread_mutex_lock(&t->m);
+	while (1) {
+		while (!t->fill && !t->exit_flag)
+			pthread_cond_wait(&t->ready, &t->m);
+		if (!t->fill)
+			break;
+		ev = t->queue[t->tail];
+		t->tail = (t->tail + 1) % TRIGGER_QUEUE_LEN;
+		t->fill--;
+		pthread_mutex_unlock(&t->m);
+		r = deliver(t, &ev);
+		pthread_mutex_lock(&t->m);
+		if (r < 0)
+			t->failed++;
+	}
+	pthread_mutex_unlock(&t->m);
+	return 0;
+}
+
+int trigger_dispatch_init(struct trigger_dispatch *t, const char *sink)
+{
+	memset(t, 0, sizeof(*t));
+	t->sink = sink;
+	t->fd = -1;
+	t->helper_pid = -1;
+#ifndef _WIN32
+	/* fork before any other thread exists */
+	if (!sink && start_helper(t) < 0)
+		return -1;
+#endif
+	pthread_mutex_init(&t->m, NULL);
+	pthread_cond_init(&t->ready, NULL);
+	if (pthread_create(&t->thread, NULL, dispatch_thread_fn, t)) {
+		fprintf(stderr, "error: can't start trigger dispatch thread!\n");
+		pthread_cond_destroy(&t->ready);
+		pthread_mutex_destroy(&t->m);
+		return -1;
+	}
+	t->started = 1;
+	return 0;
+}
+
+int trigger_dispatch_post(struct trigger_dispatch *t, const struct trigger_event *ev)
+{
+	struct timeval tv;
+	if (!t->started)
+		return -1;
+	pthread_mutex_lock(&t->m);
+	if (t->fill >= TRIGGER_QUEUE_LEN) {
+		t->dropped++;
+		pthread_mutex_unlock(&t->m);
+		return -1;
+	}
+	t->queue[t->head] = *ev;
+	gettimeofday(&tv, NULL);
+	t->queue[t->head].ts = tv.tv_sec + 1E-6 * tv.tv_usec;
+	t->head = (t->head + 1) % TRIGGER_QUEUE_LEN;
+	t->fill++;
+	t->posted++;
+	pthread_cond_signal(&t->ready);
+	pthread_mutex_unlock(&t->m);
+	return 0;
+}
+
+void trigger_dispatch_close(struct trigger_dispatch *t)
+{
+	if (!t->started)
+		return;
+	pthread_mutex_lock(&t->m);
+	t->exit_flag = 1;
+	pthread_cond_signal(&t->ready);
+	pthread_mutex_unlock(&t->m);
+	pthread_join(t->thread, NULL);
+	if (t->fd >= 0)
+		close(t->fd);
+	t->fd = -1;
+#ifndef _WIN32
+	/* the helper leaves on eof, its running commands are inherited by init */
+	if (t->helper_pid > 0)
+		waitpid(t->helper_pid, NULL, 0);
+	t->helper_pid = -1;
+#endif
+	pthread_cond_destroy(&t->ready);
+	pthread_mutex_destroy(&t->m);
+	t->started = 0;
+}
@@ -0,0 +1,109 @@
+/*
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __TRIGGER_H
+#define __TRIGGER_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* dispatch of trigger events, off the signal processing threads.
+ * posting never blocks: events go into a bounded queue, a dispatcher thread
+ * passes them on, either
+ *  - to a helper process, forked once at setup while the caller is still small
+ *    and single threaded. it runs the trigger commands and reaps them, or
+ *  - to a sink: fifo, unix socket or file, one JSON object per line.
+ * events are dropped and counted when the queue is full.
+ */
+
+#define TRIGGER_QUEUE_LEN	32
+#define TRIGGER_CMD_LEN		256
+#define TRIGGER_ARGS_LEN	1024
+
+struct trigger_event
+{
+	double	ts;		/* unix time, set when posted */
+	uint64_t freq;		/* Hz */
+	int	gain;		/* tenth dB */
+	int	lineNo;		/* of the command file */
+	double	level;		/* dB */
+	double	refLevel;
+	double	refLevelTol;
+	char	crit[8];	/* "in", "out", "<" or ">" */
+	char	command[TRIGGER_CMD_LEN];	/* empty: nothing to execute */
+	char	args[TRIGGER_ARGS_LEN];
+};
+
+struct trigger_dispatch
+{
+	int	started;
+	const char *sink;	/* NULL: helper process executes the commands */
+	int	fd;		/* to helper or sink, -1 if closed */
+	int	helper_pid;
+	struct trigger_event queue[TRIGGER_QUEUE_LEN];
+	int	head, tail, fill;
+	int	exit_flag;
+	unsigned posted, dropped, failed;
+	pthread_t thread;
+	pthread_mutex_t m;
+	pthread_cond_t ready;
+};
+
+/*!
+ * Setup dispatch. call before other threads are created
+ *
+ * \param t state
+ * \param sink path of fifo, unix socket or file for JSON lines,
+ *   NULL to execute the commands in a helper process
+ * \return 0 on success, -1 on error
+ */
+
+int trigger_dispatch_init(struct trigger_dispatch *t, const char *sink);
+
+/*!
+ * Queue an event, without blocking
+ *
+ * \param t state
+ * \param ev event, copied. ts is set here
+ * \return 0 if queued, -1 if dropped
+ */
+
+int trigger_dispatch_post(struct trigger_dispatch *t, const struct trigger_event *ev);
+
+/*!
+ * Pass on queued events, stop the dispatcher thread and the helper process
+ *
+ * \param t state
+ */
+
+void trigger_dispatch_close(struct trigger_dispatch *t);
+
+/*!
+ * Execute the command of an event, replacing the arguments
+ * !freq!, !gain!, !mlevel!, !crit!, !reflevel! and !reftol!
+ *
+ * \param ev event
+ */
+
+void trigger_execute(const struct trigger_event *ev);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__TRIGGER_H*/
@@ -100,11 +100,11 @@ void wavePrepareHeader(unsigned samplerate, unsigned freq, int bitsPerSample, in
 
 	memcpy( waveHdr.f.hdr.ID, "fmt ", 4 );
 	waveHdr.f.hdr.size = 16;
-	waveHdr.f.wFormatTag = 1;					/* PCM */
+	waveHdr.f.wFormatTag = (bitsPerSample == 32) ? 3 : 1;	/* IEEE float or PCM */
 	waveHdr.f.nChannels = numChannels;		/* I and Q channels */
 	waveHdr.f.nSamplesPerSec = samplerate;
 	waveHdr.f.nAvgBytesPerSec = samplerate * bytesPerFrame;
-	waveHdr.f.nBlockAlign = waveHdr.f.nChannels;
+	waveHdr.f.nBlockAlign = bytesPerFrame;
 	waveHdr.f.nBitsPerSample = bitsPerSample;
 
 	memcpy( waveHdr.a.hdr.ID, "auxi", 4 );
@@ -158,6 +158,11 @@ int  waveWriteSamples(FILE* f,  void * vpData, size_t numSamples, int needCleanD
 			/* TODO: convert back endianness */
 		}
 		return (nw == numSamples) ? 0 : 1;
+	case 32:
+		/* float32 in host byte order, as the header: a little endian host is assumed */
+		nw = fwrite(vpData, sizeof(float), numSamples, f);
+		waveDataSize += sizeof(float) * numSamples;
+		return (nw == numSamples) ? 0 : 1;
 	}
 }
 
@@ -183,6 +188,11 @@ int  waveWriteFrames(FILE* f,  void * vpData, size_t numFrames, int needCleanDat
 			/* TODO: convert back endianness */
 		}
 		return (nw == numFrames) ? 0 : 1;
+	case 32:
+		/* float32 in host byte order, as the header: a little endian host is assumed */
+		nw = fwrite(vpData, waveHdr.f.nChannels * sizeof(float), numFrames, f);
+		waveDataSize += waveHdr.f.nChannels * sizeof(float) * numFrames;
+		return (nw == numFrames) ? 0 : 1;
 	}
 }
 
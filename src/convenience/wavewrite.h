@@ -34,6 +34,9 @@ extern int	waveHdrStarted;
  * call waveWriteHeader() before writing anything to to file
  * and call waveFinalizeHeader() afterwards,
  * stdout/stderr can't be used, because seek to begin isn't possible.
+ * bitsPerSample 8 and 16 write integer PCM, 32 writes IEEE float32.
+ * header and samples are written in host byte order: wave files are
+ * little endian, a little endian host is assumed.
  * 
  */
 
@@ -44,6 +44,11 @@ typedef int socklen_t;
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
 
 #ifndef _WIN32
 #define min(a, b) (((a) < (b)) ? (a) : (b))
@@ -56,6 +61,19 @@ typedef int socklen_t;
 
 #include <pthread.h>
 
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#elif defined(_WIN32)
+#include <malloc.h>
+#endif
+
+#if defined(_MSC_VER)
+#define RTLSDR_MEMORY_BARRIER()	MemoryBarrier()
+#else
+#define RTLSDR_MEMORY_BARRIER()	__sync_synchronize()
+#endif
+
 /* cond dumbness */
 #define safe_cond_signal(n, m) pthread_mutex_lock(m); pthread_cond_signal(n); pthread_mutex_unlock(m)
 #define safe_cond_wait(n, m) pthread_mutex_lock(m); pthread_cond_wait(n, m); pthread_mutex_unlock(m)
@@ -107,6 +125,16 @@ typedef int socklen_t;
 
 #define ENABLE_ZEROCOPY 0
 
+/* vector extensions for the per block processing in the async path.
+ * each kernel has a plain C fallback */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RTLSDR_SIMD_SSE2	1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define RTLSDR_SIMD_NEON	1
+#include <arm_neon.h>
+#endif
+
 
 /* activate/use RTL's IF AGC control .. from  https://github.com/old-dab/rtlsdr
  * purpose: make AGC more smooth .. and NOT freeze
@@ -202,6 +230,82 @@ struct softagc_state {
 	int *	rpcGainValues;
 };
 
+enum iqcorr_mode {
+	IQCORR_OFF = 0,		/* off */
+	IQCORR_DC,		/* remove DC offset of I and Q */
+	IQCORR_DC_IQ		/* remove DC offset and correct gain/phase imbalance */
+};
+
+enum dsreal_mode {
+	DSREAL_OFF = 0,		/* deliver I/Q as captured */
+	DSREAL_PACKED,		/* deliver packed real samples of the ADC: 1 byte per sample */
+	DSREAL_HALFBAND		/* deliver I/Q at half the rate, centered at rate/4 */
+};
+
+#define DSREAL_HB_TAPS		8	/* non-zero odd taps on each side of the half-band filter */
+#define DSREAL_HB_HALF		(2 * DSREAL_HB_TAPS - 1)	/* filter length is 2 * HALF + 1 */
+#define DSREAL_HIST		(2 * DSREAL_HB_HALF + 2)
+#define DSREAL_COEF_SHIFT	14
+
+struct dsreal_state {
+	enum dsreal_mode	mode;
+	/* half-band state */
+	int16_t		coef[DSREAL_HB_TAPS];	/* Q14, sign of mixer included */
+	int16_t		hist[DSREAL_HIST];	/* last real samples in half LSB */
+	unsigned	phase;			/* sample index of hist[0] modulo 4 */
+	int16_t *	work;		/* allocated outside of the usb callback */
+	int		workLen;
+};
+
+struct sigstats_state {
+	int		interval;           /* measure every interval'th block. 0: off */
+	int		counter;
+	/* publication without lock: seq is odd while writing */
+	volatile uint32_t	seq;
+	rtlsdr_signal_stats_t	stats;
+};
+
+struct hop_state {
+	pthread_mutex_t	mutex;		/* protects pending schedule */
+	rtlsdr_hop_entry_t *	pending;	/* new schedule from rtlsdr_set_hop_schedule() */
+	int		pendingNum;
+	volatile int	havePending;
+
+	/* following is only accessed from USB thread in rtlsdr_read_async() */
+	rtlsdr_hop_entry_t *	entries;	/* active schedule */
+	int		num;
+	int		idx;
+	volatile int	retunePending;	/* hop to idx requested from callback */
+	int		tunedIdx;	/* entry of the current tuning, -1 before the first hop */
+	uint32_t	tunedSweep;
+	uint32_t	remainingSettle;    /* I/Q samples until settled */
+	uint32_t	remainingDwell;     /* settled I/Q samples until next hop */
+	uint32_t	sweep;
+	rtlsdr_block_tag_t	tag;            /* tag of currently delivered block */
+};
+
+/* samples are processed as (x - 127.5) * 64: 1/64 LSB resolution in int16 */
+#define IQCORR_SCALE_SHIFT	6
+#define IQCORR_OFFSET		8160	/* 127.5 * 64 */
+#define IQCORR_COEF_SHIFT	14	/* Q14 coefficients */
+
+struct iqcorr_state {
+	enum iqcorr_mode	mode;
+	int		decimation;         /* estimator uses every decimation'th I/Q pair */
+	int		avgBlocks;          /* estimator time constant in blocks */
+	int		verbose;
+	volatile int	restart;            /* drop estimates, e.g. after retuning */
+	int		numBlocks;          /* number of blocks in estimate */
+
+	/* running estimates in units of LSB, relative to 127.5 */
+	double	meanI, meanQ;
+	double	powI, powQ, crossIQ;	/* 2nd order moments without DC */
+
+	/* coefficients applied by the kernel */
+	int16_t	dcI, dcQ;               /* DC in 1/64 LSB */
+	int16_t	coefQQ, coefQI;         /* Q' = coefQQ * Q + coefQI * I in Q14 */
+};
+
 struct rtlsdr_dev {
 	libusb_context *ctx;
 	struct libusb_device_handle *devh;
@@ -209,6 +313,14 @@ struct rtlsdr_dev {
 	uint32_t xfer_buf_len;
 	struct libusb_transfer **xfer;
 	unsigned char **xfer_buf;
+	/* user-space transfer buffers: single arena, see _rtlsdr_alloc_arena() */
+	unsigned char *xfer_arena;
+	size_t xfer_arena_len;
+	int xfer_arena_mapped;	/* 0: malloc'ed, 1: mmap'ed */
+	int xfer_arena_locked;
+	int arena_hugepages;	/* options for the arena */
+	int arena_mlock;
+	int arena_numa;
 	rtlsdr_read_async_cb_t cb;
 	void *cb_ctx;
 	volatile enum rtlsdr_async_status async_status;
@@ -240,6 +352,14 @@ struct rtlsdr_dev {
 	struct r82xx_priv r82xx_p;
 	/* soft tuner agc */
 	struct softagc_state softagc;
+	/* DC offset and I/Q imbalance correction */
+	struct iqcorr_state iqcorr;
+	/* hop schedule executed in rtlsdr_read_async() */
+	struct hop_state hop;
+	/* signal statistics */
+	struct sigstats_state sigstats;
+	/* real-only output in direct sampling */
+	struct dsreal_state dsreal;
 
 	/* -cs- Concurrent lock for the periodic reading of I2C registers */
 	pthread_mutex_t cs_mutex;
@@ -1501,7 +1621,8 @@ int rtlsdr_set_center_freq(rtlsdr_dev_t *dev, uint32_t freq)
 		rtlsdr_update_ds(dev, freq);
 
 	if (dev->direct_sampling) {
-		r = rtlsdr_set_if_freq(dev, freq);
+		/* real-only output requires the real ADC signal on I: don't mix */
+		r = rtlsdr_set_if_freq(dev, (dev->dsreal.mode != DSREAL_OFF) ? 0 : freq);
 	} else if (dev->tuner && dev->tuner->set_freq) {
 		rtlsdr_set_i2c_repeater(dev, 1);
 		r = dev->tuner->set_freq(dev, freq - dev->offs_freq);
@@ -1513,6 +1634,9 @@ int rtlsdr_set_center_freq(rtlsdr_dev_t *dev, uint32_t freq)
 	else
 		dev->freq = 0;
 
+	/* DC offset and imbalance depend on tuning: estimate again */
+	dev->iqcorr.restart = 1;
+
 	return r;
 }
 
@@ -1537,7 +1661,8 @@ int rtlsdr_set_center_freq64(rtlsdr_dev_t *dev, uint64_t freq)
 		rtlsdr_update_ds(dev, freq);
 
 	if (dev->direct_sampling) {
-		r = rtlsdr_set_if_freq(dev, freq);
+		/* real-only output requires the real ADC signal on I: don't mix */
+		r = rtlsdr_set_if_freq(dev, (dev->dsreal.mode != DSREAL_OFF) ? 0 : freq);
 	} else if (dev->tuner && dev->tuner->set_freq64) {
 		rtlsdr_set_i2c_repeater(dev, 1);
 		r = dev->tuner->set_freq64(dev, freq - dev->offs_freq);
@@ -1553,6 +1678,9 @@ int rtlsdr_set_center_freq64(rtlsdr_dev_t *dev, uint64_t freq)
 	else
 		dev->freq = 0;
 
+	/* DC offset and imbalance depend on tuning: estimate again */
+	dev->iqcorr.restart = 1;
+
 	return r;
 }
 
@@ -3180,6 +3308,15 @@ int rtlsdr_open(rtlsdr_dev_t **out_dev, uint32_t index)
 	dev->softagc.rpcNumGains = 0;
 	dev->softagc.rpcGainValues = NULL;
 
+	dev->iqcorr.mode = IQCORR_OFF;
+	dev->iqcorr.decimation = 16;	/* parameter: default: every 16th I/Q pair */
+	dev->iqcorr.avgBlocks = 16;	/* parameter: default: ~16 blocks */
+	dev->iqcorr.verbose = 0;
+	dev->iqcorr.restart = 1;
+
+	pthread_mutex_init(&dev->hop.mutex, NULL);
+	dev->hop.tag.hop_index = -1;
+
 	/* UDP controller server */
 #ifdef WITH_UDP_SERVER
 	dev->udpPortNo = 0;	/* default port 32323 .. but deactivated - by default */
@@ -3489,6 +3626,11 @@ int rtlsdr_close(rtlsdr_dev_t *dev)
 	softagc_uninit(dev);
 	pthread_mutex_destroy(&dev->cs_mutex);
 
+	free(dev->hop.pending);
+	free(dev->hop.entries);
+	pthread_mutex_destroy(&dev->hop.mutex);
+	free(dev->dsreal.work);
+
 	libusb_release_interface(dev->devh, 0);
 
 #ifdef DETACH_KERNEL_DRIVER
@@ -3815,17 +3957,628 @@ static int softagc(rtlsdr_dev_t *dev, unsigned char *buf, int len)
 }
 
 
+/* update running DC and I/Q imbalance estimates from a subset of the block
+ * and derive the fixed point coefficients for iqcorr_apply() */
+static void iqcorr_estimate(struct iqcorr_state *iqc, const unsigned char *buf, int len)
+{
+	const int step = 2 * iqc->decimation;
+	int64_t sumI = 0, sumQ = 0, sumII = 0, sumQQ = 0, sumIQ = 0;
+	int i, n = 0;
+	double mI, mQ, pI, pQ, cIQ, alpha;
+
+	for (i = 0; i + 1 < len; i += step) {
+		const int vI = 2 * (int)buf[i] - 255;		/* in half LSB */
+		const int vQ = 2 * (int)buf[i+1] - 255;
+		sumI += vI;
+		sumQ += vQ;
+		sumII += vI * vI;
+		sumQQ += vQ * vQ;
+		sumIQ += vI * vQ;
+		++n;
+	}
+	if (!n)
+		return;
+
+	mI = 0.5 * (double)sumI / n;
+	mQ = 0.5 * (double)sumQ / n;
+	pI = 0.25 * (double)sumII / n - mI * mI;
+	pQ = 0.25 * (double)sumQQ / n - mQ * mQ;
+	cIQ = 0.25 * (double)sumIQ / n - mI * mQ;
+
+	if (iqc->restart) {
+		iqc->restart = 0;
+		iqc->numBlocks = 0;
+	}
+	/* plain average over first blocks, then exponential */
+	++iqc->numBlocks;
+	alpha = 1.0 / ((iqc->numBlocks < iqc->avgBlocks) ? iqc->numBlocks : iqc->avgBlocks);
+	if (iqc->numBlocks == 1) {
+		iqc->meanI = mI;
+		iqc->meanQ = mQ;
+		iqc->powI = pI;
+		iqc->powQ = pQ;
+		iqc->crossIQ = cIQ;
+	} else {
+		iqc->meanI += alpha * (mI - iqc->meanI);
+		iqc->meanQ += alpha * (mQ - iqc->meanQ);
+		iqc->powI += alpha * (pI - iqc->powI);
+		iqc->powQ += alpha * (pQ - iqc->powQ);
+		iqc->crossIQ += alpha * (cIQ - iqc->crossIQ);
+	}
+
+	iqc->dcI = (int16_t)floor(iqc->meanI * (1 << IQCORR_SCALE_SHIFT) + 0.5);
+	iqc->dcQ = (int16_t)floor(iqc->meanQ * (1 << IQCORR_SCALE_SHIFT) + 0.5);
+	iqc->coefQQ = (1 << IQCORR_COEF_SHIFT);
+	iqc->coefQI = 0;
+
+	/* Q = g * A * sin(t + phi) vs. I = A * cos(t):
+	 *   g = sqrt(E[Q^2] / E[I^2]), sin(phi) = E[IQ] / sqrt(E[I^2] * E[Q^2])
+	 *   A * sin(t) = Q / (g * cos(phi)) - I * tan(phi)
+	 */
+	if (iqc->mode == IQCORR_DC_IQ && iqc->powI > 1.0 && iqc->powQ > 1.0) {
+		const double g = sqrt(iqc->powQ / iqc->powI);
+		double sphi = iqc->crossIQ / sqrt(iqc->powI * iqc->powQ);
+		double cphi, cQQ, cQI;
+		if (sphi > 0.5)
+			sphi = 0.5;
+		else if (sphi < -0.5)
+			sphi = -0.5;
+		cphi = sqrt(1.0 - sphi * sphi);
+		cQQ = 1.0 / (g * cphi);
+		cQI = -sphi / cphi;
+		/* coefficients have to fit into int16 in Q14 */
+		if (cQQ < 1.99) {
+			iqc->coefQQ = (int16_t)floor(cQQ * (1 << IQCORR_COEF_SHIFT) + 0.5);
+			iqc->coefQI = (int16_t)floor(cQI * (1 << IQCORR_COEF_SHIFT) + 0.5);
+		}
+	}
+
+	if (iqc->verbose && iqc->numBlocks == iqc->avgBlocks)
+		fprintf(stderr, "rtlsdr iqcorr: DC I %.2f, Q %.2f; Q' = %.4f * Q %+.4f * I\n"
+			, iqc->meanI, iqc->meanQ
+			, iqc->coefQQ / TWO_POW(IQCORR_COEF_SHIFT)
+			, iqc->coefQI / TWO_POW(IQCORR_COEF_SHIFT) );
+}
+
+/* apply DC offset and imbalance correction in place
+ *   I' = I - dcI
+ *   Q' = coefQQ * (Q - dcQ) + coefQI * (I - dcI)
+ */
+static void iqcorr_apply(const struct iqcorr_state *iqc, unsigned char *buf, int len)
+{
+	const int offI = IQCORR_OFFSET + iqc->dcI;
+	const int offQ = IQCORR_OFFSET + iqc->dcQ;
+	const int cQQ = iqc->coefQQ;
+	const int cQI = iqc->coefQI;
+	const int rnd = IQCORR_OFFSET + (1 << (IQCORR_SCALE_SHIFT - 1));
+	int i = 0;
+
+#if defined(RTLSDR_SIMD_SSE2)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i off = _mm_set_epi16(offQ, offI, offQ, offI, offQ, offI, offQ, offI);
+		/* _mm_madd_epi16() on interleaved (I, Q) pairs */
+		const __m128i kI = _mm_set_epi16(0, 1 << IQCORR_COEF_SHIFT, 0, 1 << IQCORR_COEF_SHIFT,
+			0, 1 << IQCORR_COEF_SHIFT, 0, 1 << IQCORR_COEF_SHIFT);
+		const __m128i kQ = _mm_set_epi16(cQQ, cQI, cQQ, cQI, cQQ, cQI, cQQ, cQI);
+		const __m128i vrnd = _mm_set1_epi16(rnd);
+		for (; i + 16 <= len; i += 16) {
+			__m128i in = _mm_loadu_si128((const __m128i *)(buf + i));
+			__m128i v[2];
+			int k;
+			v[0] = _mm_unpacklo_epi8(in, zero);
+			v[1] = _mm_unpackhi_epi8(in, zero);
+			for (k = 0; k < 2; ++k) {
+				__m128i x = _mm_sub_epi16(_mm_slli_epi16(v[k], IQCORR_SCALE_SHIFT), off);
+				__m128i oI = _mm_srai_epi32(_mm_madd_epi16(x, kI), IQCORR_COEF_SHIFT);
+				__m128i oQ = _mm_srai_epi32(_mm_madd_epi16(x, kQ), IQCORR_COEF_SHIFT);
+				x = _mm_packs_epi32(_mm_unpacklo_epi32(oI, oQ), _mm_unpackhi_epi32(oI, oQ));
+				v[k] = _mm_srai_epi16(_mm_adds_epi16(x, vrnd), IQCORR_SCALE_SHIFT);
+			}
+			_mm_storeu_si128((__m128i *)(buf + i), _mm_packus_epi16(v[0], v[1]));
+		}
+	}
+#elif defined(RTLSDR_SIMD_NEON)
+	{
+		const int16x8_t vOffI = vdupq_n_s16(offI - IQCORR_OFFSET);
+		const int16x8_t vOffQ = vdupq_n_s16(offQ - IQCORR_OFFSET);
+		const int16x8_t vOffs = vdupq_n_s16(IQCORR_OFFSET);
+		const int16x4_t vQQ = vdup_n_s16(cQQ);
+		const int16x4_t vQI = vdup_n_s16(cQI);
+		for (; i + 16 <= len; i += 16) {
+			uint8x8x2_t in = vld2_u8(buf + i);
+			int16x8_t xI = vsubq_s16(vreinterpretq_s16_u16(vshll_n_u8(in.val[0], IQCORR_SCALE_SHIFT)), vOffs);
+			int16x8_t xQ = vsubq_s16(vreinterpretq_s16_u16(vshll_n_u8(in.val[1], IQCORR_SCALE_SHIFT)), vOffs);
+			int32x4_t lo, hi;
+			xI = vsubq_s16(xI, vOffI);
+			xQ = vsubq_s16(xQ, vOffQ);
+			lo = vmlal_s16(vmull_s16(vget_low_s16(xQ), vQQ), vget_low_s16(xI), vQI);
+			hi = vmlal_s16(vmull_s16(vget_high_s16(xQ), vQQ), vget_high_s16(xI), vQI);
+			xQ = vcombine_s16(vqshrn_n_s32(lo, IQCORR_COEF_SHIFT), vqshrn_n_s32(hi, IQCORR_COEF_SHIFT));
+			/* back to offset binary: (x + 127.5 * 64 + 32) >> 6 */
+			in.val[0] = vqshrun_n_s16(vqaddq_s16(xI, vdupq_n_s16(rnd)), IQCORR_SCALE_SHIFT);
+			in.val[1] = vqshrun_n_s16(vqaddq_s16(xQ, vdupq_n_s16(rnd)), IQCORR_SCALE_SHIFT);
+			vst2_u8(buf + i, in);
+		}
+	}
+#endif
+
+	for (; i + 1 < len; i += 2) {
+		const int xI = ((int)buf[i] << IQCORR_SCALE_SHIFT) - offI;
+		const int xQ = ((int)buf[i+1] << IQCORR_SCALE_SHIFT) - offQ;
+		int oI = (xI + rnd) >> IQCORR_SCALE_SHIFT;
+		int oQ = (((cQQ * xQ + cQI * xI) >> IQCORR_COEF_SHIFT) + rnd) >> IQCORR_SCALE_SHIFT;
+		buf[i] = (unsigned char)( (oI < 0) ? 0 : ( (oI > 255) ? 255 : oI ) );
+		buf[i+1] = (unsigned char)( (oQ < 0) ? 0 : ( (oQ > 255) ? 255 : oQ ) );
+	}
+}
+
+static void iqcorr(rtlsdr_dev_t *dev, unsigned char *buf, int len)
+{
+	/* there is no I/Q imbalance with the tuner bypassed */
+	if (dev->direct_sampling)
+		return;
+	iqcorr_estimate(&dev->iqcorr, buf, len);
+	iqcorr_apply(&dev->iqcorr, buf, len);
+}
+
+
+/* in direct sampling, the ADC's real signal arrives in the I bytes:
+ * just pack them, dropping the Q bytes. in place */
+static int dsreal_pack(unsigned char *buf, int len)
+{
+	const int n = len / 2;
+	int i = 0;
+#if defined(RTLSDR_SIMD_SSE2)
+	{
+		const __m128i maskLo = _mm_set1_epi16(0x00ff);
+		for (; i + 16 <= n; i += 16) {
+			const __m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i *)(buf + 2 * i)), maskLo);
+			const __m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i *)(buf + 2 * i + 16)), maskLo);
+			_mm_storeu_si128((__m128i *)(buf + i), _mm_packus_epi16(a, b));
+		}
+	}
+#elif defined(RTLSDR_SIMD_NEON)
+	for (; i + 16 <= n; i += 16) {
+		const uint8x16x2_t v = vld2q_u8(buf + 2 * i);
+		vst1q_u8(buf + i, v.val[0]);
+	}
+#endif
+	for (; i < n; ++i)
+		buf[i] = buf[2 * i];
+	return n;
+}
+
+/* real-to-complex conversion of the I bytes' real signal:
+ * mix with exp(-j*pi/2*n) to shift rate/4 to 0 Hz, then half-band filter
+ * and decimate by 2. with the half-band filter's zero even taps,
+ * I only needs the center tap on even samples and Q only the odd samples.
+ * delivers len/4 I/Q samples. in place */
+static int dsreal_halfband(struct dsreal_state *ds, unsigned char *buf, int len)
+{
+	const int n = len / 2;
+	int16_t *w;
+	int t, k;
+	unsigned g;
+
+	/* sized by dsreal_init() for the transfer length */
+	if (ds->workLen < DSREAL_HIST + n)
+		return 0;
+	w = ds->work;
+	memcpy(w, ds->hist, sizeof(ds->hist));
+	for (k = 0; k < n; ++k)
+		w[DSREAL_HIST + k] = (int16_t)(2 * (int)buf[2 * k] - 255);	/* half LSB */
+
+	/* centers c = HALF + 1 + 2t are even sample indices */
+	g = (ds->phase + DSREAL_HB_HALF + 1) & 3;
+	for (t = 0; t < n / 2; ++t) {
+		const int16_t *c = w + DSREAL_HB_HALF + 1 + 2 * t;
+		int vI = c[0];
+		int vQ = 0;
+		int p;
+		for (p = 0; p < DSREAL_HB_TAPS; ++p)
+			vQ += ds->coef[p] * ((int)c[-(2 * p + 1)] - (int)c[2 * p + 1]);
+		vQ >>= DSREAL_COEF_SHIFT;
+		if (g) {
+			vI = -vI;
+			vQ = -vQ;
+		}
+		g ^= 2;
+		vI = (vI + 256) >> 1;
+		vQ = (vQ + 256) >> 1;
+		buf[2 * t] = (unsigned char)vI;
+		buf[2 * t + 1] = (unsigned char)( (vQ < 0) ? 0 : ( (vQ > 255) ? 255 : vQ ) );
+	}
+
+	memcpy(ds->hist, w + n, sizeof(ds->hist));
+	ds->phase = (ds->phase + n) & 3;
+	return n;
+}
+
+/* returns number of output bytes */
+static int dsreal_convert(struct dsreal_state *ds, unsigned char *buf, int len)
+{
+	if (ds->mode == DSREAL_PACKED)
+		return dsreal_pack(buf, len);
+	if (ds->mode == DSREAL_HALFBAND)
+		return dsreal_halfband(ds, buf, len);
+	return len;
+}
+
+/* returns -1 when the work buffer can't be allocated; the state is kept then */
+static int dsreal_init(struct dsreal_state *ds, enum dsreal_mode mode, uint32_t buf_len)
+{
+	double h[DSREAL_HB_TAPS];
+	double sum = 0.0;
+	int p;
+	const int workLen = DSREAL_HIST + (int)buf_len / 2;
+
+	if (mode == DSREAL_HALFBAND && ds->workLen < workLen) {
+		int16_t *w = realloc(ds->work, workLen * sizeof(int16_t));
+		if (!w)
+			return -1;
+		ds->work = w;
+		ds->workLen = workLen;
+	}
+	ds->mode = mode;
+	memset(ds->hist, 0, sizeof(ds->hist));
+	ds->phase = 0;
+
+	/* half-band: h[j] = sinc(j/2) / 2 at odd j, Blackman window */
+	for (p = 0; p < DSREAL_HB_TAPS; ++p) {
+		const int j = 2 * p + 1;
+		const double x = M_PI * j / (2 * DSREAL_HB_HALF + 2);
+		const double win = 0.42 + 0.5 * cos(2.0 * x) + 0.08 * cos(4.0 * x);
+		h[p] = 0.5 * sin(M_PI * j / 2.0) / (M_PI * j / 2.0) * win;
+		sum += 2.0 * h[p];
+	}
+	for (p = 0; p < DSREAL_HB_TAPS; ++p) {
+		/* odd taps sum up to 0.5. factor 2 keeps amplitude after mixing.
+		 * mixer: Im(exp(-j*pi/2*m)) = -1 at m = 1 mod 4, +1 at m = 3 mod 4
+		 * at center index 0 mod 4, sample c-j has m = -j, sample c+j has m = j */
+		const double mixSign = ( ((2 * p + 1) & 3) == 1 ) ? 1.0 : -1.0;
+		const double c = 2.0 * (0.5 * h[p] / sum) * mixSign;
+		ds->coef[p] = (int16_t)floor(c * (1 << DSREAL_COEF_SHIFT) + 0.5);
+	}
+	return 0;
+}
+
+/* called from _libusb_callback(): tag block and request hop when dwell is over.
+ * the hop itself is executed in rtlsdr_read_async() - outside of the callback */
+static void hop_tag_block(rtlsdr_dev_t *dev, uint32_t numSmp)
+{
+	struct hop_state *hop = &dev->hop;
+
+	if (hop->havePending) {
+		pthread_mutex_lock(&hop->mutex);
+		free(hop->entries);
+		hop->entries = hop->pending;
+		hop->num = hop->pendingNum;
+		hop->pending = NULL;
+		hop->pendingNum = 0;
+		hop->havePending = 0;
+		pthread_mutex_unlock(&hop->mutex);
+		hop->idx = 0;
+		hop->sweep = 0;
+		hop->tunedIdx = -1;
+		hop->tunedSweep = 0;
+		hop->retunePending = (hop->num > 0);
+	}
+
+	if (!hop->num) {
+		hop->tag.hop_index = -1;
+		hop->tag.settled = 1;
+		hop->tag.freq = dev->freq;
+		hop->tag.sweep = 0;
+		return;
+	}
+
+	if (hop->retunePending) {
+		/* captured at the current tuning: report its entry until hop_retune() */
+		hop->tag.hop_index = hop->tunedIdx;
+		hop->tag.freq = dev->freq;
+		hop->tag.sweep = hop->tunedSweep;
+		hop->tag.settled = 0;
+		return;
+	}
+
+	hop->tag.hop_index = hop->idx;
+	hop->tag.freq = hop->entries[hop->idx].freq;
+	hop->tag.sweep = hop->sweep;
+
+	if (hop->remainingSettle) {
+		/* block might contain samples from before retune */
+		hop->tag.settled = 0;
+		hop->remainingSettle -= (numSmp < hop->remainingSettle) ? numSmp : hop->remainingSettle;
+		return;
+	}
+
+	hop->tag.settled = 1;
+	hop->remainingDwell -= (numSmp < hop->remainingDwell) ? numSmp : hop->remainingDwell;
+	if (!hop->remainingDwell && hop->num > 1) {
+		if (++hop->idx >= hop->num) {
+			hop->idx = 0;
+			++hop->sweep;
+		}
+		hop->retunePending = 1;
+	} else if (!hop->remainingDwell) {
+		/* single entry: just count passes */
+		hop->remainingDwell = hop->entries[0].dwell ? hop->entries[0].dwell : 1;
+		++hop->sweep;
+	}
+}
+
+/* executed on USB thread in rtlsdr_read_async() */
+static void hop_retune(rtlsdr_dev_t *dev)
+{
+	struct hop_state *hop = &dev->hop;
+	const rtlsdr_hop_entry_t *e = &hop->entries[hop->idx];
+
+	if (e->bandwidth && e->bandwidth != dev->bw)
+		rtlsdr_set_tuner_bandwidth(dev, e->bandwidth);
+	if (e->gain != RTLSDR_HOP_KEEP_GAIN)
+		rtlsdr_set_tuner_gain(dev, e->gain);
+	if (e->freq != dev->freq)
+		rtlsdr_set_center_freq64(dev, e->freq);
+
+	hop->remainingSettle = e->settle ? e->settle : (dev->rate / 100);
+	hop->remainingDwell = e->dwell ? e->dwell : 1;
+	hop->tunedIdx = hop->idx;
+	hop->tunedSweep = hop->sweep;
+	hop->retunePending = 0;
+	if (dev->verbose >= 2)
+		fprintf(stderr, "rtlsdr hop to entry %d: %f MHz\n", hop->idx, e->freq * 1E-6);
+}
+
+int rtlsdr_set_hop_schedule(rtlsdr_dev_t *dev, const rtlsdr_hop_entry_t *entries, int num_entries)
+{
+	rtlsdr_hop_entry_t *copy = NULL;
+
+	if (!dev || num_entries < 0 || (num_entries && !entries))
+		return -1;
+
+	if (num_entries) {
+		copy = malloc(num_entries * sizeof(rtlsdr_hop_entry_t));
+		if (!copy)
+			return -1;
+		memcpy(copy, entries, num_entries * sizeof(rtlsdr_hop_entry_t));
+	}
+
+	pthread_mutex_lock(&dev->hop.mutex);
+	free(dev->hop.pending);
+	dev->hop.pending = copy;
+	dev->hop.pendingNum = num_entries;
+	dev->hop.havePending = 1;
+	pthread_mutex_unlock(&dev->hop.mutex);
+	return 0;
+}
+
+int rtlsdr_get_block_tag(rtlsdr_dev_t *dev, rtlsdr_block_tag_t *tag)
+{
+	if (!dev || !tag)
+		return -1;
+	if (!dev->hop.num) {
+		tag->hop_index = -1;
+		tag->settled = 1;
+		tag->freq = dev->freq;
+		tag->sweep = 0;
+		return 0;
+	}
+	*tag = dev->hop.tag;
+	return 0;
+}
+
+/* sums over a block of offset binary I/Q bytes */
+struct sigstats_sums {
+	uint64_t	sumI;       /* sum of I bytes */
+	uint64_t	sumQ;       /* sum of Q bytes */
+	uint64_t	sumSq;      /* sum of (x - 128)^2 over I and Q */
+	uint64_t	numClip;    /* number of bytes at 0 or 255 */
+	unsigned	minV, maxV;
+};
+
+static void sigstats_block(const unsigned char *buf, int len, struct sigstats_sums *r)
+{
+	uint64_t sumI = 0, sumQ = 0, sumSq = 0, numClip = 0;
+	int minV = 255, maxV = 0;
+	int i = 0;
+
+#if defined(RTLSDR_SIMD_SSE2)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i maskLo = _mm_set1_epi16(0x00ff);
+		const __m128i bias = _mm_set1_epi8((char)0x80);
+		const __m128i ones = _mm_set1_epi8(1);
+		const __m128i vmax = _mm_set1_epi8((char)0xff);
+		__m128i vMin = _mm_set1_epi8((char)0xff);
+		__m128i vMax = zero;
+		while (i + 16 <= len) {
+			/* 32 bit square sums can't overflow within a chunk */
+			const int chunkEnd = (len - i > 65536) ? (i + 65536) : (len & ~15);
+			__m128i accI = zero, accQ = zero, accSq = zero, accClip = zero;
+			uint64_t t[2];
+			uint32_t u[4];
+			for (; i < chunkEnd; i += 16) {
+				const __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+				/* (x - 128) as int8 - sign extended to int16 */
+				const __m128i d = _mm_xor_si128(v, bias);
+				const __m128i dLo = _mm_srai_epi16(_mm_unpacklo_epi8(d, d), 8);
+				const __m128i dHi = _mm_srai_epi16(_mm_unpackhi_epi8(d, d), 8);
+				const __m128i clip = _mm_or_si128(_mm_cmpeq_epi8(v, zero), _mm_cmpeq_epi8(v, vmax));
+				accI = _mm_add_epi64(accI, _mm_sad_epu8(_mm_and_si128(v, maskLo), zero));
+				accQ = _mm_add_epi64(accQ, _mm_sad_epu8(_mm_srli_epi16(v, 8), zero));
+				accSq = _mm_add_epi32(accSq, _mm_madd_epi16(dLo, dLo));
+				accSq = _mm_add_epi32(accSq, _mm_madd_epi16(dHi, dHi));
+				accClip = _mm_add_epi64(accClip, _mm_sad_epu8(_mm_and_si128(clip, ones), zero));
+				vMin = _mm_min_epu8(vMin, v);
+				vMax = _mm_max_epu8(vMax, v);
+			}
+			_mm_storeu_si128((__m128i *)t, accI);	sumI += t[0] + t[1];
+			_mm_storeu_si128((__m128i *)t, accQ);	sumQ += t[0] + t[1];
+			_mm_storeu_si128((__m128i *)t, accClip);	numClip += t[0] + t[1];
+			_mm_storeu_si128((__m128i *)u, accSq);
+			sumSq += (uint64_t)u[0] + u[1] + u[2] + u[3];
+		}
+		{
+			unsigned char t[16];
+			int k;
+			_mm_storeu_si128((__m128i *)t, vMin);
+			for (k = 0; k < 16; ++k)
+				minV = (t[k] < minV) ? t[k] : minV;
+			_mm_storeu_si128((__m128i *)t, vMax);
+			for (k = 0; k < 16; ++k)
+				maxV = (t[k] > maxV) ? t[k] : maxV;
+		}
+	}
+#elif defined(RTLSDR_SIMD_NEON)
+	{
+		uint8x16_t vMin = vdupq_n_u8(255);
+		uint8x16_t vMax = vdupq_n_u8(0);
+		while (i + 32 <= len) {
+			/* 16 bit sums can't overflow within a chunk of 128 iterations */
+			const int chunkEnd = (len - i > 128 * 32) ? (i + 128 * 32) : (len & ~31);
+			uint16x8_t accI = vdupq_n_u16(0), accQ = vdupq_n_u16(0), accClip = vdupq_n_u16(0);
+			int32x4_t accSq = vdupq_n_s32(0);
+			uint32x4_t w;
+			for (; i < chunkEnd; i += 32) {
+				const uint8x16x2_t v = vld2q_u8(buf + i);
+				const int8x16_t dI = vreinterpretq_s8_u8(veorq_u8(v.val[0], vdupq_n_u8(0x80)));
+				const int8x16_t dQ = vreinterpretq_s8_u8(veorq_u8(v.val[1], vdupq_n_u8(0x80)));
+				uint8x16_t clip = vorrq_u8(vceqq_u8(v.val[0], vdupq_n_u8(0)), vceqq_u8(v.val[0], vdupq_n_u8(255)));
+				clip = vsubq_u8(vdupq_n_u8(0), clip);	/* 0xff -> 1 */
+				clip = vaddq_u8(clip, vsubq_u8(vdupq_n_u8(0),
+					vorrq_u8(vceqq_u8(v.val[1], vdupq_n_u8(0)), vceqq_u8(v.val[1], vdupq_n_u8(255)))));
+				accI = vpadalq_u8(accI, v.val[0]);
+				accQ = vpadalq_u8(accQ, v.val[1]);
+				accClip = vpadalq_u8(accClip, clip);
+				accSq = vpadalq_s16(accSq, vmull_s8(vget_low_s8(dI), vget_low_s8(dI)));
+				accSq = vpadalq_s16(accSq, vmull_s8(vget_high_s8(dI), vget_high_s8(dI)));
+				accSq = vpadalq_s16(accSq, vmull_s8(vget_low_s8(dQ), vget_low_s8(dQ)));
+				accSq = vpadalq_s16(accSq, vmull_s8(vget_high_s8(dQ), vget_high_s8(dQ)));
+				vMin = vminq_u8(vMin, vminq_u8(v.val[0], v.val[1]));
+				vMax = vmaxq_u8(vMax, vmaxq_u8(v.val[0], v.val[1]));
+			}
+			w = vpaddlq_u16(accI);
+			sumI += (uint64_t)vgetq_lane_u32(w, 0) + vgetq_lane_u32(w, 1) + vgetq_lane_u32(w, 2) + vgetq_lane_u32(w, 3);
+			w = vpaddlq_u16(accQ);
+			sumQ += (uint64_t)vgetq_lane_u32(w, 0) + vgetq_lane_u32(w, 1) + vgetq_lane_u32(w, 2) + vgetq_lane_u32(w, 3);
+			w = vpaddlq_u16(accClip);
+			numClip += (uint64_t)vgetq_lane_u32(w, 0) + vgetq_lane_u32(w, 1) + vgetq_lane_u32(w, 2) + vgetq_lane_u32(w, 3);
+			w = vreinterpretq_u32_s32(accSq);
+			sumSq += (uint64_t)vgetq_lane_u32(w, 0) + vgetq_lane_u32(w, 1) + vgetq_lane_u32(w, 2) + vgetq_lane_u32(w, 3);
+		}
+		{
+			unsigned char t[16];
+			int k;
+			vst1q_u8(t, vMin);
+			for (k = 0; k < 16; ++k)
+				minV = (t[k] < minV) ? t[k] : minV;
+			vst1q_u8(t, vMax);
+			for (k = 0; k < 16; ++k)
+				maxV = (t[k] > maxV) ? t[k] : maxV;
+		}
+	}
+#endif
+
+	for (; i + 1 < len; i += 2) {
+		const int vI = buf[i];
+		const int vQ = buf[i+1];
+		sumI += vI;
+		sumQ += vQ;
+		sumSq += (vI - 128) * (vI - 128) + (vQ - 128) * (vQ - 128);
+		numClip += (vI == 0 || vI == 255) + (vQ == 0 || vQ == 255);
+		minV = (vI < minV) ? vI : minV;
+		minV = (vQ < minV) ? vQ : minV;
+		maxV = (vI > maxV) ? vI : maxV;
+		maxV = (vQ > maxV) ? vQ : maxV;
+	}
+
+	r->sumI = sumI;
+	r->sumQ = sumQ;
+	r->sumSq = sumSq;
+	r->numClip = numClip;
+	r->minV = (unsigned)minV;
+	r->maxV = (unsigned)maxV;
+}
+
+static void sigstats(rtlsdr_dev_t *dev, const unsigned char *buf, int len)
+{
+	struct sigstats_state *st = &dev->sigstats;
+	struct sigstats_sums r;
+	const double fs = 127.5;
+	double n, sumD, pk;
+	rtlsdr_signal_stats_t out;
+
+	if (++st->counter < st->interval)
+		return;
+	st->counter = 0;
+	len &= ~1;
+	if (len <= 0)
+		return;
+
+	sigstats_block(buf, len, &r);
+	n = len / 2;
+	/* sum over (x - 127.5)^2 = sum over (d + 0.5)^2 with d = x - 128 */
+	sumD = (double)(r.sumI + r.sumQ) - 128.0 * len;
+	pk = ( (r.maxV - fs) > (fs - r.minV) ) ? (r.maxV - fs) : (fs - r.minV);
+
+	out.block_count = st->stats.block_count + 1;
+	out.sample_count = (uint32_t)n;
+	out.mean_power = (float)( ((double)r.sumSq + sumD + 0.25 * len) / (n * fs * fs) );
+	out.peak = (float)(pk / fs);
+	out.clip_rate = (float)( (double)r.numClip / len );
+	out.dc_i = (float)( ((double)r.sumI / n - fs) / fs );
+	out.dc_q = (float)( ((double)r.sumQ / n - fs) / fs );
+
+	++st->seq;
+	RTLSDR_MEMORY_BARRIER();
+	st->stats = out;
+	RTLSDR_MEMORY_BARRIER();
+	++st->seq;
+}
+
+int rtlsdr_get_signal_stats(rtlsdr_dev_t *dev, rtlsdr_signal_stats_t *stats)
+{
+	struct sigstats_state *st;
+	uint32_t seq;
+
+	if (!dev || !stats)
+		return -1;
+
+	st = &dev->sigstats;
+	do {
+		seq = st->seq;
+		RTLSDR_MEMORY_BARRIER();
+		*stats = st->stats;
+		RTLSDR_MEMORY_BARRIER();
+	} while ( (seq & 1) || seq != st->seq );
+
+	return (stats->block_count) ? 0 : 1;
+}
+
 static void LIBUSB_CALL _libusb_callback(struct libusb_transfer *xfer)
 {
 	rtlsdr_dev_t *dev = (rtlsdr_dev_t *)xfer->user_data;
 
 	if (LIBUSB_TRANSFER_COMPLETED == xfer->status) {
 		int keepBlock = 1;
+		int len = xfer->actual_length;
+		if ( dev->sigstats.interval )
+			sigstats(dev, xfer->buffer, xfer->actual_length);
 		if ( dev->softagc.agcState != SOFTSTATE_OFF )
 			keepBlock = softagc(dev, xfer->buffer, xfer->actual_length);
 
+		if ( dev->iqcorr.mode != IQCORR_OFF && keepBlock )
+			iqcorr(dev, xfer->buffer, xfer->actual_length);
+
+		if ( (dev->hop.num || dev->hop.havePending) && keepBlock )
+			hop_tag_block(dev, xfer->actual_length / 2);
+
+		if ( dev->dsreal.mode != DSREAL_OFF && dev->direct_sampling && keepBlock )
+			len = dsreal_convert(&dev->dsreal, xfer->buffer, len);
+
 		if (dev->cb && keepBlock)
-			dev->cb(xfer->buffer, xfer->actual_length, dev->cb_ctx);
+			dev->cb(xfer->buffer, len, dev->cb_ctx);
 
 		libusb_submit_transfer(xfer); /* resubmit transfer */
 		dev->xfer_errors = 0;
@@ -3862,6 +4615,141 @@ int rtlsdr_wait_async(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb, void *ctx)
 	return rtlsdr_read_async(dev, cb, ctx, 0, 0);
 }
 
+/* alignment of each transfer buffer in the arena: cache line */
+#define XFER_BUF_ALIGN		64
+#define XFER_HUGEPAGE_SIZE	(2 * 1024 * 1024)
+
+#if defined(__linux__) && defined(SYS_mbind)
+/* bind pages to the NUMA node of the calling CPU. avoids dependency on libnuma */
+static void _rtlsdr_bind_arena_numa(rtlsdr_dev_t *dev)
+{
+	const int mpol_bind = 2;		/* MPOL_BIND from <numaif.h> */
+	const unsigned mpol_mf_move = 1 << 1;	/* MPOL_MF_MOVE */
+	unsigned cpu = 0, node = 0;
+	unsigned long nodemask[4];
+	long r;
+
+#ifdef SYS_getcpu
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) < 0)
+		return;
+#endif
+	if (node >= 8 * sizeof(nodemask))
+		return;
+	memset(nodemask, 0, sizeof(nodemask));
+	nodemask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+	r = syscall(SYS_mbind, dev->xfer_arena, dev->xfer_arena_len, mpol_bind,
+		nodemask, (unsigned long)(8 * sizeof(nodemask)), mpol_mf_move);
+	if (dev->verbose)
+		fprintf(stderr, "rtlsdr: bind transfer buffers to NUMA node %u of cpu %u: %s\n",
+			node, cpu, (r < 0) ? strerror(errno) : "ok");
+}
+#endif
+
+/* allocate all user-space transfer buffers as one aligned region.
+ * pages are touched here: rtlsdr_read_async() runs on the thread which
+ * consumes the samples in the callback, thus the pages get allocated
+ * on that thread's NUMA node (first touch) - or explicitly with 'bufnuma'.
+ * options 'bufhuge' and 'buflock' request huge pages and locked memory */
+static int _rtlsdr_alloc_arena(rtlsdr_dev_t *dev, size_t len)
+{
+	dev->xfer_arena = NULL;
+	dev->xfer_arena_mapped = 0;
+	dev->xfer_arena_locked = 0;
+	dev->xfer_arena_len = len;
+
+#if defined(__linux__)
+	if (dev->arena_hugepages || dev->arena_numa) {
+		void *p = MAP_FAILED;
+		const size_t hugeLen = (len + XFER_HUGEPAGE_SIZE - 1) & ~(size_t)(XFER_HUGEPAGE_SIZE - 1);
+#ifdef MAP_HUGETLB
+		if (dev->arena_hugepages) {
+			p = mmap(NULL, hugeLen, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			if (p != MAP_FAILED)
+				dev->xfer_arena_len = hugeLen;
+			else if (dev->verbose)
+				fprintf(stderr, "rtlsdr: no explicit huge pages available: %s\n", strerror(errno));
+		}
+#endif
+		if (p == MAP_FAILED) {
+			if (dev->arena_hugepages)
+				dev->xfer_arena_len = hugeLen;
+			p = mmap(NULL, dev->xfer_arena_len, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+			/* fall back to transparent huge pages */
+			if (p != MAP_FAILED && dev->arena_hugepages)
+				madvise(p, dev->xfer_arena_len, MADV_HUGEPAGE);
+#endif
+		}
+		if (p != MAP_FAILED) {
+			dev->xfer_arena = (unsigned char *)p;
+			dev->xfer_arena_mapped = 1;
+		} else {
+			dev->xfer_arena_len = len;
+		}
+	}
+#endif
+
+	if (!dev->xfer_arena) {
+#if defined(_WIN32)
+		dev->xfer_arena = (unsigned char *)_aligned_malloc(len, XFER_BUF_ALIGN);
+#else
+		void *p = NULL;
+		if (!posix_memalign(&p, XFER_BUF_ALIGN, len))
+			dev->xfer_arena = (unsigned char *)p;
+#endif
+		if (!dev->xfer_arena)
+			return -ENOMEM;
+	}
+
+#if defined(__linux__) && defined(SYS_mbind)
+	if (dev->arena_numa && dev->xfer_arena_mapped)
+		_rtlsdr_bind_arena_numa(dev);
+#endif
+
+	/* first touch */
+	memset(dev->xfer_arena, 0, dev->xfer_arena_len);
+
+#if defined(__linux__)
+	if (dev->arena_mlock) {
+		if (!mlock(dev->xfer_arena, dev->xfer_arena_len))
+			dev->xfer_arena_locked = 1;
+		else
+			fprintf(stderr, "rtlsdr: could not lock %u bytes of transfer buffers: %s\n",
+				(unsigned)dev->xfer_arena_len, strerror(errno));
+	}
+#endif
+	if (dev->verbose)
+		fprintf(stderr, "rtlsdr: transfer buffer arena of %u bytes, %s%s\n",
+			(unsigned)dev->xfer_arena_len,
+			dev->xfer_arena_mapped ? "mapped" : "aligned heap",
+			dev->xfer_arena_locked ? ", locked" : "");
+	return 0;
+}
+
+static void _rtlsdr_free_arena(rtlsdr_dev_t *dev)
+{
+	if (!dev->xfer_arena)
+		return;
+#if defined(__linux__)
+	if (dev->xfer_arena_locked)
+		munlock(dev->xfer_arena, dev->xfer_arena_len);
+	if (dev->xfer_arena_mapped)
+		munmap(dev->xfer_arena, dev->xfer_arena_len);
+	else
+		free(dev->xfer_arena);
+#elif defined(_WIN32)
+	_aligned_free(dev->xfer_arena);
+#else
+	free(dev->xfer_arena);
+#endif
+	dev->xfer_arena = NULL;
+	dev->xfer_arena_len = 0;
+	dev->xfer_arena_mapped = 0;
+	dev->xfer_arena_locked = 0;
+}
+
 static int _rtlsdr_alloc_async_buffers(rtlsdr_dev_t *dev)
 {
 	unsigned int i;
@@ -3914,13 +4802,12 @@ static int _rtlsdr_alloc_async_buffers(rtlsdr_dev_t *dev)
 
 	/* no zero-copy available, allocate buffers in userspace */
 	if (!dev->use_zerocopy) {
+		const size_t stride = (dev->xfer_buf_len + XFER_BUF_ALIGN - 1) & ~(size_t)(XFER_BUF_ALIGN - 1);
 		fprintf(stderr, "Allocating %d (non-zero-copy) user-space buffers\n", dev->xfer_buf_num);
-		for (i = 0; i < dev->xfer_buf_num; ++i) {
-			dev->xfer_buf[i] = malloc(dev->xfer_buf_len);
-
-			if (!dev->xfer_buf[i])
-				return -ENOMEM;
-		}
+		if (_rtlsdr_alloc_arena(dev, stride * dev->xfer_buf_num) < 0)
+			return -ENOMEM;
+		for (i = 0; i < dev->xfer_buf_num; ++i)
+			dev->xfer_buf[i] = dev->xfer_arena + i * stride;
 	}
 
 	return 0;
@@ -3953,8 +4840,6 @@ static int _rtlsdr_free_async_buffers(rtlsdr_dev_t *dev)
 							    dev->xfer_buf[i],
 							    dev->xfer_buf_len);
 #endif
-				} else {
-					free(dev->xfer_buf[i]);
 				}
 			}
 		}
@@ -3963,6 +4848,8 @@ static int _rtlsdr_free_async_buffers(rtlsdr_dev_t *dev)
 		dev->xfer_buf = NULL;
 	}
 
+	_rtlsdr_free_arena(dev);
+
 	return 0;
 }
 
@@ -4014,6 +4901,21 @@ int rtlsdr_read_async(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb, void *ctx,
 
 	_rtlsdr_alloc_async_buffers(dev);
 
+	if (dev->dsreal.mode != DSREAL_OFF &&
+	    dsreal_init(&dev->dsreal, dev->dsreal.mode, dev->xfer_buf_len) < 0) {
+		fprintf(stderr, "Failed to allocate the work buffer for direct sampling real output\n");
+		_rtlsdr_free_async_buffers(dev);
+		dev->async_status = RTLSDR_INACTIVE;
+		return -1;
+	}
+
+	/* a schedule set before streaming: hop to the first entry right now */
+	if (dev->hop.havePending) {
+		hop_tag_block(dev, 0);
+		if (dev->hop.retunePending)
+			hop_retune(dev);
+	}
+
 	for(i = 0; i < dev->xfer_buf_num; ++i) {
 		libusb_fill_bulk_transfer(dev->xfer[i],
 						dev->devh,
@@ -4047,6 +4949,9 @@ int rtlsdr_read_async(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb, void *ctx,
 			break;
 		}
 
+		if (dev->hop.retunePending && RTLSDR_RUNNING == dev->async_status)
+			hop_retune(dev);
+
 		if (RTLSDR_CANCELING == dev->async_status) {
 			next_status = RTLSDR_INACTIVE;
 
@@ -4382,6 +5287,16 @@ const char * rtlsdr_get_opt_help(int longInfo)
 #endif
 		"\t\tTp=<gpio_pin>         set GPIO pin for Bias T, default =0 for rtl-sdr.com compatible V3\n"
 		"\t\tT=<bias_tee>          1 activates power at antenna one some dongles, e.g. rtl-sdr.com's V3\n"
+		"\t\tbufhuge=<on>          1 allocates async transfer buffers in huge pages (Linux)\n"
+		"\t\tbuflock=<on>          1 locks async transfer buffers in memory (Linux)\n"
+		"\t\tbufnuma=<on>          1 binds async transfer buffers to NUMA node of the reading thread (Linux)\n"
+		"\t\tdsreal=<mode>         output in direct sampling: 0: I/Q as captured (default);\n"
+		"\t\t                        1: packed real ADC samples; 2: I/Q at half rate centered at rate/4\n"
+		"\t\tstats=<N>             measure signal statistics on every N'th block. default: 0 = off\n"
+		"\t\tiqc=<mode>            DC offset and I/Q imbalance correction in library. default: 0\n"
+		"\t\t                        0: off; 1: remove DC; 2: remove DC and correct gain/phase imbalance\n"
+		"\t\tiqcdec=<N>            DC/IQ estimator uses every N'th I/Q pair. default: 16\n"
+		"\t\tiqcavg=<blocks>       DC/IQ estimator averaging time constant in blocks. default: 16\n"
 #ifdef WITH_UDP_SERVER
 		"\t\tport=<udp_port>       1 or tcp port number activates UDP server. default: 0.\n"
 		"\t\t                        default port number: 32323\n"
@@ -4401,6 +5316,8 @@ const char * rtlsdr_get_opt_help(int longInfo)
 #else
 		"\t\tds=<direct_sampling>:dm=<ds_mode_thresh>:T=<bias_tee>\n"
 #endif
+		"\t\tbufhuge=<on>:buflock=<on>:bufnuma=<on>\n"
+		"\t\tdsreal=<mode>:stats=<N>:iqc=<mode>:iqcdec=<N>:iqcavg=<blocks>\n"
 #ifdef WITH_UDP_SERVER
 		"\t\tport=<udp_port default with 1>\n"
 #endif
@@ -4611,6 +5528,93 @@ int rtlsdr_set_opt_string(rtlsdr_dev_t *dev, const char *opts, int verbose)
 			dev->softagc.verbose = 1;
 			ret = 0;
 		}
+		else if (!strncmp(optPart, "bufhuge=", 8)) {
+			dev->arena_hugepages = atoi(optPart +8);
+			if (verbose)
+				fprintf(stderr, "\nrtlsdr_set_opt_string(): parsed huge pages for transfer buffers %d\n", dev->arena_hugepages);
+		}
+		else if (!strncmp(optPart, "buflock=", 8)) {
+			dev->arena_mlock = atoi(optPart +8);
+			if (verbose)
+				fprintf(stderr, "\nrtlsdr_set_opt_string(): parsed locking of transfer buffers %d\n", dev->arena_mlock);
+		}
+		else if (!strncmp(optPart, "bufnuma=", 8)) {
+			dev->arena_numa = atoi(optPart +8);
+			if (verbose)
+				fprintf(stderr, "\nrtlsdr_set_opt_string(): parsed NUMA binding of transfer buffers %d\n", dev->arena_numa);
+		}
+		else if (!strncmp(optPart, "dsreal=", 7)) {
+			int mode = atoi(optPart +7);
+			if (RTLSDR_INACTIVE != dev->async_status) {
+				/* the usb callback converts with the state: no switch while streaming */
+				if (verbose)
+					fprintf(stderr, "\nrtlsdr_set_opt_string(): direct sampling real output mode can't be changed while streaming\n");
+				ret = -1;
+			}
+			else if ( 0 <= mode && mode <= 2 )
+			{
+				if (dsreal_init(&dev->dsreal, (enum dsreal_mode)mode,
+					dev->xfer_buf_len ? dev->xfer_buf_len : DEFAULT_BUF_LENGTH) < 0) {
+					fprintf(stderr, "\nrtlsdr_set_opt_string(): failed to allocate work buffer for direct sampling real output\n");
+					ret = -1;
+				} else {
+					if (dev->direct_sampling)
+						rtlsdr_set_center_freq64(dev, dev->freq);
+					ret = 0;
+					if (verbose)
+						fprintf(stderr, "\nrtlsdr_set_opt_string(): parsed direct sampling real output mode %d\n", mode);
+				}
+			} else {
+				if (verbose)
+					fprintf(stderr, "\nrtlsdr_set_opt_string(): error parsing direct sampling real output mode: valid range 0 .. 2\n");
+				ret = -1;  /* reported by retAll */
+			}
+		}
+		else if (!strncmp(optPart, "stats=", 6)) {
+			int interval = atoi(optPart +6);
+			if (interval < 0)
+				interval = 0;
+			if (verbose)
+				fprintf(stderr, "\nrtlsdr_set_opt_string(): parsed signal statistics on every %d'th block\n", interval);
+			dev->sigstats.counter = 0;
+			dev->sigstats.interval = interval;
+		}
+		else if (!strncmp(optPart, "iqc=", 4)) {
+			int mode = atoi(optPart +4);
+			if ( 0 <= mode && mode <= 2 )
+			{
+				dev->iqcorr.mode = (enum iqcorr_mode)mode;
+				dev->iqcorr.restart = 1;
+				ret = 0;
+				if (verbose)
+					fprintf(stderr, "\nrtlsdr_set_opt_string(): parsed DC/IQ correction mode %d\n", mode);
+			} else {
+				if (verbose)
+					fprintf(stderr, "\nrtlsdr_set_opt_string(): error parsing DC/IQ correction mode: valid range 0 .. 2\n");
+				ret = -1;  /* reported by retAll */
+			}
+		}
+		else if (!strncmp(optPart, "iqcdec=", 7)) {
+			int decimation = atoi(optPart +7);
+			if (decimation < 1)
+				decimation = 1;
+			if (verbose)
+				fprintf(stderr, "\nrtlsdr_set_opt_string(): parsed DC/IQ estimator decimation %d\n", decimation);
+			dev->iqcorr.decimation = decimation;
+		}
+		else if (!strncmp(optPart, "iqcavg=", 7)) {
+			int avgBlocks = atoi(optPart +7);
+			if (avgBlocks < 1)
+				avgBlocks = 1;
+			if (verbose)
+				fprintf(stderr, "\nrtlsdr_set_opt_string(): parsed DC/IQ estimator averaging over %d blocks\n", avgBlocks);
+			dev->iqcorr.avgBlocks = avgBlocks;
+		}
+		else if (!strcmp(optPart, "iqcverbose")) {
+			fprintf(stderr, "\nrtlsdr_set_opt_string(): parsed option iqcverbose for DC/IQ correction\n");
+			dev->iqcorr.verbose = 1;
+			ret = 0;
+		}
 #ifdef WITH_UDP_SERVER
 		else if (!strncmp(optPart, "port=", 5)) {
 			int udpPortNo = atoi(optPart +5);
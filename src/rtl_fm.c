@@ -58,6 +58,8 @@
 
 #ifndef _WIN32
 #include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
 #else
 #include <windows.h>
 #include <fcntl.h>
@@ -86,35 +88,69 @@
 #include "convenience/convenience.h"
 #include "convenience/rtl_convenience.h"
 #include "convenience/wavewrite.h"
+#include "convenience/waveread.h"
+#include "convenience/decimate.h"
+#include "convenience/resample.h"
+#include "convenience/fmdisc.h"
+#include "convenience/channelizer.h"
+#include "convenience/trigger.h"
+#include "convenience/measstream.h"
 
 #define DEFAULT_SAMPLE_RATE		24000
 #define DEFAULT_BUF_LENGTH		(1 * 16384)
 #define MAXIMUM_OVERSAMPLE		16
-#define MAXIMUM_BUF_LENGTH		(MAXIMUM_OVERSAMPLE * DEFAULT_BUF_LENGTH)
+#define MAXIMUM_BUF_LENGTH		(MAXIMUM_OVERSAMPLE * DEFAULT_BUF_LENGTH)	/* limit of -b */
+#define TILE_LENGTH			4096	/* int16 values: passes over a block run tile by tile in cache */
 #define AUTO_GAIN				-100
 #define DEFAULT_BUFFER_DUMP		4096
 
 #define FREQUENCIES_LIMIT		1024
 
+/* demod_state.use_float: stages after the demodulator in float32 */
+#define FLOAT_OFF			0	/* int16 pipeline */
+#define FLOAT_PROCESS			1	/* float32 pipeline, int16 output */
+#define FLOAT_OUTPUT			2	/* float32 pipeline and output, full scale = 1.0 */
+#define BLOCK_QUEUE_LEN			8	/* blocks per queue, power of 2 */
+#define LOW_LATENCY_BLOCK_MS		2	/* usb transfer size with -E lowlat */
+#define MAX_RECEIVERS			8	/* devices in one process */
+#define SCAN_MAX_CAPTURE		2400000	/* highest capture rate for -E pscan */
+#define SCAN_USABLE			0.8	/* part of the capture bandwidth holding channels */
+#define SQUELCH_ATTACK_MS		1.0	/* defaults of -l open:close:attack:release */
+#define SQUELCH_RELEASE_MS		50.0
+
+#if defined(_MSC_VER)
+#define QUEUE_BARRIER()			MemoryBarrier()
+#else
+#define QUEUE_BARRIER()			__sync_synchronize()
+#endif
+
+#define MIN(x, y)			(((x) < (y)) ? (x) : (y))
+
 static int BufferDump = DEFAULT_BUFFER_DUMP;
 static int OutputToStdout = 1;
+static int low_latency = 0;
 static int MinCaptureRate = 1000000;
 
 static volatile int do_exit = 0;
 static int lcm_post[17] = {1,1,1,3,1,5,3,7,1,9,5,11,3,13,7,15,1};
 static int ACTUAL_BUF_LENGTH;
 
-static int *atan_lut = NULL;
-static int atan_lut_size = 131072; /* 512 KB */
-static int atan_lut_coef = 8;
 
 static int verbosity = 0;
 static int printLevels = 0;
-static int printLevelNo = 1;
-static int levelMax = 0;
-static int levelMaxMax = 0;
-static double levelSum = 0.0;
-static int32_t prev_if_band_center_freq = 0;
+static struct meas_stream meas;	/* -S: levels as records instead of text */
+
+/* per stage timing: with -I replay or -E profile */
+enum stage_id { STAGE_CONVERT = 0, STAGE_ROTATE, STAGE_SCAN, STAGE_DECIMATE, STAGE_LEVELS, STAGE_DEMOD,
+	STAGE_POST, STAGE_RESAMPLE, STAGE_OUTPUT, STAGE_WRITE, STAGE_NUM };
+static const char * stage_names[STAGE_NUM] = { "conversion", "rotation", "scan/mixing", "decimation",
+	"squelch/levels", "demodulation", "deemph/dc block", "resampling", "output", "write" };
+static int profiling = 0;
+static uint64_t stage_ns[STAGE_NUM];	/* each one written by a single thread */
+static volatile uint64_t profile_samples = 0;	/* I/Q pairs at capture rate */
+static uint64_t profile_start_ns = 0, profile_end_ns = 0;	/* replay */
+
+#define PROFILE_STAGE(t, stage)	do { if (profiling) { uint64_t t_ = now_ns(); stage_ns[stage] += t_ - (t); (t) = t_; } } while (0)
 
 
 enum trigExpr { crit_IN =0, crit_OUT, crit_LT, crit_GT };
@@ -124,18 +160,11 @@ time_t stop_time;
 int duration = 0;
 
 
-struct cmd_state
+/* one line of the command file */
+struct cmd_line
 {
-	const char * filename;
-	FILE * file;
 	int lineNo;
-	char acLine[4096];
-	int checkADCmax;
-	int checkADCrms;
-	uint64_t prevFreq;
 	uint64_t freq;
-	int prevGain;
-	uint32_t prevBandwidth;
 	int gain;
 	enum trigExpr trigCrit;
 	double refLevel;
@@ -144,15 +173,83 @@ struct cmd_state
 	int numBlockTrigger;
 	char * command;
 	char * args;
-	double levelSum;
+	double levelSum;	/* of the running measurement */
+	double levelPeak;
 	int numSummed;
+	int32_t offset;		/* -E cgroup: to the center of its capture */
+};
+
+/* statistics per line number, printed at exit */
+struct cmd_stat
+{
+	uint64_t freq;
+	int waitTrigger;
+	int numLevels;
+	double sumLevels;
+	float minLevel;
+	float maxLevel;
+};
+
+struct cmd_state
+{
+	const char * filename;
+	FILE * file;
+	int lineNo;
+	char acLine[4096];
+	int checkADCmax;
+	int checkADCrms;
+	uint64_t prevFreq;
+	uint64_t freq;		/* to tune: of the current line or group */
+	int prevGain;
+	uint32_t prevBandwidth;
+	int gain;
+	struct cmd_line cur;	/* line being measured, without -E cgroup */
 	int omitFirstFreqLevels;
-	int waitTrigger[FREQUENCIES_LIMIT];
-	int statNumLevels[FREQUENCIES_LIMIT];
-	uint64_t statFreq[FREQUENCIES_LIMIT];
-	double statSumLevels[FREQUENCIES_LIMIT];
-	float statMinLevel[FREQUENCIES_LIMIT];
-	float statMaxLevel[FREQUENCIES_LIMIT];
+	struct cmd_stat *stats;	/* grows with the line numbers */
+	int numStats;
+	/* -E cgroup: all lines of the file, measured a capture at a time */
+	int grouped;
+	struct cmd_line *lines;	/* sorted by gain and frequency */
+	int numLines;
+	int *groupFirst;	/* lines of group g: groupFirst[g] .. groupFirst[g+1]-1 */
+	uint64_t *groupFreq;	/* center of group g */
+	int numGroups;
+	int group;		/* being measured */
+	double groupSpan;	/* frequency span fitting into a capture */
+	struct chan_power cp;
+	const char * triggerSink;	/* -e: events to a fifo/socket instead of commands */
+	struct trigger_dispatch trig;
+};
+
+/* one preallocated block in a queue */
+struct queue_block
+{
+	void	 *buf;	/* capacity samples of sample_size bytes, swapped with the stages' buffers */
+	int	  len;
+	unsigned gen;	/* dongle.tune_gen when the block was captured */
+	uint64_t ts;	/* with -E lowlat: capture time of 1st sample, now_ns() clock */
+};
+
+/* bounded single producer / single consumer queue:
+ * head is only written by the producer, tail only by the consumer.
+ * the mutex and conditions are only taken to sleep on an empty queue
+ * or - in blocking mode - on a full one. */
+struct block_queue
+{
+	const char *name;
+	struct queue_block blocks[BLOCK_QUEUE_LEN];
+	volatile unsigned head;
+	volatile unsigned tail;
+	volatile int consumer_waits;
+	volatile int producer_waits;
+	volatile int closed;	/* producer finished: consumer gets NULL once empty */
+	int	  blocking;
+	int	  sample_size;
+	int	  capacity;	/* samples per block, 0 until block_queue_alloc() */
+	unsigned pushed, overruns, max_fill;
+	pthread_mutex_t m;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
 };
 
 struct dongle_state
@@ -167,54 +264,113 @@ struct dongle_state
 	uint32_t bandwidth;
 	int	  bccorner;  /* -1 for low band corner, 0 for band center, +1 for high band corner */
 	int	  gain;
-	int16_t  buf16[MAXIMUM_BUF_LENGTH];
 	uint32_t buf_len;
 	int	  ppm_error;
 	int	  offset_tuning;
 	int	  direct_sampling;
 	int	  mute;
+	volatile unsigned tune_gen;
+	FILE	 *replay_file;	/* -I: recorded input instead of dev */
+	int	  replay_bits;	/* 0 for raw u8 I/Q, else bits per sample of wave */
+	uint32_t replay_rate;	/* samplerate of wave, 0 = unknown */
 	struct demod_state *demod_target;
 	double samplePowSum;
 	int samplePowCount;
 	unsigned char sampleMax;
 };
 
+#define MAX_DEMOD_STAGES	12
+
+struct demod_state;
+
+/* one step of the demod chain, see build_demod_chain() */
+struct demod_stage
+{
+	void	 (*fn)(struct demod_state*);
+	const char *name;
+	int	  prof;	/* enum stage_id */
+};
+
+/* -E pscan: channels are grouped into captures,
+ * controller.freqs[] holds the center of each capture */
+struct scan_state
+{
+	int	  enabled;
+	int	  num;		/* channels */
+	uint32_t *freqs;	/* sorted */
+	int32_t  *offsets;	/* to the center of their capture */
+	int	 *first;	/* channels of capture g: first[g] .. first[g+1]-1 */
+	int	  active;	/* channel being demodulated, -1 for none */
+	struct chan_power cp;
+	struct chan_mixer mixer;
+};
+
+/* -l open:close[:attack:release]: power squelch, tracked pair by pair
+ * in the decimation pass and gated sample accurately */
+struct squelch_state
+{
+	int	  enabled;
+	int	  skip_demod;	/* -E sqskip: closed blocks are not demodulated */
+	int	  close_level;	/* rms, below open level: hysteresis */
+	double	  attack_ms, release_ms;
+	float	  open_pow, close_pow;	/* levels squared: mean square of I and Q */
+	float	  attack, release;	/* smoothing factors per I/Q pair */
+	float	  env;		/* power envelope */
+	int	  open;
+	int	  open_pairs;	/* of the current block */
+	double	  pow_sum;	/* of the current block, for its rms */
+};
+
 struct demod_state
 {
 	int	  exit_flag;
 	pthread_t thread;
-	int16_t  lowpassed[MAXIMUM_BUF_LENGTH];
+	int16_t  *lowpassed;	/* dongle.buf_len values, swapped with the queue's blocks */
 	int	  lp_len;
-	int16_t  lp_i_hist[10][6];
-	int16_t  lp_q_hist[10][6];
-	int16_t  result[MAXIMUM_BUF_LENGTH];
-	int16_t  droop_i_hist[9];
-	int16_t  droop_q_hist[9];
+	struct cic5_state lp_cic[CIC_TABLE_MAX];
+	int16_t  *result;	/* result_cap values each */
+	float	 *resultf;	/* float pipeline */
+	int	  result_cap;
+	struct cfir_state droop;
+	int	  droop_passes;
 	int	  result_len;
 	int	  rate_in;
 	int	  rate_out;
 	int	  rate_out2;
 	int	  now_r, now_j;
-	int	  pre_r, pre_j;
 	int	  prev_index;
 	int	  downsample;	/* min 1, max 256 */
 	int	  post_downsample;
 	int	  output_scale;
 	int	  squelch_level, conseq_squelch, squelch_hits, terminate_on_squelch;
+	struct squelch_state sq;
 	int	  downsample_passes;
 	int	  comp_fir_size;
-	int	  custom_atan;
-	int	  deemph, deemph_a;
-	int	  now_lpr;
-	int	  prev_lpr_index;
+	int	  custom_atan;	/* enum fmdisc_mode */
+	struct fmdisc_state disc;
+	int	  deemph, deemph_a, deemph_avg;
+	struct resampler resamp;	/* rate_out -> rate_out2 */
 	int	  dc_block_audio, dc_avg, adc_block_const;
 	int	  dc_block_raw, dc_avgI, dc_avgQ, rdc_block_const;
 	void	 (*mode_demod)(struct demod_state*);
-	pthread_rwlock_t rw;
-	pthread_cond_t ready;
-	pthread_mutex_t ready_m;
+	int	  use_float;	/* FLOAT_OFF, FLOAT_PROCESS or FLOAT_OUTPUT */
+	void	 (*mode_demod_f)(struct demod_state*);	/* lowpassed -> resultf */
+	float	  deemph_avgf, dc_avgf;
+	struct block_queue queue;
+	int	  skip_stale;
+	unsigned stale_gen;
+	uint64_t block_ts;	/* ts of the block in lowpassed */
+	struct scan_state scan;
+	struct demod_stage chain[MAX_DEMOD_STAGES];	/* enabled stages only */
+	int	  chain_len;
+	int	  chain_stop;	/* set by a stage: skip the rest of the chain for this block */
 	struct output_state *output_target;
 	struct cmd_state *cmd;
+	struct dongle_state *dongle;
+	struct controller_state *controller;
+	/* -L statistics */
+	int	  printLevelNo, levelMax, levelMaxMax, printBlockLen;
+	double	  levelSum;
 };
 
 struct output_state
@@ -224,12 +380,13 @@ struct output_state
 	FILE	 *file;
 	char	 *filename;
 	char	 *tempfilename;
-	int16_t  result[MAXIMUM_BUF_LENGTH];
-	int	  result_len;
 	int	  rate;
-	pthread_rwlock_t rw;
-	pthread_cond_t ready;
-	pthread_mutex_t ready_m;
+	struct block_queue queue;
+	/* antenna to output latency with -E lowlat, in ns */
+	uint64_t lat_num, lat_max, lat_min;
+	double	  lat_sum;
+	uint64_t win_num, win_max, win_start;	/* window for verbose reports */
+	double	  win_sum;
 };
 
 struct controller_state
@@ -244,15 +401,33 @@ struct controller_state
 	pthread_cond_t hop;
 	pthread_mutex_t hop_m;
 	struct cmd_state *cmd;
+	struct dongle_state *dongle;
+	struct demod_state *demod;
+	int	  min_capture_rate;
+	int32_t  prev_if_band_center_freq;
 };
 
-/* multiple of these, eventually */
+/* one device with its own threads, set up by receiver_link() */
+struct receiver
+{
+	struct dongle_state *dongle;
+	struct demod_state *demod;
+	struct output_state *output;
+	struct controller_state *controller;
+	struct cmd_state *cmd;
+};
+
+/* the 1st receiver, which the options are parsed into */
 struct dongle_state dongle;
 struct demod_state demod;
 struct output_state output;
 struct controller_state controller;
 struct cmd_state cmd;
 
+/* further receivers for -d given more than once are allocated */
+static struct receiver rx[MAX_RECEIVERS];
+static int rx_num = 1;
+
 
 void usage(void)
 {
@@ -271,6 +446,8 @@ void usage(void)
 		"\t[-C command_filename: command file with comma seperated values (.csv). sets modulation 'raw']\n"
 		"\t\tcommand file contains lines with: freq,gain,trig-crit,trig_level,trig_tolerance,#meas,#blocks,trigger_command,arguments\n"
 		"\t\t with trig_crit one of 'in', 'out', 'lt' or 'gt'\n"
+		"\t[-e trigger_sink: fifo, unix socket or file receiving the triggers of -C\n"
+		"\t	as JSON lines, instead of executing their commands]\n"
 		"\t[-B num_samples at capture rate: remove that many samples at capture_rate after changing frequency (default: 4096)]\n"
 		"\t[-m minimum_capture_rate Hz (default: 1m, min=900k, max=3.2m)]\n"
 		"\t[-v increase verbosity (default: 0)]\n"
@@ -280,6 +457,9 @@ void usage(void)
 		"\t	raw mode outputs 2x16 bit IQ pairs\n"
 		"\t[-s sample_rate (default: 24k)]\n"
 		"\t[-d device_index or serial (default: 0)]\n"
+		"\t	repeat -d to receive with several devices (max 8): each -f applies to the\n"
+		"\t	device of the preceding -d, all other options to every device.\n"
+		"\t	give one output filename per device, in the order of -d (no -H, -I, -C)\n"
 		"\t[-T enable bias-T on GPIO PIN 0 (works for rtl-sdr.com v3 dongles)]\n"
 		"\t[-D direct_sampling_mode (default: 0, 1 = I, 2 = Q, 3 = I below threshold, 4 = Q below threshold)]\n"
 		"\t[-D direct_sampling_threshold_frequency (default: 0 use tuner specific frequency threshold for 3 and 4)]\n"
@@ -287,9 +467,17 @@ void usage(void)
 		"\t[-w tuner_bandwidth in Hz (default: automatic)]\n"
 		"\t[-W length of single buffer in units of 512 samples (default: 32 was 256)]\n"
 		"\t[-l squelch_level (default: 0/off)]\n"
+		"\t[-l open_level:close_level[:attack_ms:release_ms] (default attack/release: 1:50)]\n"
+		"\t	squelch tracked sample by sample during decimation: opens above open_level,\n"
+		"\t	closes below close_level, the power envelope follows within attack/release.\n"
+		"\t	-E sqskip skips demodulation of blocks without open samples (not with pscan)\n"
 		"\t[-L N  prints levels every N calculations]\n"
 		"\t	output are comma separated values (csv):\n"
 		"\t	avg rms since last output, max rms since last output, overall max rms, squelch (paramed), rms, rms level, avg rms level\n"
+		"\t[-S meas_stream: levels of -L and measurements of -C as records instead of text,\n"
+		"\t	to a file, fifo or udp:host:port, written once per second.\n"
+		"\t	binary: header, then per record ts, freq, rms, peak, adc max/rms, trigger, line.\n"
+		"\t	see convenience/measstream.h. -E ndjson for JSON lines]\n"
 		"\t[-c de-emphasis_time_constant in us for wbfm. 'us' or 'eu' for 75/50 us (default: us)]\n"
 #if 0
 		"\t	for fm squelch is inverted\n"
@@ -308,24 +496,48 @@ void usage(void)
 		"\t	deemp:  enable de-emphasis filter\n"
 		"\t	direct: enable direct sampling (bypasses tuner, uses rtl2832 xtal)\n"
 		"\t	offset: enable offset tuning (only e4000 tuner)\n"
+		"\t	float:  float32 processing after the demodulator, int16 output\n"
+		"\t	f32:    float32 processing and float32 output (full scale 1.0),\n"
+		"\t	        written as IEEE float wave with -H\n"
+		"\t	lowlat: low latency: small usb transfers (~2 ms, unless -W), unbuffered output,\n"
+		"\t	        reports the antenna to output latency (every second with -v)\n"
+		"\t	pscan:  parallel scan: one fft per block measures all channels within the\n"
+		"\t	        capture bandwidth (up to 2.4 MHz) and the strongest one above squelch\n"
+		"\t	        is demodulated. retunes only when the channels need several captures\n"
+		"\t	cgroup: with -C: lines within the capture bandwidth (up to 2.4 MHz) and of the\n"
+		"\t	        same gain are measured concurrently, from one fft per block.\n"
+		"\t	        retunes only between these groups\n"
+		"\t	ndjson: -S writes JSON lines instead of binary records\n"
+		"\t	sqskip: no demodulation of blocks, where -l open:close stayed closed\n"
+		"\t	profile: print time per stage in ns/sample at exit\n"
+		"\t	lossless: wait instead of dropping blocks, when demod or output fall behind\n"
+		"\t	          (meant for replay; with a live dongle the loss moves to USB)\n"
 		"\t	bcc:    use tuner bandwidths center as band center (default)\n"
 		"\t	bclo:   use tuner bandwidths low  corner as band center\n"
 		"\t	bchi:   use tuner bandwidths high corner as band center\n"
 		"%s"
 		"\t[-q dc_avg_factor for option rdc (default: 9)]\n"
 		"\t[-n disables demodulation output to stdout/file]\n"
+		"\t[-I replay_file: process recorded I/Q at maximum speed instead of a dongle]\n"
+		"\t	raw 8 bit I/Q as from rtl_sdr, '-' for stdin, or 8/16 bit I/Q wave file\n"
+		"\t	recorded at the capture rate and frequency, which -v reports.\n"
+		"\t	implies -E lossless and -E profile, reporting the real-time factor\n"
 		"\t[-H write wave Header to file (default: off)]\n"
 		"\t	limitation: only 1st tuned frequency will be written into the header!\n"
-		"\tfilename ('-' means stdout)\n"
+		"\tfilename ('-' means stdout), one per device\n"
 		"\t	omitting the filename also uses stdout\n\n"
 		"Experimental options:\n"
 		"\t[-r resample_rate (default: none / same as -s)]\n"
+		"\t	exact rational resampling of the audio, e.g. -s 170k -r 32k or -s 240k -r 48k\n"
 		"\t[-t squelch_delay (default: 10)]\n"
 		"\t	+values will mute/scan, -values will exit\n"
 		"\t[-F fir_size (default: off)]\n"
 		"\t	enables low-leakage downsample filter\n"
 		"\t	size can be 0 or 9.  0 has bad roll off\n"
-		"\t[-A std/fast/lut/ale choose atan math (default: std)]\n"
+		"\t[-A std/fast/lut/ale/poly/polyfix choose atan math (default: std)]\n"
+		"\t\tlut: small interpolated table, poly: vectorized float polynomial,\n"
+		"\t\tpolyfix: fixed point polynomial for cpus without fpu\n"
+		"\t[-A bench: compare accuracy and speed of all atan modes, then exit]\n"
 #if 0
 		"\t[-C clip_path (default: off)\n"
 		"\t (create time stamped raw clips, requires squelch)\n"
@@ -334,7 +546,7 @@ void usage(void)
 		"\t (fifo will contain the active frequency)\n"
 #endif
 		"\n"
-		"Produces signed 16 bit ints, use Sox or aplay to hear them.\n"
+		"Produces signed 16 bit ints - or 32 bit floats with -E f32, use Sox or aplay to hear them.\n"
 		"\trtl_fm ... | play -t raw -r 24k -es -b 16 -c 1 -V1 -\n"
 		"\t		   | aplay -r 24000 -f S16_LE -t raw -c 1\n"
 		"\t  -M wbfm  | play -r 32k ... \n"
@@ -343,6 +555,15 @@ void usage(void)
 	exit(1);
 }
 
+static void cancel_all(void)
+{
+	int i;
+	for (i = 0; i < rx_num; i++) {
+		if (rx[i].dongle && rx[i].dongle->dev)
+			rtlsdr_cancel_async(rx[i].dongle->dev);
+	}
+}
+
 #ifdef _WIN32
 BOOL WINAPI
 sighandler(int signum)
@@ -350,7 +571,7 @@ sighandler(int signum)
 	if (CTRL_C_EVENT == signum) {
 		fprintf(stderr, "Signal caught, exiting!\n");
 		do_exit = 1;
-		rtlsdr_cancel_async(dongle.dev);
+		cancel_all();
 		return TRUE;
 	}
 	return FALSE;
@@ -360,30 +581,173 @@ static void sighandler(int signum)
 {
 	fprintf(stderr, "Signal caught, exiting!\n");
 	do_exit = 1;
-	rtlsdr_cancel_async(dongle.dev);
+	cancel_all();
 }
 #endif
 
+static uint64_t now_ns(void)
+{
+#ifdef _WIN32
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER ticks;
+	if (!freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&ticks);
+	return (uint64_t)((double)ticks.QuadPart * 1E9 / (double)freq.QuadPart);
+#elif defined(__APPLE__)
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000000U + (uint64_t)tv.tv_usec * 1000U;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000U + (uint64_t)ts.tv_nsec;
+#endif
+}
+
 /* more cond dumbness */
 #define safe_cond_signal(n, m) do { pthread_mutex_lock(m); pthread_cond_signal(n); pthread_mutex_unlock(m); } while (0)
 #define safe_cond_wait(n, m)   do { pthread_mutex_lock(m); pthread_cond_wait(n, m); pthread_mutex_unlock(m); } while (0)
 
-/* {length, coef, coef, coef}  and scaled by 2^15
-   for now, only length 9, optimal way to get +85% bandwidth */
-#define CIC_TABLE_MAX 10
-int cic_9_tables[][10] = {
-	{0,},
-	{9, -156,  -97, 2798, -15489, 61019, -15489, 2798,  -97, -156},
-	{9, -128, -568, 5593, -24125, 74126, -24125, 5593, -568, -128},
-	{9, -129, -639, 6187, -26281, 77511, -26281, 6187, -639, -129},
-	{9, -122, -612, 6082, -26353, 77818, -26353, 6082, -612, -122},
-	{9, -120, -602, 6015, -26269, 77757, -26269, 6015, -602, -120},
-	{9, -120, -582, 5951, -26128, 77542, -26128, 5951, -582, -120},
-	{9, -119, -580, 5931, -26094, 77505, -26094, 5931, -580, -119},
-	{9, -119, -578, 5921, -26077, 77484, -26077, 5921, -578, -119},
-	{9, -119, -577, 5917, -26067, 77473, -26067, 5917, -577, -119},
-	{9, -199, -362, 5303, -25505, 77489, -25505, 5303, -362, -199},
-};
+static int block_queue_init(struct block_queue *q, const char *name, int blocking)
+{
+	memset(q, 0, sizeof(*q));
+	q->name = name;
+	q->blocking = blocking;
+	q->sample_size = sizeof(int16_t);
+	pthread_mutex_init(&q->m, NULL);
+	pthread_cond_init(&q->not_empty, NULL);
+	pthread_cond_init(&q->not_full, NULL);
+	return 0;
+}
+
+/* before block_queue_alloc() */
+static void block_queue_set_sample_size(struct block_queue *q, int sample_size)
+{
+	q->sample_size = sample_size;
+}
+
+/* once the block length is known, before any thread uses the queue */
+static int block_queue_alloc(struct block_queue *q, int capacity)
+{
+	int i;
+	for (i = 0; i < BLOCK_QUEUE_LEN; i++) {
+		q->blocks[i].buf = malloc((size_t)capacity * q->sample_size);
+		if (!q->blocks[i].buf)
+			return -1;
+	}
+	q->capacity = capacity;
+	return 0;
+}
+
+static void block_queue_cleanup(struct block_queue *q)
+{
+	int i;
+	for (i = 0; i < BLOCK_QUEUE_LEN; i++) {
+		free(q->blocks[i].buf);
+		q->blocks[i].buf = NULL;
+	}
+	pthread_mutex_destroy(&q->m);
+	pthread_cond_destroy(&q->not_empty);
+	pthread_cond_destroy(&q->not_full);
+}
+
+/* producer: returns the next free block or NULL, when the block has to be dropped */
+static struct queue_block *block_queue_write_slot(struct block_queue *q)
+{
+	unsigned fill = q->head - q->tail;
+	if (fill >= BLOCK_QUEUE_LEN) {
+		if (!q->blocking) {
+			++q->overruns;
+			/* report 1st, 2nd, 4th, 8th, .. overrun */
+			if (verbosity && !(q->overruns & (q->overruns - 1)))
+				fprintf(stderr, "%s queue overrun: %u blocks dropped\n", q->name, q->overruns);
+			return NULL;
+		}
+		pthread_mutex_lock(&q->m);
+		q->producer_waits = 1;
+		QUEUE_BARRIER();
+		while (q->head - q->tail >= BLOCK_QUEUE_LEN && !do_exit)
+			pthread_cond_wait(&q->not_full, &q->m);
+		q->producer_waits = 0;
+		pthread_mutex_unlock(&q->m);
+		if (do_exit)
+			return NULL;
+	}
+	QUEUE_BARRIER();
+	return &q->blocks[q->head % BLOCK_QUEUE_LEN];
+}
+
+/* producer: publish the block from block_queue_write_slot() */
+static void block_queue_push(struct block_queue *q, int len, unsigned gen)
+{
+	struct queue_block *b = &q->blocks[q->head % BLOCK_QUEUE_LEN];
+	unsigned fill;
+	b->len = len;
+	b->gen = gen;
+	QUEUE_BARRIER();
+	q->head++;
+	QUEUE_BARRIER();
+	fill = q->head - q->tail;
+	if (fill > q->max_fill)
+		q->max_fill = fill;
+	++q->pushed;
+	if (q->consumer_waits)
+		safe_cond_signal(&q->not_empty, &q->m);
+}
+
+/* consumer: returns the oldest block, waits while empty. NULL on exit or when closed and empty */
+static struct queue_block *block_queue_read_slot(struct block_queue *q)
+{
+	if (q->head == q->tail) {
+		pthread_mutex_lock(&q->m);
+		q->consumer_waits = 1;
+		QUEUE_BARRIER();
+		while (q->head == q->tail && !do_exit && !q->closed)
+			pthread_cond_wait(&q->not_empty, &q->m);
+		q->consumer_waits = 0;
+		pthread_mutex_unlock(&q->m);
+		if (q->head == q->tail)
+			return NULL;
+	}
+	QUEUE_BARRIER();
+	return &q->blocks[q->tail % BLOCK_QUEUE_LEN];
+}
+
+/* consumer: release the block from block_queue_read_slot() */
+static void block_queue_pop(struct block_queue *q)
+{
+	QUEUE_BARRIER();
+	q->tail++;
+	QUEUE_BARRIER();
+	if (q->producer_waits)
+		safe_cond_signal(&q->not_full, &q->m);
+}
+
+/* wake up both sides, e.g. to notice do_exit */
+static void block_queue_wake(struct block_queue *q)
+{
+	pthread_mutex_lock(&q->m);
+	pthread_cond_broadcast(&q->not_empty);
+	pthread_cond_broadcast(&q->not_full);
+	pthread_mutex_unlock(&q->m);
+}
+
+/* producer: no more blocks will follow */
+static void block_queue_close(struct block_queue *q)
+{
+	pthread_mutex_lock(&q->m);
+	q->closed = 1;
+	pthread_cond_broadcast(&q->not_empty);
+	pthread_mutex_unlock(&q->m);
+}
+
+static void block_queue_report(struct block_queue *q)
+{
+	if (verbosity || q->overruns)
+		fprintf(stderr, "%s queue: %u blocks passed, %u dropped, max fill %u of %d\n",
+			q->name, q->pushed, q->overruns, q->max_fill, BLOCK_QUEUE_LEN);
+}
 
 #if defined(_MSC_VER) && (_MSC_VER < 1800)
 double log2(double n)
@@ -477,6 +841,42 @@ void rotate_neg90(unsigned char *buf, uint32_t len)
 	}
 }
 
+static void squelch_setup(struct squelch_state *q, int open_level, int rate)
+{
+	q->open_pow = (float)open_level * open_level;
+	q->close_pow = (float)q->close_level * q->close_level;
+	/* envelope reaches 63% of a step after the attack/release time */
+	q->attack = (float)(1.0 - exp(-1000.0 / (q->attack_ms * rate + 1E-3)));
+	q->release = (float)(1.0 - exp(-1000.0 / (q->release_ms * rate + 1E-3)));
+	q->env = 0.0f;
+	q->open = 0;
+	q->open_pairs = 0;
+	q->pow_sum = 0.0;
+}
+
+/* track one decimated I/Q pair, returns 1 if the squelch is open */
+static inline int squelch_pair(struct squelch_state *q, int i, int j)
+{
+	float p = 0.5f * ((float)i * i + (float)j * j);
+	q->env += (p - q->env) * ((p > q->env) ? q->attack : q->release);
+	q->pow_sum += p;
+	if (q->open ? (q->env < q->close_pow) : (q->env >= q->open_pow))
+		q->open = !q->open;
+	q->open_pairs += q->open;
+	return q->open;
+}
+
+static void squelch_gate(struct squelch_state *q, int16_t *iq, int len)
+{
+	int i;
+	for (i = 0; i < len; i += 2) {
+		if (!squelch_pair(q, iq[i], iq[i+1])) {
+			iq[i] = 0;
+			iq[i+1] = 0;
+		}
+	}
+}
+
 void low_pass(struct demod_state *d)
 /* simple square window FIR */
 {
@@ -491,6 +891,10 @@ void low_pass(struct demod_state *d)
 		}
 		d->lowpassed[i2]   = d->now_r; /* * d->output_scale; */
 		d->lowpassed[i2+1] = d->now_j; /* * d->output_scale; */
+		if (d->sq.enabled && !squelch_pair(&d->sq, d->lowpassed[i2], d->lowpassed[i2+1])) {
+			d->lowpassed[i2] = 0;
+			d->lowpassed[i2+1] = 0;
+		}
 		d->prev_index = 0;
 		d->now_r = 0;
 		d->now_j = 0;
@@ -512,7 +916,6 @@ static char * trim(char * s) {
 
 static void cmd_init(struct cmd_state *c)
 {
-	int k;
 	c->filename = NULL;
 	c->file = NULL;
 	c->lineNo = 1;
@@ -523,30 +926,78 @@ static void cmd_init(struct cmd_state *c)
 	c->prevBandwidth = -1;
 	c->freq = 0;
 	c->gain = 0;
-	c->trigCrit = crit_IN;
-	c->refLevel = 0.0;
-	c->refLevelTol = 0.0;
-	c->numMeas = 0;
-	c->numBlockTrigger = 0;
-	c->command = NULL;
-	c->args = NULL;
-	c->levelSum = 0.0;
-	c->numSummed = 0;
+	memset(&c->cur, 0, sizeof(c->cur));
+	c->cur.trigCrit = crit_IN;
 	c->omitFirstFreqLevels = 3;
-	for (k = 0; k < FREQUENCIES_LIMIT; k++) {
-		c->waitTrigger[k] = 0;
-		c->statNumLevels[k] = 0;
-		c->statFreq[k] = 0;
-		c->statSumLevels[k] = 0.0;
-		c->statMinLevel[k] = 0.0F;
-		c->statMaxLevel[k] = 0.0F;
-	}
+	c->stats = NULL;
+	c->numStats = 0;
+	c->grouped = 0;
+	c->lines = NULL;
+	c->numLines = 0;
+	c->groupFirst = NULL;
+	c->groupFreq = NULL;
+	c->numGroups = 0;
+	c->group = -1;
+	c->groupSpan = 0.0;
+	memset(&c->cp, 0, sizeof(c->cp));
+	c->triggerSink = NULL;
+	memset(&c->trig, 0, sizeof(c->trig));
 }
 
-static int toNextCmdLine(struct cmd_state *c)
+static void cmd_free_lines(struct cmd_state *c)
+{
+	int k;
+	for (k = 0; k < c->numLines; k++) {
+		free(c->lines[k].command);
+		free(c->lines[k].args);
+	}
+	free(c->lines);
+	free(c->groupFirst);
+	free(c->groupFreq);
+	c->lines = NULL;
+	c->groupFirst = NULL;
+	c->groupFreq = NULL;
+	c->numLines = c->numGroups = 0;
+}
+
+static void cmd_cleanup(struct cmd_state *c)
+{
+	cmd_free_lines(c);
+	chan_power_free(&c->cp);
+	free(c->stats);
+	c->stats = NULL;
+	c->numStats = 0;
+	if (c->file)
+		fclose(c->file);
+	c->file = NULL;
+}
+
+/* statistics of a line number, NULL if out of memory */
+static struct cmd_stat * cmd_stat(struct cmd_state *c, int lineNo)
+{
+	struct cmd_stat *st;
+	int n;
+	if (lineNo < 0)
+		return NULL;
+	if (lineNo >= c->numStats) {
+		n = c->numStats ? c->numStats : 64;
+		while (n <= lineNo)
+			n *= 2;
+		st = realloc(c->stats, n * sizeof(struct cmd_stat));
+		if (!st)
+			return NULL;
+		memset(st + c->numStats, 0, (n - c->numStats) * sizeof(struct cmd_stat));
+		c->stats = st;
+		c->numStats = n;
+	}
+	return &c->stats[lineNo];
+}
+
+/* parse a trimmed line into l. returns 1 for a valid line,
+ * 0 for keywords and errors */
+static int parseCmdLine(struct cmd_state *c, char * pLine, struct cmd_line *l)
 {
 	const char * delim = ",";
-	char * pLine = NULL;
 	char * pCmdFreq = NULL;
 	char * pCmdGain = NULL;
 	char * pCmdTrigCrit = NULL;
@@ -554,6 +1005,87 @@ static int toNextCmdLine(struct cmd_state *c)
 	char * pCmdTol = NULL;
 	char * pCmdNumMeas = NULL;
 	char * pCmdNumBlockTrigger = NULL;
+
+	pCmdFreq = strtok(pLine, delim);
+	if (!pCmdFreq) { fprintf(stderr, "error parsing frequency in line %d of command file!\n", c->lineNo); return 0; }
+	pCmdFreq = trim(pCmdFreq);
+	/* check keywords */
+	if (!strcmp(pCmdFreq, "adc") || !strcmp(pCmdFreq, "adcmax")) {
+		c->checkADCmax = 1;
+		return 0;
+	}
+	else if (!strcmp(pCmdFreq, "adcrms")) {
+		c->checkADCrms = 1;
+		return 0;
+	}
+	l->freq = (uint64_t)atofs(pCmdFreq);
+
+	pCmdGain = strtok(NULL, delim);
+	if (!pCmdGain) { fprintf(stderr, "error parsing gain in line %d of command file!\n", c->lineNo); return 0; }
+	pCmdGain = trim(pCmdGain);
+	if (!strcmp(pCmdGain,"auto") || !strcmp(pCmdGain,"a"))
+		l->gain = AUTO_GAIN;
+	else
+		l->gain = (int)(atof(pCmdGain) * 10);
+
+	pCmdTrigCrit = strtok(NULL, delim);
+	if (!pCmdTrigCrit) { fprintf(stderr, "error parsing expr in line %d of command file!\n", c->lineNo); return 0; }
+	pCmdTrigCrit = trim(pCmdTrigCrit);
+	if (!strcmp(pCmdTrigCrit,"in"))			l->trigCrit = crit_IN;
+	else if (!strcmp(pCmdTrigCrit,"=="))	l->trigCrit = crit_IN;
+	else if (!strcmp(pCmdTrigCrit,"out"))	l->trigCrit = crit_OUT;
+	else if (!strcmp(pCmdTrigCrit,"!="))	l->trigCrit = crit_OUT;
+	else if (!strcmp(pCmdTrigCrit,"<>"))	l->trigCrit = crit_OUT;
+	else if (!strcmp(pCmdTrigCrit,"lt"))	l->trigCrit = crit_LT;
+	else if (!strcmp(pCmdTrigCrit,"<"))		l->trigCrit = crit_LT;
+	else if (!strcmp(pCmdTrigCrit,"gt"))	l->trigCrit = crit_GT;
+	else if (!strcmp(pCmdTrigCrit,">"))		l->trigCrit = crit_GT;
+	else { fprintf(stderr, "error parsing expr in line %d of command file!\n", c->lineNo); return 0; }
+
+	pCmdLevel = strtok(NULL, delim);
+	if (!pCmdLevel) { fprintf(stderr, "error parsing level in line %d of command file!\n", c->lineNo); return 0; }
+	l->refLevel = atof(trim(pCmdLevel));
+
+	pCmdTol = strtok(NULL, delim);
+	if (!pCmdTol) { fprintf(stderr, "error parsing tolerance in line %d of command file!\n", c->lineNo); return 0; }
+	l->refLevelTol = atof(trim(pCmdTol));
+
+	pCmdNumMeas = strtok(NULL, delim);
+	if (!pCmdNumMeas) { fprintf(stderr, "error parsing #measurements in line %d of command file!\n", c->lineNo); return 0; }
+	l->numMeas = atoi(trim(pCmdNumMeas));
+	if (l->numMeas <= 0) { fprintf(stderr, "warning: fixed #measurements from %d to 10 in line %d of command file!\n", l->numMeas, c->lineNo); l->numMeas=10; }
+
+	pCmdNumBlockTrigger = strtok(NULL, delim);
+	if (!pCmdNumBlockTrigger) { fprintf(stderr, "error parsing #blockTrigger in line %d of command file!\n", c->lineNo); return 0; }
+	l->numBlockTrigger = atoi(trim(pCmdNumBlockTrigger));
+
+	l->command = strtok(NULL, delim);
+	/* no check: allow empty string. just trim it */
+	if (l->command)
+		l->command = trim(l->command);
+
+	l->args = strtok(NULL, delim);
+	/* no check: allow empty string. just trim it */
+	if (l->args)
+		l->args = trim(l->args);
+
+	l->lineNo = c->lineNo;
+	l->levelSum = 0.0;
+	l->levelPeak = 0.0;
+	l->numSummed = 0;
+	l->offset = 0;
+
+	if (verbosity >= 2)
+		fprintf(stderr, "read from cmd file: freq %.3f kHz, gain %0.1f dB, level %s {%.1f +/- %.1f}, cmd '%s %s'\n",
+			l->freq /1000.0, l->gain /10.0, 
+			aCritStr[l->trigCrit], l->refLevel, l->refLevelTol,
+			(l->command ? l->command : "%"), (l->args ? l->args : "") );
+	return 1;
+}
+
+static int toNextCmdLine(struct cmd_state *c)
+{
+	char * pLine = NULL;
 	int numValidLines = 1;  /* assume valid lines */
 	while (1) {
 		if (c->file && feof(c->file)) {
@@ -579,141 +1111,185 @@ static int toNextCmdLine(struct cmd_state *c)
 		pLine = trim(c->acLine);
 		if (pLine[0]=='#' || pLine[0]==0)
 			continue;  /* detect comment lines and empty lines */
+		if (!parseCmdLine(c, pLine, &c->cur))
+			continue;
+		c->freq = c->cur.freq;
+		c->gain = c->cur.gain;
+
+		numValidLines++;
+		return 1;
+	}
+
+	return 0;
+}
 
-		pCmdFreq = strtok(pLine, delim);
-		if (!pCmdFreq) { fprintf(stderr, "error parsing frequency in line %d of command file!\n", c->lineNo); continue; }
-		pCmdFreq = trim(pCmdFreq);
-		/* check keywords */
-		if (!strcmp(pCmdFreq, "adc") || !strcmp(pCmdFreq, "adcmax")) {
-			c->checkADCmax = 1;
+static int cmp_cmd_line(const void *a, const void *b)
+{
+	const struct cmd_line *la = a, *lb = b;
+	if (la->gain != lb->gain)
+		return (la->gain > lb->gain) - (la->gain < lb->gain);
+	return (la->freq > lb->freq) - (la->freq < lb->freq);
+}
+
+/* -E cgroup: read the whole command file and group its lines into captures:
+ * same gain, frequencies within groupSpan. returns number of lines */
+static int cmd_load(struct cmd_state *c)
+{
+	struct cmd_line l, *lines;
+	char * pLine;
+	int cap = 0, g, k;
+	uint64_t lo;
+	cmd_free_lines(c);
+	c->file = fopen(c->filename, "r");
+	if (!c->file) {
+		fprintf(stderr, "error: can't open command file '%s'!\n", c->filename);
+		return 0;
+	}
+	c->lineNo = 0;
+	while (fgets(c->acLine, 4096, c->file)) {
+		c->lineNo++;
+		pLine = trim(c->acLine);
+		if (pLine[0]=='#' || pLine[0]==0)
 			continue;
-		}
-		else if (!strcmp(pCmdFreq, "adcrms")) {
-			c->checkADCrms = 1;
+		if (!parseCmdLine(c, pLine, &l))
 			continue;
+		/* command and args point into acLine */
+		l.command = (l.command && l.command[0]) ? strdup(l.command) : NULL;
+		l.args = l.args ? strdup(l.args) : NULL;
+		if (c->numLines >= cap) {
+			cap = cap ? 2 * cap : 64;
+			lines = realloc(c->lines, cap * sizeof(struct cmd_line));
+			if (!lines) {
+				fprintf(stderr, "error: out of memory for command file!\n");
+				free(l.command);
+				free(l.args);
+				break;
+			}
+			c->lines = lines;
 		}
-		c->freq = (uint64_t)atofs(pCmdFreq);
-
-		pCmdGain = strtok(NULL, delim);
-		if (!pCmdGain) { fprintf(stderr, "error parsing gain in line %d of command file!\n", c->lineNo); continue; }
-		pCmdGain = trim(pCmdGain);
-		if (!strcmp(pCmdGain,"auto") || !strcmp(pCmdGain,"a"))
-			c->gain = AUTO_GAIN;
-		else
-			c->gain = (int)(atof(pCmdGain) * 10);
-
-		pCmdTrigCrit = strtok(NULL, delim);
-		if (!pCmdTrigCrit) { fprintf(stderr, "error parsing expr in line %d of command file!\n", c->lineNo); continue; }
-		pCmdTrigCrit = trim(pCmdTrigCrit);
-		if (!strcmp(pCmdTrigCrit,"in"))			c->trigCrit = crit_IN;
-		else if (!strcmp(pCmdTrigCrit,"=="))	c->trigCrit = crit_IN;
-		else if (!strcmp(pCmdTrigCrit,"out"))	c->trigCrit = crit_OUT;
-		else if (!strcmp(pCmdTrigCrit,"!="))	c->trigCrit = crit_OUT;
-		else if (!strcmp(pCmdTrigCrit,"<>"))	c->trigCrit = crit_OUT;
-		else if (!strcmp(pCmdTrigCrit,"lt"))	c->trigCrit = crit_LT;
-		else if (!strcmp(pCmdTrigCrit,"<"))		c->trigCrit = crit_LT;
-		else if (!strcmp(pCmdTrigCrit,"gt"))	c->trigCrit = crit_GT;
-		else if (!strcmp(pCmdTrigCrit,">"))		c->trigCrit = crit_GT;
-		else { fprintf(stderr, "error parsing expr in line %d of command file!\n", c->lineNo); continue; }
-
-		pCmdLevel = strtok(NULL, delim);
-		if (!pCmdLevel) { fprintf(stderr, "error parsing level in line %d of command file!\n", c->lineNo); continue; }
-		c->refLevel = atof(trim(pCmdLevel));
-
-		pCmdTol = strtok(NULL, delim);
-		if (!pCmdTol) { fprintf(stderr, "error parsing tolerance in line %d of command file!\n", c->lineNo); continue; }
-		c->refLevelTol = atof(trim(pCmdTol));
-
-		pCmdNumMeas = strtok(NULL, delim);
-		if (!pCmdNumMeas) { fprintf(stderr, "error parsing #measurements in line %d of command file!\n", c->lineNo); continue; }
-		c->numMeas = atoi(trim(pCmdNumMeas));
-		if (c->numMeas <= 0) { fprintf(stderr, "warning: fixed #measurements from %d to 10 in line %d of command file!\n", c->numMeas, c->lineNo); c->numMeas=10; }
-
-		pCmdNumBlockTrigger = strtok(NULL, delim);
-		if (!pCmdNumBlockTrigger) { fprintf(stderr, "error parsing #blockTrigger in line %d of command file!\n", c->lineNo); continue; }
-		c->numBlockTrigger = atoi(trim(pCmdNumBlockTrigger));
-
-		c->command = strtok(NULL, delim);
-		/* no check: allow empty string. just trim it */
-		if (c->command)
-			c->command = trim(c->command);
-
-		c->args = strtok(NULL, delim);
-		/* no check: allow empty string. just trim it */
-		if (c->args)
-			c->args = trim(c->args);
+		c->lines[c->numLines++] = l;
+	}
+	fclose(c->file);
+	c->file = NULL;
+	if (!c->numLines) {
+		fprintf(stderr, "error: command file '%s' does not contain any valid lines!\n", c->filename);
+		return 0;
+	}
+	qsort(c->lines, c->numLines, sizeof(struct cmd_line), cmp_cmd_line);
 
-		if (verbosity >= 2)
-			fprintf(stderr, "read from cmd file: freq %.3f kHz, gain %0.1f dB, level %s {%.1f +/- %.1f}, cmd '%s %s'\n",
-				c->freq /1000.0, c->gain /10.0, 
-				aCritStr[c->trigCrit], c->refLevel, c->refLevelTol,
-				(c->command ? c->command : "%"), (c->args ? c->args : "") );
+	c->groupFirst = malloc((c->numLines + 1) * sizeof(int));
+	c->groupFreq = malloc(c->numLines * sizeof(uint64_t));
+	if (!c->groupFirst || !c->groupFreq) {
+		fprintf(stderr, "error: out of memory for command file!\n");
+		cmd_free_lines(c);
+		return 0;
+	}
+	g = 0;
+	c->groupFirst[0] = 0;
+	lo = c->lines[0].freq;
+	for (k = 1; k <= c->numLines; k++) {
+		if (k < c->numLines && c->lines[k].gain == c->lines[k-1].gain
+		 && (double)(c->lines[k].freq - lo) <= c->groupSpan)
+			continue;
+		c->groupFreq[g] = lo + (c->lines[k-1].freq - lo) / 2;
+		c->groupFirst[++g] = k;
+		if (k < c->numLines)
+			lo = c->lines[k].freq;
+	}
+	c->numGroups = g;
+	for (g = 0; g < c->numGroups; g++) {
+		for (k = c->groupFirst[g]; k < c->groupFirst[g+1]; k++) {
+			c->lines[k].offset = (int32_t)(c->lines[k].freq - c->groupFreq[g]);}
+	}
+	if (verbosity >= 2)
+		fprintf(stderr, "command file: %d lines in %d captures\n", c->numLines, c->numGroups);
+	return c->numLines;
+}
 
-		numValidLines++;
-		return 1;
+/* -E cgroup: switch to the next capture, rereading the file after the last one */
+static int toNextCmdGroup(struct cmd_state *c)
+{
+	int k;
+	c->group++;
+	if (c->group >= c->numGroups) {
+		if (!cmd_load(c))
+			return 0;
+		c->group = 0;
+	}
+	c->freq = c->groupFreq[c->group];
+	c->gain = c->lines[c->groupFirst[c->group]].gain;
+	for (k = c->groupFirst[c->group]; k < c->groupFirst[c->group+1]; k++) {
+		c->lines[k].levelSum = 0.0;
+		c->lines[k].levelPeak = 0.0;
+		c->lines[k].numSummed = 0;
 	}
+	return 1;
+}
 
-	return 0;
+static int cmd_next(struct cmd_state *c)
+{
+	return c->grouped ? toNextCmdGroup(c) : toNextCmdLine(c);
+}
+
+/* all lines of the current line or group have their #meas levels */
+static int cmd_measured(struct cmd_state *c)
+{
+	int k;
+	if (!c->grouped)
+		return c->cur.numSummed >= c->cur.numMeas;
+	if (c->group < 0 || c->group >= c->numGroups)
+		return 0;
+	for (k = c->groupFirst[c->group]; k < c->groupFirst[c->group+1]; k++) {
+		if (c->lines[k].numSummed < c->lines[k].numMeas)
+			return 0;
+	}
+	return 1;
 }
 
-static int testTrigCrit(struct cmd_state *c, double level)
+static int testTrigCrit(struct cmd_line *l, double level)
 {
-	switch(c->trigCrit)
+	switch(l->trigCrit)
 	{
-	case crit_IN:	return ( c->refLevel-c->refLevelTol <= level && level <= c->refLevel+c->refLevelTol );
-	case crit_OUT:	return ( c->refLevel-c->refLevelTol > level || level > c->refLevel+c->refLevelTol );
-	case crit_LT:	return ( level < c->refLevel-c->refLevelTol );
-	case crit_GT:	return ( level > c->refLevel+c->refLevelTol );
+	case crit_IN:	return ( l->refLevel-l->refLevelTol <= level && level <= l->refLevel+l->refLevelTol );
+	case crit_OUT:	return ( l->refLevel-l->refLevelTol > level || level > l->refLevel+l->refLevelTol );
+	case crit_LT:	return ( level < l->refLevel-l->refLevelTol );
+	case crit_GT:	return ( level > l->refLevel+l->refLevelTol );
 	}
 	return 0;
 }
 
-static void checkTriggerCommand(struct cmd_state *c, unsigned char adcSampleMax, double powerSum, int powerCount )
+static void checkTriggerCommand(struct cmd_state *c, struct cmd_line *l, unsigned char adcSampleMax, double powerSum, int powerCount )
 {
-	char acRepFreq[32], acRepGain[32], acRepMLevel[32], acRepRefLevel[32], acRepRefTolerance[32];
-	char * execSearchStrings[7] = { "!freq!", "!gain!", "!mlevel!", "!crit!", "!reflevel!", "!reftol!", NULL };
-	char * execReplaceStrings[7] = { acRepFreq, acRepGain, acRepMLevel, NULL, acRepRefLevel, acRepRefTolerance, NULL };
+	struct trigger_event ev;
+	struct meas_record rec;
 	double triggerLevel;
 	double adcRms = 0.0;
-	int k, triggerCommand = 0;
+	int triggerCommand = 0;
 	int adcMax = (int)adcSampleMax - 127;
 	char adcText[128];
+	struct cmd_stat *st = cmd_stat(c, l->lineNo);
 
-	if (c->numSummed != c->numMeas)
+	if (l->numSummed != l->numMeas)
 		return;
 
-	if (c->omitFirstFreqLevels) {
-		/* workaround: measured levels of first controlled frequency looks wrong! */
-		c->omitFirstFreqLevels--;
-		return;
-	}
-
-	/* decrease all counters */
-	for ( k = 0; k < FREQUENCIES_LIMIT; k++ ) {
-		if ( c->waitTrigger[k] > 0 ) {
-			c->waitTrigger[k] -= c->numMeas;
-			if ( c->waitTrigger[k] < 0 )
-				c->waitTrigger[k] = 0;
-		}
-	}
-	triggerLevel = 20.0 * log10( 1E-10 + c->levelSum / c->numSummed );
-	triggerCommand = testTrigCrit(c, triggerLevel);
+	triggerLevel = 20.0 * log10( 1E-10 + l->levelSum / l->numSummed );
+	triggerCommand = testTrigCrit(l, triggerLevel);
 
 	/* update statistics */
-	if ( c->lineNo < FREQUENCIES_LIMIT ) {
-		if ( c->statNumLevels[c->lineNo] == 0 ) {
-			++c->statNumLevels[c->lineNo];
-			c->statFreq[c->lineNo] = c->freq;
-			c->statSumLevels[c->lineNo] = triggerLevel;
-			c->statMinLevel[c->lineNo] = (float)triggerLevel;
-			c->statMaxLevel[c->lineNo] = (float)triggerLevel;
-		} else if ( c->statFreq[c->lineNo] == c->freq ) {
-			++c->statNumLevels[c->lineNo];
-			c->statSumLevels[c->lineNo] += triggerLevel;
-			if ( c->statMinLevel[c->lineNo] > (float)triggerLevel )
-				c->statMinLevel[c->lineNo] = (float)triggerLevel;
-			if ( c->statMaxLevel[c->lineNo] < (float)triggerLevel )
-				c->statMaxLevel[c->lineNo] = (float)triggerLevel;
+	if ( st ) {
+		if ( st->numLevels == 0 ) {
+			++st->numLevels;
+			st->freq = l->freq;
+			st->sumLevels = triggerLevel;
+			st->minLevel = (float)triggerLevel;
+			st->maxLevel = (float)triggerLevel;
+		} else if ( st->freq == l->freq ) {
+			++st->numLevels;
+			st->sumLevels += triggerLevel;
+			if ( st->minLevel > (float)triggerLevel )
+				st->minLevel = (float)triggerLevel;
+			if ( st->maxLevel < (float)triggerLevel )
+				st->maxLevel = (float)triggerLevel;
 		}
 	}
 
@@ -729,29 +1305,84 @@ static void checkTriggerCommand(struct cmd_state *c, unsigned char adcSampleMax,
 		sprintf(adcText, "adc rms %5.1f ", adcRms );
 	}
 
-	if ( c->lineNo < FREQUENCIES_LIMIT && c->waitTrigger[c->lineNo] <= 0 ) {
-			c->waitTrigger[c->lineNo] = triggerCommand ? c->numBlockTrigger : 0;
+	if (meas.fd >= 0) {
+		rec.ts = meas_time();
+		rec.freq = l->freq;
+		rec.rms = (float)triggerLevel;
+		rec.peak = meas_db(l->levelPeak);
+		rec.adc_max = c->checkADCmax ? (float)adcMax : -1.0f;
+		rec.adc_rms = (c->checkADCrms && powerCount > 0) ? (float)sqrt( powerSum / powerCount ) : -1.0f;
+		rec.trigger = !triggerCommand ? MEAS_TRIG_OFF : (st && st->waitTrigger <= 0) ? MEAS_TRIG_ON : MEAS_TRIG_HOLD;
+		rec.line = l->lineNo;
+		meas_stream_add(&meas, &rec);
+	}
+
+	if ( st && st->waitTrigger <= 0 ) {
+			st->waitTrigger = triggerCommand ? l->numBlockTrigger : 0;
 			if (verbosity)
 				fprintf(stderr, "%.3f kHz: gain %4.1f + level %4.1f dB %s=> %s\n",
-					(double)c->freq /1000.0, 0.1*c->gain, triggerLevel, adcText,
+					(double)l->freq /1000.0, 0.1*c->gain, triggerLevel, adcText,
 					(triggerCommand ? "activates trigger" : "does not trigger") );
-			if (triggerCommand && c->command && c->command[0]) {
-				fprintf(stderr, "command to trigger is '%s %s'\n", c->command, c->args);
-				/* prepare search/replace of special parameters for command arguments */
-				snprintf(acRepFreq, 32, "%.0f", (double)c->freq);
-				snprintf(acRepGain, 32, "%d", c->gain);
-				snprintf(acRepMLevel, 32, "%d", (int)(0.5 + triggerLevel*10.0) );
-				execReplaceStrings[3] = aCritStr[c->trigCrit];
-				snprintf(acRepRefLevel, 32, "%d", (int)(0.5 + c->refLevel*10.0) );
-				snprintf(acRepRefTolerance, 32, "%d", (int)(0.5 + c->refLevelTol*10.0) );
-				executeInBackground( c->command, c->args, execSearchStrings, execReplaceStrings );
+			if (triggerCommand && ((l->command && l->command[0]) || c->triggerSink)) {
+				if (l->command && l->command[0])
+					fprintf(stderr, "command to trigger is '%s %s'\n", l->command, l->args);
+				/* no fork from here: the dispatcher passes it on */
+				memset(&ev, 0, sizeof(ev));
+				ev.freq = l->freq;
+				ev.gain = c->gain;
+				ev.lineNo = l->lineNo;
+				ev.level = triggerLevel;
+				ev.refLevel = l->refLevel;
+				ev.refLevelTol = l->refLevelTol;
+				strncpy(ev.crit, aCritStr[l->trigCrit], sizeof(ev.crit) - 1);
+				if (l->command)
+					strncpy(ev.command, l->command, sizeof(ev.command) - 1);
+				if (l->args)
+					strncpy(ev.args, l->args, sizeof(ev.args) - 1);
+				if (trigger_dispatch_post(&c->trig, &ev) < 0)
+					fprintf(stderr, "warning: trigger queue full, dropped trigger for %.3f kHz\n", (double)l->freq /1000.0);
 			}
 	} else if (verbosity) {
 		fprintf(stderr, "%.3f kHz: gain %4.1f + level %4.1f dB %s=> %s, blocks for %d\n",
-			(double)c->freq /1000.0, 0.1*c->gain, triggerLevel, adcText, (triggerCommand ? "would trigger" : "does not trigger"),
-			(c->lineNo < FREQUENCIES_LIMIT ? c->waitTrigger[c->lineNo] : -1 ) );
+			(double)l->freq /1000.0, 0.1*c->gain, triggerLevel, adcText, (triggerCommand ? "would trigger" : "does not trigger"),
+			(st ? st->waitTrigger : -1 ) );
+	}
+	l->numSummed++;
+}
+
+/* evaluate the measured line or group */
+static void checkTriggerCommands(struct cmd_state *c, unsigned char adcSampleMax, double powerSum, int powerCount )
+{
+	int k, numMeas;
+	if (c->omitFirstFreqLevels) {
+		/* workaround: measured levels of first controlled frequency looks wrong! */
+		c->omitFirstFreqLevels--;
+		return;
+	}
+
+	/* decrease all counters by the measured blocks */
+	numMeas = c->cur.numMeas;
+	if (c->grouped) {
+		numMeas = 0;
+		for (k = c->groupFirst[c->group]; k < c->groupFirst[c->group+1]; k++) {
+			if (c->lines[k].numMeas > numMeas)
+				numMeas = c->lines[k].numMeas;
+		}
+	}
+	for ( k = 0; k < c->numStats; k++ ) {
+		if ( c->stats[k].waitTrigger > 0 ) {
+			c->stats[k].waitTrigger -= numMeas;
+			if ( c->stats[k].waitTrigger < 0 )
+				c->stats[k].waitTrigger = 0;
+		}
 	}
-	c->numSummed++;
+
+	if (!c->grouped) {
+		checkTriggerCommand(c, &c->cur, adcSampleMax, powerSum, powerCount);
+		return;
+	}
+	for (k = c->groupFirst[c->group]; k < c->groupFirst[c->group+1]; k++) {
+		checkTriggerCommand(c, &c->lines[k], adcSampleMax, powerSum, powerCount);}
 }
 
 
@@ -771,232 +1402,11 @@ int low_pass_simple(int16_t *signal2, int len, int step)
 	return len / step;
 }
 
-void low_pass_real(struct demod_state *s)
-/* simple square window FIR */
-/* add support for upsampling? */
-{
-	int i=0, i2=0;
-	int fast = (int)s->rate_out;
-	int slow = s->rate_out2;
-	while (i < s->result_len) {
-		s->now_lpr += s->result[i];
-		i++;
-		s->prev_lpr_index += slow;
-		if (s->prev_lpr_index < fast) {
-			continue;
-		}
-		s->result[i2] = (int16_t)(s->now_lpr / (fast/slow));
-		s->prev_lpr_index -= fast;
-		s->now_lpr = 0;
-		i2 += 1;
-	}
-	s->result_len = i2;
-}
-
-void fifth_order(int16_t *data, int length, int16_t *hist)
-/* for half of interleaved data */
-{
-	int i;
-	int16_t a, b, c, d, e, f;
-	a = hist[1];
-	b = hist[2];
-	c = hist[3];
-	d = hist[4];
-	e = hist[5];
-	f = data[0];
-	/* a downsample should improve resolution, so don't fully shift */
-	data[0] = (a + (b+e)*5 + (c+d)*10 + f) >> 4;
-	for (i=4; i<length; i+=4) {
-		a = c;
-		b = d;
-		c = e;
-		d = f;
-		e = data[i-2];
-		f = data[i];
-		data[i/2] = (a + (b+e)*5 + (c+d)*10 + f) >> 4;
-	}
-	/* archive */
-	hist[0] = a;
-	hist[1] = b;
-	hist[2] = c;
-	hist[3] = d;
-	hist[4] = e;
-	hist[5] = f;
-}
-
-void generic_fir(int16_t *data, int length, int *fir, int16_t *hist)
-/* Okay, not at all generic.  Assumes length 9, fix that eventually. */
-{
-	int d, temp, sum;
-	for (d=0; d<length; d+=2) {
-		temp = data[d];
-		sum = 0;
-		sum += (hist[0] + hist[8]) * fir[1];
-		sum += (hist[1] + hist[7]) * fir[2];
-		sum += (hist[2] + hist[6]) * fir[3];
-		sum += (hist[3] + hist[5]) * fir[4];
-		sum +=			hist[4]  * fir[5];
-		data[d] = sum >> 15 ;
-		hist[0] = hist[1];
-		hist[1] = hist[2];
-		hist[2] = hist[3];
-		hist[3] = hist[4];
-		hist[4] = hist[5];
-		hist[5] = hist[6];
-		hist[6] = hist[7];
-		hist[7] = hist[8];
-		hist[8] = temp;
-	}
-}
-
-/* define our own complex math ops
-   because ARMv5 has no hardware float */
-
-void multiply(int ar, int aj, int br, int bj, int *cr, int *cj)
-{
-	*cr = ar*br - aj*bj;
-	*cj = aj*br + ar*bj;
-}
-
-int polar_discriminant(int ar, int aj, int br, int bj)
-{
-	int cr, cj;
-	double angle;
-	multiply(ar, aj, br, -bj, &cr, &cj);
-	angle = atan2((double)cj, (double)cr);
-	return (int)(angle / 3.14159 * (1<<14));
-}
-
-int fast_atan2(int y, int x)
-/* pre scaled for int16 */
-{
-	int yabs, angle;
-	int pi4=(1<<12), pi34=3*(1<<12);  /* note pi = 1<<14 */
-	if (x==0 && y==0) {
-		return 0;
-	}
-	yabs = y;
-	if (yabs < 0) {
-		yabs = -yabs;
-	}
-	if (x >= 0) {
-		angle = pi4  - pi4 * (x-yabs) / (x+yabs);
-	} else {
-		angle = pi34 - pi4 * (x+yabs) / (yabs-x);
-	}
-	if (y < 0) {
-		return -angle;
-	}
-	return angle;
-}
-
-int polar_disc_fast(int ar, int aj, int br, int bj)
-{
-	int cr, cj;
-	multiply(ar, aj, br, -bj, &cr, &cj);
-	return fast_atan2(cj, cr);
-}
-
-int atan_lut_init(void)
-{
-	int i = 0;
-
-	atan_lut = malloc(atan_lut_size * sizeof(int));
-
-	for (i = 0; i < atan_lut_size; i++) {
-		atan_lut[i] = (int) (atan((double) i / (1<<atan_lut_coef)) / 3.14159 * (1<<14));
-	}
-
-	return 0;
-}
-
-int polar_disc_lut(int ar, int aj, int br, int bj)
-{
-	int cr, cj, x, x_abs;
-
-	multiply(ar, aj, br, -bj, &cr, &cj);
-
-	/* special cases */
-	if (cr == 0 || cj == 0) {
-		if (cr == 0 && cj == 0)
-			{return 0;}
-		if (cr == 0 && cj > 0)
-			{return 1 << 13;}
-		if (cr == 0 && cj < 0)
-			{return -(1 << 13);}
-		if (cj == 0 && cr > 0)
-			{return 0;}
-		if (cj == 0 && cr < 0)
-			{return 1 << 14;}
-	}
-
-	/* real range -32768 - 32768 use 64x range -> absolute maximum: 2097152 */
-	x = (cj << atan_lut_coef) / cr;
-	x_abs = abs(x);
-
-	if (x_abs >= atan_lut_size) {
-		/* we can use linear range, but it is not necessary */
-		return (cj > 0) ? 1<<13 : -(1<<13);
-	}
-
-	if (x > 0) {
-		return (cj > 0) ? atan_lut[x] : atan_lut[x] - (1<<14);
-	} else {
-		return (cj > 0) ? (1<<14) - atan_lut[-x] : -atan_lut[-x];
-	}
-
-	return 0;
-}
-
-int esbensen(int ar, int aj, int br, int bj)
-/*
-  input signal: s(t) = a*exp(-i*w*t+p)
-  a = amplitude, w = angular freq, p = phase difference
-  solve w
-  s' = -i(w)*a*exp(-i*w*t+p)
-  s'*conj(s) = -i*w*a*a
-  s'*conj(s) / |s|^2 = -i*w
-*/
-{
-	int cj, dr, dj;
-	int scaled_pi = 2608; /* 1<<14 / (2*pi) */
-	dr = (br - ar) * 2;
-	dj = (bj - aj) * 2;
-	cj = bj*dr - br*dj; /* imag(ds*conj(s)) */
-	return (scaled_pi * cj / (ar*ar+aj*aj+1));
-}
-
 void fm_demod(struct demod_state *fm)
 {
-	int i, pcm;
-	int16_t *lp = fm->lowpassed;
-	pcm = polar_discriminant(lp[0], lp[1],
-		fm->pre_r, fm->pre_j);
-	fm->result[0] = (int16_t)pcm;
-	for (i = 2; i < (fm->lp_len-1); i += 2) {
-		switch (fm->custom_atan) {
-		case 0:
-			pcm = polar_discriminant(lp[i], lp[i+1],
-				lp[i-2], lp[i-1]);
-			break;
-		case 1:
-			pcm = polar_disc_fast(lp[i], lp[i+1],
-				lp[i-2], lp[i-1]);
-			break;
-		case 2:
-			pcm = polar_disc_lut(lp[i], lp[i+1],
-				lp[i-2], lp[i-1]);
-			break;
-		case 3:
-			pcm = esbensen(lp[i], lp[i+1],
-				lp[i-2], lp[i-1]);
-			break;
-		}
-		fm->result[i/2] = (int16_t)pcm;
-	}
-	fm->pre_r = lp[fm->lp_len - 2];
-	fm->pre_j = lp[fm->lp_len - 1];
-	fm->result_len = fm->lp_len/2;
+	fm->result_len = fmdisc_demod(&fm->disc, fm->lowpassed, fm->lp_len, fm->result);
+	if (fm->result_len < 0) {
+		fm->result_len = 0;}
 }
 
 void am_demod(struct demod_state *fm)
@@ -1052,8 +1462,8 @@ void raw_demod(struct demod_state *fm)
 
 void deemph_filter(struct demod_state *fm)
 {
-	static int avg;  /* cheating... */
 	int i, d;
+	int avg = fm->deemph_avg;
 	/* de-emph IIR
 	 * avg = avg * (1 - alpha) + sample * alpha;
 	 */
@@ -1066,12 +1476,15 @@ void deemph_filter(struct demod_state *fm)
 		}
 		fm->result[i] = (int16_t)avg;
 	}
+	fm->deemph_avg = avg;
 }
 
 void dc_block_audio_filter(struct demod_state *fm)
 {
 	int i, avg;
 	int64_t sum = 0;
+	if (!fm->result_len)
+		return;
 	for (i=0; i < fm->result_len; i++) {
 		sum += fm->result[i];
 	}
@@ -1083,6 +1496,34 @@ void dc_block_audio_filter(struct demod_state *fm)
 	fm->dc_avg = avg;
 }
 
+void deemph_dc_block_filter(struct demod_state *fm)
+/* deemph_filter() followed by dc_block_audio_filter(),
+ * summing up for the dc average in the same pass */
+{
+	int i, d, dc;
+	int avg = fm->deemph_avg;
+	int64_t sum = 0;
+	for (i = 0; i < fm->result_len; i++) {
+		d = fm->result[i] - avg;
+		if (d > 0) {
+			avg += (d + fm->deemph_a/2) / fm->deemph_a;
+		} else {
+			avg += (d - fm->deemph_a/2) / fm->deemph_a;
+		}
+		fm->result[i] = (int16_t)avg;
+		sum += fm->result[i];
+	}
+	fm->deemph_avg = avg;
+	if (!fm->result_len)
+		return;
+	dc = sum / fm->result_len;
+	dc = (dc + fm->dc_avg * fm->adc_block_const) / ( fm->adc_block_const + 1 );
+	for (i = 0; i < fm->result_len; i++) {
+		fm->result[i] -= dc;
+	}
+	fm->dc_avg = dc;
+}
+
 void dc_block_raw_filter(struct demod_state *fm, int16_t *buf, int len)
 {
 	/* derived from dc_block_audio_filter,
@@ -1106,6 +1547,149 @@ void dc_block_raw_filter(struct demod_state *fm, int16_t *buf, int len)
 	fm->dc_avgI = avgI;
 	fm->dc_avgQ = avgQ;
 }
+
+/* float32 pipeline: same stages as above, working on resultf.
+ * values keep the scale of the int16 pipeline, without its wrap arounds */
+
+void fm_demod_f(struct demod_state *fm)
+{
+	fm->result_len = fmdisc_demod_f(&fm->disc, fm->lowpassed, fm->lp_len, fm->resultf);
+	if (fm->result_len < 0) {
+		fm->result_len = 0;}
+}
+
+void am_demod_f(struct demod_state *fm)
+{
+	int i;
+	float re, im;
+	int16_t *lp = fm->lowpassed;
+	float *r = fm->resultf;
+	for (i = 0; i < fm->lp_len; i += 2) {
+		re = lp[i];
+		im = lp[i+1];
+		r[i/2] = sqrtf(re * re + im * im) * fm->output_scale;
+	}
+	fm->result_len = fm->lp_len/2;
+}
+
+void usb_demod_f(struct demod_state *fm)
+{
+	int i;
+	int16_t *lp = fm->lowpassed;
+	float *r = fm->resultf;
+	for (i = 0; i < fm->lp_len; i += 2) {
+		r[i/2] = (float)(lp[i] + lp[i+1]) * fm->output_scale;
+	}
+	fm->result_len = fm->lp_len/2;
+}
+
+void lsb_demod_f(struct demod_state *fm)
+{
+	int i;
+	int16_t *lp = fm->lowpassed;
+	float *r = fm->resultf;
+	for (i = 0; i < fm->lp_len; i += 2) {
+		r[i/2] = (float)(lp[i] - lp[i+1]) * fm->output_scale;
+	}
+	fm->result_len = fm->lp_len/2;
+}
+
+void raw_demod_f(struct demod_state *fm)
+{
+	int i;
+	for (i = 0; i < fm->lp_len; i++) {
+		fm->resultf[i] = fm->lowpassed[i];
+	}
+	fm->result_len = fm->lp_len;
+}
+
+int low_pass_simple_f(float *signal2, int len, int step)
+{
+	int i, i2;
+	float sum;
+	for(i=0; i < len; i+=step) {
+		sum = 0.0f;
+		for(i2=0; i2<step; i2++) {
+			sum += signal2[i + i2];
+		}
+		signal2[i/step] = sum;
+	}
+	return len / step;
+}
+
+void deemph_filter_f(struct demod_state *fm)
+{
+	int i;
+	float avg = fm->deemph_avgf;
+	const float alpha = 1.0f / fm->deemph_a;
+	for (i = 0; i < fm->result_len; i++) {
+		avg += (fm->resultf[i] - avg) * alpha;
+		fm->resultf[i] = avg;
+	}
+	fm->deemph_avgf = avg;
+}
+
+void dc_block_audio_filter_f(struct demod_state *fm)
+{
+	int i;
+	float avg, sum = 0.0f;
+	if (!fm->result_len)
+		return;
+	for (i=0; i < fm->result_len; i++) {
+		sum += fm->resultf[i];
+	}
+	avg = sum / fm->result_len;
+	avg = (avg + fm->dc_avgf * fm->adc_block_const) / ( fm->adc_block_const + 1 );
+	for (i=0; i < fm->result_len; i++) {
+		fm->resultf[i] -= avg;
+	}
+	fm->dc_avgf = avg;
+}
+
+void deemph_dc_block_filter_f(struct demod_state *fm)
+{
+	int i;
+	float dc, sum = 0.0f;
+	float avg = fm->deemph_avgf;
+	const float alpha = 1.0f / fm->deemph_a;
+	for (i = 0; i < fm->result_len; i++) {
+		avg += (fm->resultf[i] - avg) * alpha;
+		fm->resultf[i] = avg;
+		sum += avg;
+	}
+	fm->deemph_avgf = avg;
+	if (!fm->result_len)
+		return;
+	dc = sum / fm->result_len;
+	dc = (dc + fm->dc_avgf * fm->adc_block_const) / ( fm->adc_block_const + 1 );
+	for (i = 0; i < fm->result_len; i++) {
+		fm->resultf[i] -= dc;
+	}
+	fm->dc_avgf = dc;
+}
+
+/* resultf -> result, or scaled to +-1.0 for float output */
+void float_output(struct demod_state *fm)
+{
+	int i;
+	float v;
+	if (fm->use_float == FLOAT_OUTPUT) {
+		for (i = 0; i < fm->result_len; i++) {
+			fm->resultf[i] *= (1.0f / 32768.0f);
+		}
+		return;
+	}
+	for (i = 0; i < fm->result_len; i++) {
+		v = fm->resultf[i];
+		if (v >= 32767.0f)
+			fm->result[i] = 32767;
+		else if (v <= -32768.0f)
+			fm->result[i] = -32768;
+		else
+			fm->result[i] = (int16_t)lrintf(v);
+	}
+}
+
 int mad(int16_t *samples, int len, int step)
 /* mean average deviation */
 {
@@ -1154,163 +1738,322 @@ int rms(int16_t *samples, int len, int step, int omitDCfix)
 	return (int)sqrt((p-err) / len);
 }
 
-void arbitrary_upsample(int16_t *buf1, int16_t *buf2, int len1, int len2)
-/* linear interpolation, len1 < len2 */
-{
-	int i = 1;
-	int j = 0;
-	int tick = 0;
-	double frac;  /* use integers... */
-	while (j < len2) {
-		frac = (double)tick / (double)len2;
-		buf2[j] = (int16_t)(buf1[i-1]*(1-frac) + buf1[i]*frac);
-		j++;
-		tick += len1;
-		if (tick > len2) {
-			tick -= len2;
-			i++;
+/* stages of the demod chain, in the order of build_demod_chain() */
+
+static void cic_stage(struct demod_state *d)
+/* all passes and the droop compensation on one tile at a time,
+ * the decimated tiles are packed at the start of lowpassed */
+{
+	int i, tile, len, out = 0;
+	for (tile=0; tile < d->lp_len; tile += TILE_LENGTH) {
+		len = MIN(TILE_LENGTH, d->lp_len - tile);
+		for (i=0; i < d->downsample_passes; i++) {
+			len = cic5_decimate(&d->lp_cic[i], d->lowpassed + tile, len);
+		}
+		if (d->droop_passes) {
+			cfir_filter(&d->droop, d->lowpassed + tile, len);}
+		if (d->sq.enabled) {
+			squelch_gate(&d->sq, d->lowpassed + tile, len);}
+		memmove(d->lowpassed + out, d->lowpassed + tile, len * sizeof(int16_t));
+		out += len;
+	}
+	d->lp_len = out;
+}
+
+/* -S: record of a -L window */
+static void levels_record(struct demod_state *d, double avgRms)
+{
+	struct meas_record r;
+	struct scan_state *sc = &d->scan;
+	struct dongle_state *dg = d->dongle;
+	r.ts = meas_time();
+	r.freq = (sc->enabled && sc->active >= 0) ? sc->freqs[sc->active] : dg->userFreq;
+	r.rms = meas_db(avgRms);
+	r.peak = meas_db(d->levelMax);
+	r.adc_max = d->cmd->checkADCmax ? (float)((int)dg->sampleMax - 127) : -1.0f;
+	r.adc_rms = (d->cmd->checkADCrms && dg->samplePowCount > 0) ? (float)sqrt(dg->samplePowSum / dg->samplePowCount) : -1.0f;
+	r.trigger = MEAS_TRIG_NONE;
+	r.line = 0;
+	meas_stream_add(&meas, &r);
+}
+
+static void levels_stage(struct demod_state *d)
+{
+	struct cmd_state *c = d->cmd;
+	double freqK, avgRms, rmsLevel, avgRmsLevel;
+	int i;
+	int sr = 0;
+	/* power squelch, done by scan_stage() with -E pscan */
+	if (d->sq.enabled) {
+		/* already gated during decimation: only the block's verdict is left */
+		sr = d->lp_len ? (int)sqrt(d->sq.pow_sum / (d->lp_len / 2)) : -1;
+		if (d->sq.open_pairs) {
+			d->squelch_hits = 0;
+		} else {
+			d->squelch_hits++;
+			if (d->sq.skip_demod) {
+				d->result_len = 0;
+				d->chain_stop = 1;
+			}
+		}
+		d->sq.open_pairs = 0;
+		d->sq.pow_sum = 0.0;
+	} else if (d->squelch_level && !d->scan.enabled) {
+		sr = rms(d->lowpassed, d->lp_len, 1, d->dc_block_raw);
+		if (sr >= 0) {
+			if (sr < d->squelch_level) {
+				d->squelch_hits++;
+				for (i=0; i<d->lp_len; i++) {
+					d->lowpassed[i] = 0;
+				}
+			} else {
+				d->squelch_hits = 0;}
+		}
+	}
+
+	if (printLevels) {
+		if (!sr)
+			sr = rms(d->lowpassed, d->lp_len, 1, d->dc_block_raw);
+		--d->printLevelNo;
+		if (printLevels && sr >= 0) {
+			d->levelSum += sr;
+			if (d->levelMax < sr)		d->levelMax = sr;
+			if (d->levelMaxMax < sr)	d->levelMaxMax = sr;
+			if  (!d->printLevelNo) {
+				d->printLevelNo = printLevels;
+				freqK = d->dongle->userFreq /1000.0;
+				avgRms = d->levelSum / printLevels;
+				rmsLevel = 20.0 * log10( 1E-10 + sr );
+				avgRmsLevel = 20.0 * log10( 1E-10 + avgRms );
+				if (meas.fd >= 0)
+					levels_record(d, avgRms);
+				else
+					fprintf(stderr, "%.3f kHz, %.1f avg rms, %d max rms, %d max max rms, %d squelch rms, %d rms, %.1f dB rms level, %.2f dB avg rms level\n",
+						freqK, avgRms, d->levelMax, d->levelMaxMax, d->squelch_level, sr, rmsLevel, avgRmsLevel );
+				d->levelMax = 0;
+				d->levelSum = 0;
+			}
 		}
-		if (i >= len1) {
-			i = len1 - 1;
-			tick = len2;
+	}
+
+	/* with -E cgroup measured by cmd_group_stage() */
+	if (c->filename && !c->grouped) {
+		if (!sr)
+			sr = rms(d->lowpassed, d->lp_len, 1, d->dc_block_raw);
+		if ( d->printBlockLen && verbosity ) {
+			fprintf(stderr, "block length for rms after decimation is %d samples\n", d->lp_len);
+			if ( d->lp_len < 128 )
+				fprintf(stderr, "\n  WARNING: increase block length with option -W\n\n");
+			--d->printBlockLen;
+		}
+		if (!c->cur.numSummed) {
+			c->cur.levelSum = 0;
+			c->cur.levelPeak = 0;
 		}
+		if (c->cur.numSummed < c->cur.numMeas && sr >= 0) {
+			c->cur.levelSum += sr;
+			if (c->cur.levelPeak < sr)
+				c->cur.levelPeak = sr;
+			c->cur.numSummed++;
+		}
+	}
+}
+
+static void cmd_group_stage(struct demod_state *d)
+/* -E cgroup: level of each command file line in the current capture */
+{
+	struct cmd_state *c = d->cmd;
+	int n = c->cp.n;
+	int k, segments, level;
+	double capture_rate = (double)d->rate_in * d->downsample;
+	double f, half = 0.5 / d->downsample;
+	if (c->group < 0 || c->group >= c->numGroups)
+		return;
+	segments = d->lp_len / (2 * n);
+	if (segments < 1)
+		return;
+	/* average over the whole block, as rms() does for a single line */
+	chan_power_spectrum(&c->cp, d->lowpassed + d->lp_len - 2 * n * segments, segments);
+	for (k = c->groupFirst[c->group]; k < c->groupFirst[c->group+1]; k++) {
+		struct cmd_line *l = &c->lines[k];
+		if (l->numSummed >= l->numMeas)
+			continue;
+		f = l->offset / capture_rate;
+		/* rms of I and Q after decimation, as rms() for -l */
+		level = (int)(d->downsample * sqrt(0.5 * chan_power_band(&c->cp, f - half, f + half)));
+		l->levelSum += level;
+		if (l->levelPeak < level)
+			l->levelPeak = level;
+		l->numSummed++;
 	}
 }
 
-void arbitrary_downsample(int16_t *buf1, int16_t *buf2, int len1, int len2)
-/* fractional boxcar lowpass, len1 > len2 */
-{
-	int i = 1;
-	int j = 0;
-	int tick = 0;
-	double remainder = 0;
-	double frac;  /* use integers... */
-	buf2[0] = 0;
-	while (j < len2) {
-		frac = 1.0;
-		if ((tick + len2) > len1) {
-			frac = (double)(len1 - tick) / (double)len2;}
-		buf2[j] += (int16_t)((double)buf1[i] * frac + remainder);
-		remainder = (double)buf1[i] * (1.0-frac);
-		tick += len2;
-		i++;
-		if (tick > len1) {
-			j++;
-			buf2[j] = 0;
-			tick -= len1;
+static void scan_stage(struct demod_state *d)
+/* measure all channels of the current capture, demodulate the active one */
+{
+	struct scan_state *sc = &d->scan;
+	int g = d->controller->freq_now;
+	int n = sc->cp.n;
+	int i, level, best = -1, best_level = -1, active_level = -1;
+	double capture_rate = (double)d->rate_in * d->downsample;
+	double f, half = 0.5 / d->downsample;
+	if (sc->active < sc->first[g] || sc->active >= sc->first[g+1])
+		sc->active = -1;
+	if (d->lp_len / 2 >= n) {
+		/* last n pairs: the head of a block may be muted after a retune */
+		chan_power_spectrum(&sc->cp, d->lowpassed + d->lp_len - 2*n, 1);
+		for (i = sc->first[g]; i < sc->first[g+1]; i++) {
+			f = sc->offsets[i] / capture_rate;
+			/* rms of I and Q after decimation, as rms() for -l */
+			level = (int)(d->downsample * sqrt(0.5 * chan_power_band(&sc->cp, f - half, f + half)));
+			if (level > best_level) {
+				best_level = level;
+				best = i;
+			}
+			if (i == sc->active)
+				active_level = level;
 		}
-		if (i >= len1) {
-			i = len1 - 1;
-			tick = len1;
+		/* hold the active channel while it is open */
+		if (!d->squelch_level || active_level < d->squelch_level) {
+			if (best >= 0 && best_level >= d->squelch_level && best_level > 0) {
+				if (best != sc->active) {
+					chan_mixer_set(&sc->mixer, sc->offsets[best] / capture_rate);
+					if (verbosity)
+						fprintf(stderr, "scan: %.4f MHz, level %d\n", sc->freqs[best] * 1E-6, best_level);
+				}
+				sc->active = best;
+			} else {
+				sc->active = -1;}
 		}
 	}
-	for (j=0; j<len2; j++) {
-		buf2[j] = buf2[j] * len2 / len1;}
+	if (sc->active < 0) {
+		d->squelch_hits++;
+		memset(d->lowpassed, 0, sizeof(int16_t) * d->lp_len);
+		return;
+	}
+	d->squelch_hits = 0;
+	chan_mixer_process(&sc->mixer, d->lowpassed, d->lp_len);
+}
+
+static void post_downsample_stage(struct demod_state *d)
+{
+	d->result_len = low_pass_simple(d->result, d->result_len, d->post_downsample);
+}
+
+static void post_downsample_stage_f(struct demod_state *d)
+{
+	d->result_len = low_pass_simple_f(d->resultf, d->result_len, d->post_downsample);
+}
+
+static void resample_stage(struct demod_state *d)
+{
+	d->result_len = resampler_process(&d->resamp, d->result, d->result_len, d->result, d->result_cap);
+	if (d->result_len < 0)
+		d->result_len = 0;
 }
 
-void arbitrary_resample(int16_t *buf1, int16_t *buf2, int len1, int len2)
-/* up to you to calculate lengths and make sure it does not go OOB
- * okay for buffers to overlap, if you are downsampling */
+static void resample_stage_f(struct demod_state *d)
 {
-	if (len1 < len2) {
-		arbitrary_upsample(buf1, buf2, len1, len2);
-	} else {
-		arbitrary_downsample(buf1, buf2, len1, len2);
+	d->result_len = resampler_process_f(&d->resamp, d->resultf, d->result_len, d->resultf, d->result_cap);
+	if (d->result_len < 0)
+		d->result_len = 0;
+}
+
+static void add_stage(struct demod_state *d, void (*fn)(struct demod_state*), const char *name, int prof)
+{
+	if (d->chain_len >= MAX_DEMOD_STAGES) {
+		fprintf(stderr, "Too many demod stages\n");
+		exit(1);
 	}
+	d->chain[d->chain_len].fn = fn;
+	d->chain[d->chain_len].name = name;
+	d->chain[d->chain_len].prof = prof;
+	d->chain_len++;
 }
 
-void full_demod(struct demod_state *d)
+/* assemble the stages enabled by the options once,
+ * so full_demod() doesn't check them on every block.
+ * call after optimal_settings() has fixed downsample_passes */
+static void build_demod_chain(struct demod_state *d)
 {
-	struct cmd_state *c = d->cmd;
-	double freqK, avgRms, rmsLevel, avgRmsLevel;
-	int i, ds_p;
-	int sr = 0;
-	static int printBlockLen = 1;
-	ds_p = d->downsample_passes;
+	int ds_p = d->downsample_passes;
+	int f = (d->use_float != FLOAT_OFF);
+	int i;
+	d->chain_len = 0;
+	/* -E pscan squelches per channel on its own */
+	if (d->scan.enabled) {
+		d->sq.enabled = 0;}
+	if (d->sq.enabled) {
+		squelch_setup(&d->sq, d->squelch_level, d->rate_in);}
+
+	if (d->scan.enabled) {
+		add_stage(d, scan_stage, "scan", STAGE_SCAN);}
+	if (d->cmd->grouped && d->cmd->filename) {
+		add_stage(d, cmd_group_stage, "command file levels", STAGE_LEVELS);}
 	if (ds_p) {
-		for (i=0; i < ds_p; i++) {
-			fifth_order(d->lowpassed,   (d->lp_len >> i), d->lp_i_hist[i]);
-			fifth_order(d->lowpassed+1, (d->lp_len >> i) - 1, d->lp_q_hist[i]);
-		}
-		d->lp_len = d->lp_len >> ds_p;
+		if (ds_p > CIC_TABLE_MAX)
+			ds_p = d->downsample_passes = CIC_TABLE_MAX;
 		/* droop compensation */
-		if (d->comp_fir_size == 9 && ds_p <= CIC_TABLE_MAX) {
-			generic_fir(d->lowpassed, d->lp_len,
-				cic_9_tables[ds_p], d->droop_i_hist);
-			generic_fir(d->lowpassed+1, d->lp_len-1,
-				cic_9_tables[ds_p], d->droop_q_hist);
+		if (d->comp_fir_size == 9) {
+			cfir_free(&d->droop);
+			cfir_init(&d->droop, &cic_9_tables[ds_p][1], cic_9_tables[ds_p][0], 15);
+			d->droop_passes = ds_p;
 		}
+		if (d->droop_passes) {
+			add_stage(d, cic_stage, d->sq.enabled ? "cic5+droop+squelch" : "cic5+droop", STAGE_DECIMATE);
+		} else {
+			add_stage(d, cic_stage, d->sq.enabled ? "cic5+squelch" : "cic5", STAGE_DECIMATE);}
 	} else {
-		low_pass(d);
-	}
-	/* power squelch */
-	if (d->squelch_level) {
-		sr = rms(d->lowpassed, d->lp_len, 1, d->dc_block_raw);
-		if (sr >= 0) {
-			if (sr < d->squelch_level) {
-				d->squelch_hits++;
-				for (i=0; i<d->lp_len; i++) {
-					d->lowpassed[i] = 0;
-				}
-			} else {
-				d->squelch_hits = 0;}
-		}
-	}
-
-	if (printLevels) {
-		if (!sr)
-			sr = rms(d->lowpassed, d->lp_len, 1, d->dc_block_raw);
-		--printLevelNo;
-		if (printLevels && sr >= 0) {
-			levelSum += sr;
-			if (levelMax < sr)		levelMax = sr;
-			if (levelMaxMax < sr)	levelMaxMax = sr;
-			if  (!printLevelNo) {
-				printLevelNo = printLevels;
-				freqK = dongle.userFreq /1000.0;
-				avgRms = levelSum / printLevels;
-				rmsLevel = 20.0 * log10( 1E-10 + sr );
-				avgRmsLevel = 20.0 * log10( 1E-10 + avgRms );
-				fprintf(stderr, "%.3f kHz, %.1f avg rms, %d max rms, %d max max rms, %d squelch rms, %d rms, %.1f dB rms level, %.2f dB avg rms level\n",
-					freqK, avgRms, levelMax, levelMaxMax, d->squelch_level, sr, rmsLevel, avgRmsLevel );
-				levelMax = 0;
-				levelSum = 0;
-			}
+		add_stage(d, low_pass, d->sq.enabled ? "boxcar+squelch" : "boxcar", STAGE_DECIMATE);
+	}
+	if (d->squelch_level || printLevels || (d->cmd->filename && !d->cmd->grouped)) {
+		add_stage(d, levels_stage, "levels", STAGE_LEVELS);}
+
+	/* lowpassed -> result(f) */
+	add_stage(d, f ? d->mode_demod_f : d->mode_demod,
+		(d->mode_demod == &fm_demod) ? "fm" : (d->mode_demod == &am_demod) ? "am" :
+		(d->mode_demod == &usb_demod) ? "usb" : (d->mode_demod == &lsb_demod) ? "lsb" : "raw",
+		STAGE_DEMOD);
+	if (d->mode_demod != &raw_demod) {
+		/* todo, fm noise squelch */
+		if (d->post_downsample > 1) {
+			add_stage(d, f ? post_downsample_stage_f : post_downsample_stage, "post downsample", STAGE_POST);}
+		if (d->deemph && d->dc_block_audio) {
+			add_stage(d, f ? deemph_dc_block_filter_f : deemph_dc_block_filter, "deemph+dc block", STAGE_POST);
+		} else if (d->deemph) {
+			add_stage(d, f ? deemph_filter_f : deemph_filter, "deemph", STAGE_POST);
+		} else if (d->dc_block_audio) {
+			add_stage(d, f ? dc_block_audio_filter_f : dc_block_audio_filter, "dc block", STAGE_POST);
 		}
+		if (d->rate_out2 > 0) {
+			add_stage(d, f ? resample_stage_f : resample_stage, "resample", STAGE_RESAMPLE);}
 	}
+	if (f) {
+		add_stage(d, float_output, "float output", STAGE_OUTPUT);}
 
-	if (c->filename) {
-		if (!sr)
-			sr = rms(d->lowpassed, d->lp_len, 1, d->dc_block_raw);
-		if ( printBlockLen && verbosity ) {
-			fprintf(stderr, "block length for rms after decimation is %d samples\n", d->lp_len);
-			if ( d->lp_len < 128 )
-				fprintf(stderr, "\n  WARNING: increase block length with option -W\n\n");
-			--printBlockLen;
-		}
-		if (!c->numSummed)
-			c->levelSum = 0;
-		if (c->numSummed < c->numMeas && sr >= 0) {
-			c->levelSum += sr;
-			c->numSummed++;
-		}
+	if (verbosity) {
+		fprintf(stderr, "demod chain:");
+		for (i = 0; i < d->chain_len; i++) {
+			fprintf(stderr, "%s %s", i ? " ->" : "", d->chain[i].name);}
+		fprintf(stderr, "\n");
 	}
+}
 
-	d->mode_demod(d);  /* lowpassed -> result */
-	if (d->mode_demod == &raw_demod) {
+void full_demod(struct demod_state *d)
+{
+	struct demod_stage *st = d->chain;
+	struct demod_stage *end = d->chain + d->chain_len;
+	uint64_t t;
+	d->chain_stop = 0;
+	if (!profiling) {
+		for (; st < end && !d->chain_stop; st++) {
+			st->fn(d);}
 		return;
 	}
-	/* todo, fm noise squelch */
-	/* use nicer filter here too? */
-	if (d->post_downsample > 1) {
-		d->result_len = low_pass_simple(d->result, d->result_len, d->post_downsample);}
-	if (d->deemph) {
-		deemph_filter(d);}
-	if (d->dc_block_audio) {
-		dc_block_audio_filter(d);}
-	if (d->rate_out2 > 0) {
-		low_pass_real(d);
-		/* arbitrary_resample(d->result, d->result, d->result_len, d->result_len * d->rate_out2 / d->rate_out); */
+	t = now_ns();
+	for (; st < end && !d->chain_stop; st++) {
+		st->fn(d);
+		PROFILE_STAGE(t, st->prof);
 	}
 }
 
@@ -1319,21 +2062,25 @@ static void rtlsdr_callback(unsigned char *buf, uint32_t len, void *ctx)
 	struct dongle_state *s = ctx;
 	struct demod_state *d = s->demod_target;
 	struct cmd_state *c = d->cmd;
-	int i, muteLen = s->mute;
+	struct queue_block *blk;
+	int16_t *buf16;
+	int i, tile, tile_len, muteLen = s->mute;
 	unsigned char sampleMax;
 	uint32_t sampleP, samplePowSum = 0.0;
 	int samplePowCount = 0, step = 2;
 	time_t rawtime;
+	uint64_t t;
 
 	if (do_exit) {
 		return;}
 	if (!ctx) {
 		return;}
+	t = (profiling || low_latency) ? now_ns() : 0;
 	time(&rawtime);
 	if (duration > 0 && rawtime >= stop_time) {
 		do_exit = 1;
 		fprintf(stderr, "Time expired, exiting!\n");
-		rtlsdr_cancel_async(dongle.dev);
+		cancel_all();
 	}
 	if (s->mute) {
 		if(muteLen > (int)len)
@@ -1371,25 +2118,49 @@ static void rtlsdr_callback(unsigned char *buf, uint32_t len, void *ctx)
 		s->samplePowSum += (double)samplePowSum / samplePowCount;
 		s->samplePowCount += 1;
 	}
-	/* 1st: convert to 16 bit - to allow easier calculation of DC */
-	for (i=0; i<(int)len; i++) {
-		s->buf16[i] = ( (int16_t)buf[i] - 127 );
-	}
-	/* 2nd: do DC filtering BEFORE up-mixing */
-	if (d->dc_block_raw) {
-		dc_block_raw_filter(d, s->buf16, (int)len);
+	/* convert directly into the next free block of the demod queue */
+	blk = block_queue_write_slot(&d->queue);
+	if (!blk)
+		return;	/* demod fell behind: block is dropped and counted */
+	buf16 = blk->buf;
+	/* DC filtering needs the whole block, so it's done BEFORE up-mixing,
+	 * else the block is converted and mixed down tile by tile, while in cache */
+	if (d->dc_block_raw || (muteLen && c->filename)) {
+		/* 1st: convert to 16 bit - to allow easier calculation of DC */
+		for (i=0; i<(int)len; i++) {
+			buf16[i] = ( (int16_t)buf[i] - 127 );
+		}
+		/* 2nd: do DC filtering BEFORE up-mixing */
+		if (d->dc_block_raw) {
+			dc_block_raw_filter(d, buf16, (int)len);
+		}
+		if (muteLen && c->filename)
+			return;	/* "mute" after the dc_block_raw_filter(), giving it time to remove the new DC */
+		PROFILE_STAGE(t, STAGE_CONVERT);
+		/* 3rd: down-mixing */
+		if (!s->offset_tuning) {
+			rotate16_neg90(buf16, (int)len);
+		}
+	} else {
+		for (tile=0; tile<(int)len; tile+=TILE_LENGTH) {
+			tile_len = MIN(TILE_LENGTH, (int)len - tile);
+			for (i=tile; i<tile+tile_len; i++) {
+				buf16[i] = ( (int16_t)buf[i] - 127 );
+			}
+			/* tiles start at multiples of 4 I/Q pairs: same phase of rotation */
+			if (!s->offset_tuning) {
+				rotate16_neg90(buf16 + tile, tile_len);
+			}
+		}
+		PROFILE_STAGE(t, STAGE_CONVERT);
 	}
-	if (muteLen && c->filename)
-		return;	/* "mute" after the dc_block_raw_filter(), giving it time to remove the new DC */
-	/* 3rd: down-mixing */
-	if (!s->offset_tuning) {
-		rotate16_neg90(s->buf16, (int)len);
+	if (low_latency) {
+		/* the transfer completed with its last sample */
+		blk->ts = t - (uint64_t)(len / 2) * 1000000000U / s->rate;
 	}
-	pthread_rwlock_wrlock(&d->rw);
-	memcpy(d->lowpassed, s->buf16, 2*len);
-	d->lp_len = len;
-	pthread_rwlock_unlock(&d->rw);
-	safe_cond_signal(&d->ready, &d->ready_m);
+	PROFILE_STAGE(t, STAGE_ROTATE);
+	profile_samples += len / 2;
+	block_queue_push(&d->queue, (int)len, s->tune_gen);
 }
 
 static void *dongle_thread_fn(void *arg)
@@ -1399,87 +2170,229 @@ static void *dongle_thread_fn(void *arg)
 	return 0;
 }
 
+/* replaces dongle_thread_fn() with -I: feeds the file as fast as the demod takes it */
+static void *replay_thread_fn(void *arg)
+{
+	struct dongle_state *s = arg;
+	struct demod_state *d = s->demod_target;
+	unsigned char *buf = malloc(s->buf_len);
+	int16_t *wbuf = NULL;
+	size_t n, k;
+	int v;
+
+	if (s->replay_bits == 16)
+		wbuf = malloc(s->buf_len * sizeof(int16_t));
+	if (!buf || (s->replay_bits == 16 && !wbuf)) {
+		fprintf(stderr, "Failed to allocate replay buffer\n");
+		do_exit = 1;
+	}
+	if (s->replay_rate && s->replay_rate != s->rate)
+		fprintf(stderr, "Warning: replay file has %u Hz, capture rate is %u Hz\n", s->replay_rate, s->rate);
+	else if (!s->replay_rate)
+		fprintf(stderr, "Replaying raw 8 bit I/Q, expected at capture rate %u Hz\n", s->rate);
+
+	profile_start_ns = now_ns();
+	while (!do_exit) {
+		if (s->replay_bits == 16) {
+			waveReadSamples(s->replay_file, wbuf, s->buf_len, 0, &n);
+			for (k = 0; k < n; k++) {
+				v = (wbuf[k] >> 8) + 127;
+				buf[k] = (unsigned char)(v < 0 ? 0 : v);
+			}
+		} else if (s->replay_bits == 8) {
+			waveReadSamples(s->replay_file, buf, s->buf_len, 0, &n);
+		} else {
+			n = fread(buf, 1, s->buf_len, s->replay_file);
+		}
+		n &= ~(size_t)1;
+		if (!n)
+			break;
+		rtlsdr_callback(buf, (uint32_t)n, s);
+	}
+	block_queue_close(&d->queue);
+	free(buf);
+	free(wbuf);
+	return 0;
+}
+
+static void profile_report(double capture_rate)
+{
+	uint64_t total = 0;
+	double wall, ns;
+	int i;
+	if (!profile_samples)
+		return;
+	fprintf(stderr, "\n%-16s %10s\n", "stage", "ns/sample");
+	for (i = 0; i < STAGE_NUM; i++) {
+		total += stage_ns[i];
+		fprintf(stderr, "%-16s %10.2f\n", stage_names[i], (double)stage_ns[i] / profile_samples);
+	}
+	ns = (double)total / profile_samples;
+	fprintf(stderr, "%-16s %10.2f\n", "sum", ns);
+	fprintf(stderr, "%llu samples at %.0f Hz = %.2f s of input\n",
+		(unsigned long long)profile_samples, capture_rate, profile_samples / capture_rate);
+	if (ns > 0.0)
+		fprintf(stderr, "real-time factor of stages: %.2f\n", 1E9 / (ns * capture_rate));
+	if (profile_start_ns && profile_end_ns > profile_start_ns) {
+		wall = (profile_end_ns - profile_start_ns) * 1E-9;
+		if (wall > 0.0)
+			fprintf(stderr, "real-time factor (wall clock %.3f s): %.2f\n", wall, profile_samples / capture_rate / wall);
+	}
+}
+
 static void *demod_thread_fn(void *arg)
 {
 	struct demod_state *d = arg;
 	struct output_state *o = d->output_target;
 	struct cmd_state *c = d->cmd;
+	struct controller_state *cs = d->controller;
+	struct queue_block *blk;
+	void *buf;
 	while (!do_exit) {
-		safe_cond_wait(&d->ready, &d->ready_m);
-		pthread_rwlock_wrlock(&d->rw);
+		blk = block_queue_read_slot(&d->queue);
+		if (!blk)
+			break;
+		/* drop blocks still queued from before the requested hop */
+		if (d->skip_stale && blk->gen == d->stale_gen) {
+			block_queue_pop(&d->queue);
+			continue;
+		}
+		d->skip_stale = 0;
+		/* take the block, the queue gets our previous one */
+		buf = d->lowpassed;
+		d->lowpassed = blk->buf;
+		blk->buf = buf;
+		d->lp_len = blk->len;
+		d->stale_gen = blk->gen;
+		d->block_ts = blk->ts;
+		block_queue_pop(&d->queue);
+
 		full_demod(d);
-		pthread_rwlock_unlock(&d->rw);
 		if (d->exit_flag) {
 			do_exit = 1;
 		}
 		if (d->squelch_level && d->squelch_hits > d->conseq_squelch) {
 			d->squelch_hits = d->conseq_squelch + 1;  /* hair trigger */
-			safe_cond_signal(&controller.hop, &controller.hop_m);
+			d->skip_stale = (cs->freq_len > 1);
+			safe_cond_signal(&cs->hop, &cs->hop_m);
 			continue;
 		}
 
 		if (do_exit)
 			break;
 
-		if (c->filename && c->numSummed >= c->numMeas) {
-			checkTriggerCommand(c, dongle.sampleMax, dongle.samplePowSum, dongle.samplePowCount);
+		if (c->filename && cmd_measured(c)) {
+			checkTriggerCommands(c, d->dongle->sampleMax, d->dongle->samplePowSum, d->dongle->samplePowCount);
 
-			safe_cond_signal(&controller.hop, &controller.hop_m);
+			d->skip_stale = 1;
+			safe_cond_signal(&cs->hop, &cs->hop_m);
 			continue;
 		}
 
 		if (OutputToStdout) {
-			pthread_rwlock_wrlock(&o->rw);
-			memcpy(o->result, d->result, 2*d->result_len);
-			o->result_len = d->result_len;
-			pthread_rwlock_unlock(&o->rw);
-			safe_cond_signal(&o->ready, &o->ready_m);
+			blk = block_queue_write_slot(&o->queue);
+			if (blk) {
+				uint64_t t = profiling ? now_ns() : 0;
+				buf = blk->buf;
+				if (d->use_float == FLOAT_OUTPUT) {
+					blk->buf = d->resultf;
+					d->resultf = buf;
+				} else {
+					blk->buf = d->result;
+					d->result = buf;
+				}
+				blk->ts = d->block_ts;
+				block_queue_push(&o->queue, d->result_len, d->stale_gen);
+				PROFILE_STAGE(t, STAGE_OUTPUT);
+			}
 		}
 	}
+	/* end of replay: let the output drain and main finish */
+	if (d->queue.closed) {
+		block_queue_close(&o->queue);
+		do_exit = 1;
+	}
 	return 0;
 }
 
+static void latency_update(struct output_state *s, uint64_t ts)
+{
+	uint64_t now = now_ns();
+	uint64_t lat = (now > ts) ? now - ts : 0;
+	s->lat_num++;
+	s->lat_sum += (double)lat;
+	if (lat > s->lat_max)
+		s->lat_max = lat;
+	if (!s->lat_min || lat < s->lat_min)
+		s->lat_min = lat;
+	if (!verbosity)
+		return;
+	if (!s->win_start)
+		s->win_start = now;
+	s->win_num++;
+	s->win_sum += (double)lat;
+	if (lat > s->win_max)
+		s->win_max = lat;
+	if (now - s->win_start >= 1000000000U) {
+		fprintf(stderr, "latency: avg %.2f ms, max %.2f ms over %u blocks\n",
+			s->win_sum / s->win_num * 1E-6, s->win_max * 1E-6, (unsigned)s->win_num);
+		s->win_start = now;
+		s->win_num = s->win_max = 0;
+		s->win_sum = 0.0;
+	}
+}
+
+static void latency_report(struct output_state *s)
+{
+	if (!s->lat_num)
+		return;
+	fprintf(stderr, "antenna to output latency: min %.2f ms, avg %.2f ms, max %.2f ms over %u blocks\n",
+		s->lat_min * 1E-6, s->lat_sum / s->lat_num * 1E-6, s->lat_max * 1E-6, (unsigned)s->lat_num);
+}
+
 static void *output_thread_fn(void *arg)
 {
 	struct output_state *s = arg;
-	if (!waveHdrStarted) {
-		while (!do_exit) {
-			/* use timedwait and pad out under runs */
-			safe_cond_wait(&s->ready, &s->ready_m);
-			pthread_rwlock_rdlock(&s->rw);
-			fwrite(s->result, 2, s->result_len, s->file);
-			pthread_rwlock_unlock(&s->rw);
-		}
-	} else {
-		while (!do_exit) {
-			/* use timedwait and pad out under runs */
-			safe_cond_wait(&s->ready, &s->ready_m);
-			pthread_rwlock_rdlock(&s->rw);
-			/* distinguish for endianness: wave requires little endian */
-			waveWriteSamples(s->file, s->result, s->result_len, 0);
-			pthread_rwlock_unlock(&s->rw);
-		}
-	}
+	struct queue_block *blk;
+	uint64_t t;
+	/* drains the queue: only returns NULL when empty and exiting */
+	while ((blk = block_queue_read_slot(&s->queue)) != NULL) {
+		t = profiling ? now_ns() : 0;
+		if (!waveHdrStarted)
+			fwrite(blk->buf, s->queue.sample_size, blk->len, s->file);
+		else	/* distinguish for endianness: wave requires little endian */
+			waveWriteSamples(s->file, blk->buf, blk->len, 0);
+		if (low_latency && blk->ts)
+			latency_update(s, blk->ts);
+		block_queue_pop(&s->queue);
+		PROFILE_STAGE(t, STAGE_WRITE);
+	}
+	if (profiling)
+		profile_end_ns = now_ns();
 	return 0;
 }
 
-static void optimal_settings(uint64_t freq, uint32_t rate)
+static void optimal_settings(struct controller_state *cs, uint64_t freq, uint32_t rate)
 {
 	/* giant ball of hacks
 	 * seems unable to do a single pass, 2:1
 	 */
 	uint64_t capture_freq;
 	uint32_t capture_rate;
-	struct dongle_state *d = &dongle;
-	struct demod_state *dm = &demod;
-	struct controller_state *cs = &controller;
-	dm->downsample = (MinCaptureRate / dm->rate_in) + 1;
+	struct dongle_state *d = cs->dongle;
+	struct demod_state *dm = cs->demod;
+	/* smallest factor reaching min_capture_rate - exact output rates are left to the resampler */
+	dm->downsample = (cs->min_capture_rate + dm->rate_in - 1) / dm->rate_in;
+	if (dm->downsample < 1) {
+		dm->downsample = 1;}
 	if (dm->downsample_passes) {
-		dm->downsample_passes = (int)log2(dm->downsample) + 1;
+		dm->downsample_passes = 1;
+		while ((1 << dm->downsample_passes) < dm->downsample && dm->downsample_passes < CIC_TABLE_MAX) {
+			dm->downsample_passes++;}
 		dm->downsample = 1 << dm->downsample_passes;
 	}
 	if (verbosity >= 2) {
-		fprintf(stderr, "downsample_passes = %d (= # of fifth_order() iterations), downsample = %d\n", dm->downsample_passes, dm->downsample );
+		fprintf(stderr, "downsample_passes = %d (= # of cic5_decimate() iterations), downsample = %d\n", dm->downsample_passes, dm->downsample );
 	}
 	capture_freq = freq;
 	capture_rate = dm->downsample * dm->rate_in;
@@ -1507,13 +2420,13 @@ static void optimal_settings(uint64_t freq, uint32_t rate)
 
 static void *controller_thread_fn(void *arg)
 {
-	/* thoughts for multiple dongles
-	 * might be no good using a controller thread if retune/rate blocks
-	 */
+	/* one per receiver: retune/rate calls block only their own device */
 	int i, r, execWaitHop = 1;
 	int32_t if_band_center_freq = 0;
 	struct controller_state *s = arg;
 	struct cmd_state *c = s->cmd;
+	struct dongle_state *dg = s->dongle;
+	struct demod_state *dm = s->demod;
 
 	if (s->wb_mode) {
 		if (verbosity)
@@ -1524,50 +2437,59 @@ static void *controller_thread_fn(void *arg)
 
 	/* set up primary channel */
 	if (c->filename) {
-		dongle.mute = dongle.rate; /* over a second - until parametrized the dongle */
-		toNextCmdLine(c);
+		dg->mute = dg->rate; /* over a second - until parametrized the dongle */
+		cmd_next(c);
 		/*fprintf(stderr, "\nswitched to next command line. new freq %u\n", c->freq);*/
 		s->freqs[0] = c->freq;
 		execWaitHop = 0;
 	}
 
-	optimal_settings(s->freqs[0], demod.rate_in);
-	if (dongle.direct_sampling) {
-		verbose_direct_sampling(dongle.dev, 1);}
-	if (dongle.offset_tuning) {
-		verbose_offset_tuning(dongle.dev);}
+	optimal_settings(s, s->freqs[0], dm->rate_in);
+	if (!dg->dev) {
+		/* replay: no device to set up */
+		fprintf(stderr, "Oversampling input by: %ix.\n", dm->downsample);
+		fprintf(stderr, "Capture at %u Hz, %.3f MHz. Output at %u Hz.\n",
+			dg->rate, dg->freq * 1E-6, dm->rate_in/dm->post_downsample);
+		while (!do_exit)
+			safe_cond_wait(&s->hop, &s->hop_m);
+		return 0;
+	}
+	if (dg->direct_sampling) {
+		verbose_direct_sampling(dg->dev, 1);}
+	if (dg->offset_tuning) {
+		verbose_offset_tuning(dg->dev);}
 
 	/* Set the frequency */
 	if (verbosity) {
-		fprintf(stderr, "verbose_set_frequency(%f MHz)\n", dongle.userFreq * 1E-6);
-		if (!dongle.offset_tuning)
+		fprintf(stderr, "verbose_set_frequency(%f MHz)\n", dg->userFreq * 1E-6);
+		if (!dg->offset_tuning)
 			fprintf(stderr, "  frequency is away from parametrized one, to avoid negative impact from dc\n");
 	}
-	verbose_set_frequency(dongle.dev, dongle.freq);
-	fprintf(stderr, "Oversampling input by: %ix.\n", demod.downsample);
-	fprintf(stderr, "Oversampling output by: %ix.\n", demod.post_downsample);
+	verbose_set_frequency(dg->dev, dg->freq);
+	fprintf(stderr, "Oversampling input by: %ix.\n", dm->downsample);
+	fprintf(stderr, "Oversampling output by: %ix.\n", dm->post_downsample);
 	fprintf(stderr, "Buffer size: %0.2fms\n",
-		1000 * 0.5 * (float)ACTUAL_BUF_LENGTH / (float)dongle.rate);
+		1000 * 0.5 * (float)ACTUAL_BUF_LENGTH / (float)dg->rate);
 
 	/* Set the sample rate */
 	if (verbosity)
-		fprintf(stderr, "verbose_set_sample_rate(%.0f Hz)\n", (double)dongle.rate);
-	verbose_set_sample_rate(dongle.dev, dongle.rate);
-	fprintf(stderr, "Output at %u Hz.\n", demod.rate_in/demod.post_downsample);
-
-	if ( dongle.bandwidth ) {
-		if_band_center_freq = dongle.userFreq - dongle.freq;
-		if (dongle.bccorner < 0)
-			if_band_center_freq += ( dongle.bandwidth - demod.rate_out ) / 2;
-		else if (dongle.bccorner > 0)
-			if_band_center_freq -= ( dongle.bandwidth - demod.rate_out ) / 2;
-
-		if ( prev_if_band_center_freq != if_band_center_freq ) {
-			r = rtlsdr_set_tuner_band_center(dongle.dev, if_band_center_freq );
+		fprintf(stderr, "verbose_set_sample_rate(%.0f Hz)\n", (double)dg->rate);
+	verbose_set_sample_rate(dg->dev, dg->rate);
+	fprintf(stderr, "Output at %u Hz.\n", dm->rate_in/dm->post_downsample);
+
+	if ( dg->bandwidth ) {
+		if_band_center_freq = dg->userFreq - dg->freq;
+		if (dg->bccorner < 0)
+			if_band_center_freq += ( dg->bandwidth - dm->rate_out ) / 2;
+		else if (dg->bccorner > 0)
+			if_band_center_freq -= ( dg->bandwidth - dm->rate_out ) / 2;
+
+		if ( s->prev_if_band_center_freq != if_band_center_freq ) {
+			r = rtlsdr_set_tuner_band_center(dg->dev, if_band_center_freq );
 			if (r)
 				fprintf(stderr, "WARNING: Failed to set band center.\n");
 			else {
-				prev_if_band_center_freq = if_band_center_freq;
+				s->prev_if_band_center_freq = if_band_center_freq;
 				if (verbosity)
 					fprintf(stderr, "rtlsdr_set_tuner_band_center(%.0f Hz) successful\n", (double)if_band_center_freq);
 			}
@@ -1584,49 +2506,50 @@ static void *controller_thread_fn(void *arg)
 		if (!c->filename) {
 			/* hacky hopping */
 			s->freq_now = (s->freq_now + 1) % s->freq_len;
-			optimal_settings(s->freqs[s->freq_now], demod.rate_in);
-			rtlsdr_set_center_freq64(dongle.dev, dongle.freq);
-			if ( dongle.bandwidth ) {
-				if_band_center_freq = dongle.userFreq - dongle.freq;
-				if ( prev_if_band_center_freq != if_band_center_freq ) {
-					r = rtlsdr_set_tuner_band_center(dongle.dev, if_band_center_freq );
+			optimal_settings(s, s->freqs[s->freq_now], dm->rate_in);
+			rtlsdr_set_center_freq64(dg->dev, dg->freq);
+			if ( dg->bandwidth ) {
+				if_band_center_freq = dg->userFreq - dg->freq;
+				if ( s->prev_if_band_center_freq != if_band_center_freq ) {
+					r = rtlsdr_set_tuner_band_center(dg->dev, if_band_center_freq );
 					if (r)
 						fprintf(stderr, "WARNING: Failed to set band center.\n");
 					else {
-						prev_if_band_center_freq = if_band_center_freq;
+						s->prev_if_band_center_freq = if_band_center_freq;
 						if (verbosity)
 							fprintf(stderr, "rtlsdr_set_tuner_band_center(%.0f Hz) successful\n", (double)if_band_center_freq);
 					}
 				}
 			}
-			dongle.mute = DEFAULT_BUFFER_DUMP;
+			dg->mute = DEFAULT_BUFFER_DUMP;
+			dg->tune_gen++;
 		} else {
-			dongle.mute = 2 * dongle.rate; /* over a second - until parametrized the dongle */
-			c->numSummed = 0;
+			dg->mute = 2 * dg->rate; /* over a second - until parametrized the dongle */
+			c->cur.numSummed = 0;
 
-			toNextCmdLine(c);
+			cmd_next(c);
 
-			optimal_settings(c->freq, demod.rate_in);
+			optimal_settings(s, c->freq, dm->rate_in);
 			/* 1- set center frequency */
-			if (c->prevFreq != dongle.freq) {
-				rtlsdr_set_center_freq64(dongle.dev, dongle.freq);
-				c->prevFreq = dongle.freq;
+			if (c->prevFreq != dg->freq) {
+				rtlsdr_set_center_freq64(dg->dev, dg->freq);
+				c->prevFreq = dg->freq;
 			}
 			/* 2- Set the tuner gain */
 			if (c->prevGain != c->gain) {
 				if (c->gain == AUTO_GAIN) {
-					r = rtlsdr_set_tuner_gain_mode(dongle.dev, 0);
+					r = rtlsdr_set_tuner_gain_mode(dg->dev, 0);
 					if (r != 0)
 						fprintf(stderr, "WARNING: Failed to set automatic tuner gain.\n");
 					else
 						c->prevGain = c->gain;
 				} else {
-					c->gain = nearest_gain(dongle.dev, c->gain);
-					r = rtlsdr_set_tuner_gain_mode(dongle.dev, 1);
+					c->gain = nearest_gain(dg->dev, c->gain);
+					r = rtlsdr_set_tuner_gain_mode(dg->dev, 1);
 					if (r < 0)
 						fprintf(stderr, "WARNING: Failed to enable manual gain.\n");
 					else {
-						r = rtlsdr_set_tuner_gain(dongle.dev, c->gain);
+						r = rtlsdr_set_tuner_gain(dg->dev, c->gain);
 						if (r != 0)
 							fprintf(stderr, "WARNING: Failed to set tuner gain.\n");
 						else
@@ -1635,44 +2558,46 @@ static void *controller_thread_fn(void *arg)
 				}
 			}
 			/* 3- Set tuner bandwidth */
-			if (c->prevBandwidth != dongle.bandwidth) {
-				r = rtlsdr_set_tuner_bandwidth(dongle.dev, dongle.bandwidth);
+			if (c->prevBandwidth != dg->bandwidth) {
+				r = rtlsdr_set_tuner_bandwidth(dg->dev, dg->bandwidth);
 				if (r < 0)
 					fprintf(stderr, "WARNING: Failed to set bandwidth.\n");
 				else
-					c->prevBandwidth = dongle.bandwidth;
+					c->prevBandwidth = dg->bandwidth;
 			}
 			/*  */
-			if ( dongle.bandwidth ) {
-				if_band_center_freq = dongle.userFreq - dongle.freq;
-				if ( prev_if_band_center_freq != if_band_center_freq ) {
-					r = rtlsdr_set_tuner_band_center(dongle.dev, if_band_center_freq );
+			if ( dg->bandwidth ) {
+				if_band_center_freq = dg->userFreq - dg->freq;
+				if ( s->prev_if_band_center_freq != if_band_center_freq ) {
+					r = rtlsdr_set_tuner_band_center(dg->dev, if_band_center_freq );
 					if (r)
 						fprintf(stderr, "WARNING: Failed to set band center.\n");
 					else {
-						prev_if_band_center_freq = if_band_center_freq;
+						s->prev_if_band_center_freq = if_band_center_freq;
 						if (verbosity)
 							fprintf(stderr, "rtlsdr_set_tuner_band_center(%.0f Hz) successful\n", (double)if_band_center_freq);
 					}
 				}
 			}
 			/* 4- Set ADC samplerate *
-			r = rtlsdr_set_sample_rate(dongle.dev, dongle.rate);
+			r = rtlsdr_set_sample_rate(dg->dev, dg->rate);
 			if (r < 0)
 				fprintf(stderr, "WARNING: Failed to set sample rate.\n");
 			*/
 
-			c->levelSum = 0;
-			c->numSummed = 0;
+			c->cur.levelSum = 0;
+			c->cur.levelPeak = 0;
+			c->cur.numSummed = 0;
 			/* reset DC filters */
-			demod.dc_avg = 0;
-			demod.dc_avgI = 0;
-			demod.dc_avgQ = 0;
-			dongle.mute = BufferDump;
+			dm->dc_avg = 0;
+			dm->dc_avgI = 0;
+			dm->dc_avgQ = 0;
+			dg->mute = BufferDump;
 			/* reset adc max and power */
-			dongle.samplePowSum = 0.0;
-			dongle.samplePowCount = 0;
-			dongle.sampleMax = 0;
+			dg->samplePowSum = 0.0;
+			dg->samplePowCount = 0;
+			dg->sampleMax = 0;
+			dg->tune_gen++;
 		}
 
 	}
@@ -1704,6 +2629,10 @@ void dongle_init(struct dongle_state *s)
 	s->rate = DEFAULT_SAMPLE_RATE;
 	s->gain = AUTO_GAIN; /* tenths of a dB */
 	s->mute = 0;
+	s->tune_gen = 0;
+	s->replay_file = NULL;
+	s->replay_bits = 0;
+	s->replay_rate = 0;
 	s->direct_sampling = 0;
 	s->offset_tuning = 0;
 	s->demod_target = &demod;
@@ -1717,24 +2646,39 @@ void dongle_init(struct dongle_state *s)
 
 void demod_init(struct demod_state *s)
 {
+	int i;
 	s->rate_in = DEFAULT_SAMPLE_RATE;
 	s->rate_out = DEFAULT_SAMPLE_RATE;
 	s->squelch_level = 0;
 	s->conseq_squelch = 10;
 	s->terminate_on_squelch = 0;
 	s->squelch_hits = 11;
+	memset(&s->sq, 0, sizeof(s->sq));
+	s->sq.attack_ms = SQUELCH_ATTACK_MS;
+	s->sq.release_ms = SQUELCH_RELEASE_MS;
 	s->downsample_passes = 0;
 	s->comp_fir_size = 0;
+	for (i = 0; i < CIC_TABLE_MAX; i++)
+		cic5_init(&s->lp_cic[i]);
+	memset(&s->droop, 0, sizeof(s->droop));
+	s->droop_passes = 0;
 	s->prev_index = 0;
 	s->post_downsample = 1;	// once this works, default = 4
 	s->custom_atan = 0;
 	s->deemph = 0;
+	s->deemph_avg = 0;
 	s->rate_out2 = -1;	// flag for disabled
 	s->mode_demod = &fm_demod;
-	s->pre_j = s->pre_r = s->now_r = s->now_j = 0;
-	s->prev_lpr_index = 0;
+	s->use_float = FLOAT_OFF;
+	s->mode_demod_f = NULL;
+	s->chain_len = 0;
+	memset(&s->scan, 0, sizeof(s->scan));
+	s->scan.active = -1;
+	s->deemph_avgf = s->dc_avgf = 0.0f;
+	s->now_r = s->now_j = 0;
+	memset(&s->disc, 0, sizeof(s->disc));
 	s->deemph_a = 0;
-	s->now_lpr = 0;
+	memset(&s->resamp, 0, sizeof(s->resamp));
 	s->dc_block_audio = 0;
 	s->dc_avg = 0;
 	s->adc_block_const = 9;
@@ -1742,33 +2686,60 @@ void demod_init(struct demod_state *s)
 	s->dc_avgI = 0;
 	s->dc_avgQ = 0;
 	s->rdc_block_const = 9;
-	pthread_rwlock_init(&s->rw, NULL);
-	pthread_cond_init(&s->ready, NULL);
-	pthread_mutex_init(&s->ready_m, NULL);
+	s->lowpassed = s->result = NULL;
+	s->resultf = NULL;
+	s->result_cap = 0;
+	if (block_queue_init(&s->queue, "demod", 0) < 0) {
+		fprintf(stderr, "Failed to allocate demod queue\n");
+		exit(1);
+	}
+	s->skip_stale = 0;
+	s->stale_gen = 0;
 	s->output_target = &output;
 	s->cmd = &cmd;
+	s->dongle = &dongle;
+	s->controller = &controller;
+	s->printLevelNo = 1;
+	s->levelMax = s->levelMaxMax = 0;
+	s->levelSum = 0.0;
+	s->printBlockLen = 1;
 }
 
 void demod_cleanup(struct demod_state *s)
 {
-	pthread_rwlock_destroy(&s->rw);
-	pthread_cond_destroy(&s->ready);
-	pthread_mutex_destroy(&s->ready_m);
+	cfir_free(&s->droop);
+	resampler_free(&s->resamp);
+	fmdisc_free(&s->disc);
+	if (s->scan.enabled) {
+		chan_power_free(&s->scan.cp);
+		free(s->scan.freqs);
+		free(s->scan.offsets);
+		free(s->scan.first);
+	}
+	block_queue_report(&s->queue);
+	block_queue_cleanup(&s->queue);
+	free(s->lowpassed);
+	free(s->result);
+	free(s->resultf);
 }
 
 void output_init(struct output_state *s)
 {
 	s->rate = DEFAULT_SAMPLE_RATE;
-	pthread_rwlock_init(&s->rw, NULL);
-	pthread_cond_init(&s->ready, NULL);
-	pthread_mutex_init(&s->ready_m, NULL);
+	s->lat_num = s->lat_max = s->lat_min = 0;
+	s->lat_sum = 0.0;
+	s->win_num = s->win_max = s->win_start = 0;
+	s->win_sum = 0.0;
+	if (block_queue_init(&s->queue, "output", 0) < 0) {
+		fprintf(stderr, "Failed to allocate output queue\n");
+		exit(1);
+	}
 }
 
 void output_cleanup(struct output_state *s)
 {
-	pthread_rwlock_destroy(&s->rw);
-	pthread_cond_destroy(&s->ready);
-	pthread_mutex_destroy(&s->ready_m);
+	block_queue_report(&s->queue);
+	block_queue_cleanup(&s->queue);
 }
 
 void controller_init(struct controller_state *s)
@@ -1780,6 +2751,10 @@ void controller_init(struct controller_state *s)
 	pthread_cond_init(&s->hop, NULL);
 	pthread_mutex_init(&s->hop_m, NULL);
 	s->cmd = &cmd;
+	s->dongle = &dongle;
+	s->demod = &demod;
+	s->min_capture_rate = MinCaptureRate;
+	s->prev_if_band_center_freq = 0;
 }
 
 void controller_cleanup(struct controller_state *s)
@@ -1788,19 +2763,249 @@ void controller_cleanup(struct controller_state *s)
 	pthread_mutex_destroy(&s->hop_m);
 }
 
-void sanity_checks(void)
+static int cmp_freq(const void *a, const void *b)
+{
+	uint32_t fa = *(const uint32_t *)a, fb = *(const uint32_t *)b;
+	return (fa > fb) - (fa < fb);
+}
+
+/* raise the capture rate to hold a span of channels, up to SCAN_MAX_CAPTURE.
+ * returns the span of channel centers fitting into one capture */
+static double capture_plan(struct demod_state *d, struct controller_state *cs, double span, int *downsample)
+{
+	int ds, passes;
+	double need, usable;
+	need = (span + d->rate_in) / SCAN_USABLE;
+	if (need > SCAN_MAX_CAPTURE)
+		need = SCAN_MAX_CAPTURE;
+	if (need > cs->min_capture_rate)
+		cs->min_capture_rate = (int)need;
+	/* capture rate as optimal_settings() will choose it */
+	ds = (cs->min_capture_rate + d->rate_in - 1) / d->rate_in;
+	if (ds < 1)
+		ds = 1;
+	if (d->downsample_passes) {
+		passes = 1;
+		while ((1 << passes) < ds && passes < CIC_TABLE_MAX)
+			passes++;
+		if ((1 << passes) * d->rate_in > SCAN_MAX_CAPTURE && passes > 1)
+			passes--;
+		ds = 1 << passes;
+		cs->min_capture_rate = ds * d->rate_in;
+	}
+	usable = (double)ds * d->rate_in * SCAN_USABLE - d->rate_in;
+	if (usable < 0.0)
+		usable = 0.0;
+	*downsample = ds;
+	return usable;
+}
+
+/* fft length for bins of ~1/4 channel */
+static int capture_fft_len(int downsample)
+{
+	int n = 256;
+	while (n < 4 * downsample && n < 8192)
+		n <<= 1;
+	return n;
+}
+
+/* -E pscan: raise the capture rate to hold the channel list,
+ * split it into captures and replace controller.freqs[] with their centers */
+static void scan_setup(struct demod_state *d, struct controller_state *cs)
+{
+	struct scan_state *sc = &d->scan;
+	int i, g, ds, n;
+	uint32_t lo;
+	double usable;
+	if (!sc->enabled || !cs->freq_len)
+		return;
+	if (d->cmd->filename) {
+		fprintf(stderr, "Parallel scan doesn't support a command file\n");
+		exit(1);
+	}
+	sc->num = cs->freq_len;
+	sc->freqs = malloc(sizeof(uint32_t) * sc->num);
+	sc->offsets = malloc(sizeof(int32_t) * sc->num);
+	sc->first = malloc(sizeof(int) * (sc->num + 1));
+	if (!sc->freqs || !sc->offsets || !sc->first) {
+		fprintf(stderr, "Failed to allocate scan list\n");
+		exit(1);
+	}
+	memcpy(sc->freqs, cs->freqs, sizeof(uint32_t) * sc->num);
+	qsort(sc->freqs, sc->num, sizeof(uint32_t), cmp_freq);
+
+	usable = capture_plan(d, cs, sc->freqs[sc->num - 1] - sc->freqs[0], &ds);
+
+	/* greedy grouping of the sorted list */
+	g = 0;
+	sc->first[0] = 0;
+	lo = sc->freqs[0];
+	for (i = 1; i <= sc->num; i++) {
+		if (i < sc->num && sc->freqs[i] - lo <= usable)
+			continue;
+		cs->freqs[g] = lo + (sc->freqs[i-1] - lo) / 2;
+		sc->first[++g] = i;
+		if (i < sc->num)
+			lo = sc->freqs[i];
+	}
+	for (g = 0; sc->first[g] < sc->num; g++) {
+		for (i = sc->first[g]; i < sc->first[g+1]; i++) {
+			sc->offsets[i] = (int32_t)(sc->freqs[i] - cs->freqs[g]);}
+	}
+	cs->freq_len = g;
+	cs->freq_now = 0;
+
+	n = capture_fft_len(ds);
+	if (chan_power_init(&sc->cp, n) < 0) {
+		fprintf(stderr, "Failed to set up channel power fft\n");
+		exit(1);
+	}
+	chan_mixer_set(&sc->mixer, 0.0);
+	sc->active = -1;
+	if (verbosity)
+		fprintf(stderr, "parallel scan: %d channels in %d captures of %d Hz, fft length %d\n",
+			sc->num, cs->freq_len, ds * d->rate_in, n);
+}
+
+/* -E cgroup: raise the capture rate to hold the command file's frequencies
+ * and group its lines into captures, measured concurrently */
+static void cmd_group_setup(struct demod_state *d, struct controller_state *cs)
+{
+	struct cmd_state *c = d->cmd;
+	uint64_t lo, hi;
+	double usable;
+	int k, ds;
+	if (!c->grouped || !c->filename)
+		return;
+	c->groupSpan = 0.0;
+	if (!cmd_load(c))
+		exit(1);
+	lo = hi = c->lines[0].freq;
+	for (k = 1; k < c->numLines; k++) {
+		if (c->lines[k].freq < lo)
+			lo = c->lines[k].freq;
+		if (c->lines[k].freq > hi)
+			hi = c->lines[k].freq;
+	}
+	usable = capture_plan(d, cs, (double)(hi - lo), &ds);
+	/* the tuner filter limits the capture */
+	if (d->dongle->bandwidth && usable > d->dongle->bandwidth * SCAN_USABLE - d->rate_in)
+		usable = d->dongle->bandwidth * SCAN_USABLE - d->rate_in;
+	c->groupSpan = usable > 0.0 ? usable : 0.0;
+	if (!cmd_load(c))
+		exit(1);
+	c->group = -1;
+	if (chan_power_init(&c->cp, capture_fft_len(ds)) < 0) {
+		fprintf(stderr, "Failed to set up channel power fft\n");
+		exit(1);
+	}
+	if (verbosity)
+		fprintf(stderr, "command file: %d lines in %d captures of %d Hz, fft length %d\n",
+			c->numLines, c->numGroups, ds * d->rate_in, c->cp.n);
+}
+
+static void receiver_link(struct receiver *r)
+{
+	r->dongle->demod_target = r->demod;
+	r->demod->output_target = r->output;
+	r->demod->cmd = r->cmd;
+	r->demod->dongle = r->dongle;
+	r->demod->controller = r->controller;
+	r->controller->cmd = r->cmd;
+	r->controller->dongle = r->dongle;
+	r->controller->demod = r->demod;
+}
+
+/* for each further -d: a receiver with its own device and -f frequencies */
+static struct receiver *receiver_add(void)
+{
+	struct receiver *r;
+	if (rx_num >= MAX_RECEIVERS) {
+		fprintf(stderr, "Too many devices, maximum %i.\n", MAX_RECEIVERS);
+		exit(1);
+	}
+	r = &rx[rx_num];
+	r->dongle = calloc(1, sizeof(struct dongle_state));
+	r->demod = calloc(1, sizeof(struct demod_state));
+	r->output = calloc(1, sizeof(struct output_state));
+	r->controller = calloc(1, sizeof(struct controller_state));
+	r->cmd = calloc(1, sizeof(struct cmd_state));
+	if (!r->dongle || !r->demod || !r->output || !r->controller || !r->cmd) {
+		fprintf(stderr, "Failed to allocate receiver\n");
+		exit(1);
+	}
+	dongle_init(r->dongle);
+	controller_init(r->controller);
+	cmd_init(r->cmd);
+	rx_num++;
+	return r;
+}
+
+/* sized from the block length, which is final once the capture rate is known.
+ * the demod buffers are swapped with the queue's blocks, so they get the same size */
+static int receiver_alloc_buffers(struct receiver *r)
+{
+	struct demod_state *d = r->demod;
+	int len = (int)r->dongle->buf_len;
+	d->result_cap = len;
+	if (d->rate_out2 > 0 && resampler_max_output(&d->resamp, len) > len)
+		d->result_cap = resampler_max_output(&d->resamp, len);
+	d->lowpassed = malloc(len * sizeof(int16_t));
+	d->result = malloc(d->result_cap * sizeof(int16_t));
+	if (d->use_float != FLOAT_OFF)
+		d->resultf = malloc(d->result_cap * sizeof(float));
+	if (!d->lowpassed || !d->result || (d->use_float != FLOAT_OFF && !d->resultf))
+		return -1;
+	if (block_queue_alloc(&d->queue, len) < 0
+	 || block_queue_alloc(&r->output->queue, d->result_cap) < 0)
+		return -1;
+	return 0;
+}
+
+/* copy all other options from the 1st receiver, once they are parsed */
+static void receiver_clone(struct receiver *r, const struct receiver *src)
+{
+	int dev_index = r->dongle->dev_index;
+	*r->dongle = *src->dongle;
+	r->dongle->dev_index = dev_index;
+	r->dongle->dev = NULL;
+	*r->demod = *src->demod;
+	*r->output = *src->output;
+	if (block_queue_init(&r->demod->queue, "demod", src->demod->queue.blocking) < 0
+	 || block_queue_init(&r->output->queue, "output", src->output->queue.blocking) < 0) {
+		fprintf(stderr, "Failed to allocate queues\n");
+		exit(1);
+	}
+	r->controller->edge = src->controller->edge;
+	r->controller->wb_mode = src->controller->wb_mode;
+	receiver_link(r);
+}
+
+static void receiver_free(struct receiver *r)
 {
-	if (controller.freq_len == 0) {
+	if (r->dongle == &dongle)
+		return;
+	free(r->dongle);
+	free(r->demod);
+	free(r->output);
+	free(r->controller);
+	free(r->cmd);
+}
+
+void sanity_checks(struct receiver *r)
+{
+	struct controller_state *cs = r->controller;
+	if (cs->freq_len == 0) {
 		fprintf(stderr, "Please specify a frequency.\n");
 		exit(1);
 	}
 
-	if (controller.freq_len >= FREQUENCIES_LIMIT) {
+	if (cs->freq_len >= FREQUENCIES_LIMIT) {
 		fprintf(stderr, "Too many channels, maximum %i.\n", FREQUENCIES_LIMIT);
 		exit(1);
 	}
 
-	if (controller.freq_len > 1 && demod.squelch_level == 0) {
+	if (cs->freq_len > 1 && r->demod->squelch_level == 0) {
 		fprintf(stderr, "Please specify a squelch level.  Required for scanning multiple frequencies.\n");
 		exit(1);
 	}
@@ -1812,8 +3017,9 @@ int main(int argc, char **argv)
 #ifndef _WIN32
 	struct sigaction sigact;
 #endif
-	int r, opt;
+	int r = 0, opt, i;
 	int dev_given = 0;
+	int buf_len_given = 0;
 	int writeWav = 0;
 	int custom_ppm = 0;
 	int enable_biastee = 0;
@@ -1822,33 +3028,50 @@ int main(int argc, char **argv)
 	uint32_t ds_temp, ds_threshold = 0;
 	int timeConstant = 75; /* default: U.S. 75 uS */
 	int rtlagc = 0;
+	const char * replayName = NULL;
+	const char * measTarget = NULL;
+	char *sqArg;
+	int measFormat = MEAS_BINARY;
+	struct receiver *cur = &rx[0];	/* receiver of the last -d */
 	dongle_init(&dongle);
 	demod_init(&demod);
 	output_init(&output);
 	controller_init(&controller);
 	cmd_init(&cmd);
-
-	while ((opt = getopt(argc, argv, "d:f:g:s:b:l:o:t:r:p:R:E:O:F:A:M:hTC:B:m:L:q:c:w:W:D:nHv")) != -1) {
+	meas.fd = -1;
+	rx[0].dongle = &dongle;
+	rx[0].demod = &demod;
+	rx[0].output = &output;
+	rx[0].controller = &controller;
+	rx[0].cmd = &cmd;
+	receiver_link(&rx[0]);
+
+	while ((opt = getopt(argc, argv, "d:f:g:s:b:l:o:t:r:p:R:E:O:F:A:M:hTC:e:B:m:L:S:q:c:w:W:D:I:nHv")) != -1) {
 		switch (opt) {
 		case 'd':
-			dongle.dev_index = verbose_device_search(optarg);
+			if (dev_given)
+				cur = receiver_add();
+			cur->dongle->dev_index = verbose_device_search(optarg);
 			dev_given = 1;
 			break;
 		case 'f':
-			if (controller.freq_len >= FREQUENCIES_LIMIT) {
+			if (cur->controller->freq_len >= FREQUENCIES_LIMIT) {
 				break;}
 			if (strchr(optarg, ':'))
-				{frequency_range(&controller, optarg);}
+				{frequency_range(cur->controller, optarg);}
 			else
 			{
-				controller.freqs[controller.freq_len] = (uint32_t)atofs(optarg);
-				controller.freq_len++;
+				cur->controller->freqs[cur->controller->freq_len] = (uint32_t)atofs(optarg);
+				cur->controller->freq_len++;
 			}
 			break;
 		case 'C':
 			cmd.filename = optarg;
 			demod.mode_demod = &raw_demod;
 			break;
+		case 'e':
+			cmd.triggerSink = optarg;
+			break;
 		case 'm':
 			MinCaptureRate = (int)atofs(optarg);
 			break;
@@ -1863,10 +3086,26 @@ int main(int argc, char **argv)
 			break;
 		case 'l':
 			demod.squelch_level = (int)atof(optarg);
+			/* open:close[:attack:release] */
+			sqArg = strchr(optarg, ':');
+			if (sqArg) {
+				demod.sq.enabled = 1;
+				demod.sq.close_level = (int)atof(++sqArg);
+				if (demod.sq.close_level > demod.squelch_level)
+					demod.sq.close_level = demod.squelch_level;
+				if ((sqArg = strchr(sqArg, ':')) != NULL) {
+					demod.sq.attack_ms = atof(++sqArg);
+					if ((sqArg = strchr(sqArg, ':')) != NULL)
+						demod.sq.release_ms = atof(++sqArg);
+				}
+			}
 			break;
 		case 'L':
 			printLevels = (int)atof(optarg);
 			break;
+		case 'S':
+			measTarget = optarg;
+			break;
 		case 's':
 			demod.rate_in = (uint32_t)atofs(optarg);
 			demod.rate_out = (uint32_t)atofs(optarg);
@@ -1914,6 +3153,25 @@ int main(int argc, char **argv)
 				dongle.direct_sampling = 1;}
 			if (strcmp("offset",  optarg) == 0) {
 				dongle.offset_tuning = 1;}
+			if (strcmp("float", optarg) == 0 && !demod.use_float) {
+				demod.use_float = FLOAT_PROCESS;}
+			if (strcmp("f32", optarg) == 0) {
+				demod.use_float = FLOAT_OUTPUT;}
+			if (strcmp("lowlat", optarg) == 0) {
+				low_latency = 1;}
+			if (strcmp("pscan", optarg) == 0) {
+				demod.scan.enabled = 1;}
+			if (strcmp("cgroup", optarg) == 0) {
+				cmd.grouped = 1;}
+			if (strcmp("sqskip", optarg) == 0) {
+				demod.sq.skip_demod = 1;}
+			if (strcmp("ndjson", optarg) == 0) {
+				measFormat = MEAS_NDJSON;}
+			if (strcmp("profile", optarg) == 0) {
+				profiling = 1;}
+			if (strcmp("lossless", optarg) == 0) {
+				demod.queue.blocking = 1;
+				output.queue.blocking = 1;}
 			if (strcmp("rtlagc", optarg) == 0 || strcmp("agc", optarg) == 0) {
 				rtlagc = 1;}
 			if (strcmp("bclo", optarg) == 0 || strcmp("bcL", optarg) == 0 || strcmp("bcl", optarg) == 0) {
@@ -1934,15 +3192,13 @@ int main(int argc, char **argv)
 			demod.comp_fir_size = atoi(optarg);
 			break;
 		case 'A':
-			if (strcmp("std",  optarg) == 0) {
-				demod.custom_atan = 0;}
-			if (strcmp("fast", optarg) == 0) {
-				demod.custom_atan = 1;}
-			if (strcmp("lut",  optarg) == 0) {
-				atan_lut_init();
-				demod.custom_atan = 2;}
-			if (strcmp("ale", optarg) == 0) {
-				demod.custom_atan = 3;}
+			if (strcmp("bench", optarg) == 0) {
+				fmdisc_benchmark(stderr, 65536);
+				exit(0);}
+			for (i = 0; i < FMDISC_NUM_MODES; i++) {
+				if (strcmp(fmdisc_mode_name((enum fmdisc_mode)i), optarg) == 0) {
+					demod.custom_atan = i;}
+			}
 			break;
 		case 'M':
 			if (strcmp("nbfm",  optarg) == 0 || strcmp("nfm",  optarg) == 0 || strcmp("fm",  optarg) == 0) {
@@ -1965,7 +3221,8 @@ int main(int argc, char **argv)
 				demod.custom_atan = 1;
 				//demod.post_downsample = 4;
 				demod.deemph = 1;
-				demod.squelch_level = 0;}
+				demod.squelch_level = 0;
+				demod.sq.enabled = 0;}
 			break;
 		case 'T':
 			enable_biastee = 1;
@@ -1988,6 +3245,9 @@ int main(int argc, char **argv)
 		case 'H':
 			writeWav = 1;
 			break;
+		case 'I':
+			replayName = optarg;
+			break;
 		case 'v':
 			++verbosity;
 			break;
@@ -1998,6 +3258,7 @@ int main(int argc, char **argv)
 			dongle.buf_len = 512 * atoi(optarg);
 			if (dongle.buf_len > MAXIMUM_BUF_LENGTH)
 				dongle.buf_len = MAXIMUM_BUF_LENGTH;
+			buf_len_given = 1;
 			break;
 		case 'h':
 		case '?':
@@ -2010,38 +3271,148 @@ int main(int argc, char **argv)
 	if (verbosity)
 		fprintf(stderr, "verbosity set to %d\n", verbosity);
 
-	/* quadruple sample_rate to limit to Δθ to ±π/2 */
-	demod.rate_in *= demod.post_downsample;
+	/* the wave header state of wavewrite.c exists once per process */
+	if (rx_num > 1 && (replayName || cmd.filename || profiling || writeWav)) {
+		fprintf(stderr, "Several devices don't support -I, -C, -H or -E profile\n");
+		exit(1);
+	}
+	for (i = 1; i < rx_num; i++) {
+		receiver_clone(&rx[i], &rx[0]);}
 
-	if (!output.rate) {
-		output.rate = demod.rate_out;}
+	for (i = 0; i < rx_num; i++) {
+		struct demod_state *dm = rx[i].demod;
+		struct output_state *out = rx[i].output;
 
-	sanity_checks();
+		/* quadruple sample_rate to limit to Δθ to ±π/2 */
+		dm->rate_in *= dm->post_downsample;
 
-	if (controller.freq_len > 1) {
-		demod.terminate_on_squelch = 0;}
+		if (!out->rate) {
+			out->rate = dm->rate_out;}
 
-	if (optind < argc) {
-		output.filename = argv[optind];
-	} else {
-		output.filename = "-";
-	}
+		if (dm->rate_out2 == dm->rate_out) {
+			dm->rate_out2 = -1;}
+		if (dm->rate_out2 > 0) {
+			r = resampler_init(&dm->resamp, dm->rate_out, dm->rate_out2, 0);
+			if (r < 0) {
+				fprintf(stderr, "Failed to set up resampling from %d Hz to %d Hz\n", dm->rate_out, dm->rate_out2);
+				exit(1);
+			}
+			if (r > 0 && !i)
+				fprintf(stderr, "Warning: resampling to %.1f Hz instead of %d Hz\n", dm->resamp.rate_out, dm->rate_out2);
+			if (verbosity && !i)
+				fprintf(stderr, "resampling %d Hz -> %d Hz with %d phases x %d taps, decimation %d\n",
+					dm->rate_out, dm->rate_out2, dm->resamp.L, dm->resamp.taps, dm->resamp.M);
+		}
 
-	ACTUAL_BUF_LENGTH = lcm_post[demod.post_downsample] * DEFAULT_BUF_LENGTH;
+		if (fmdisc_init(&dm->disc, (enum fmdisc_mode)dm->custom_atan) < 0) {
+			fprintf(stderr, "Failed to set up fm discriminator\n");
+			exit(1);
+		}
+		if (verbosity && !i && dm->mode_demod == &fm_demod)
+			fprintf(stderr, "fm discriminator: %s\n", fmdisc_mode_name(dm->disc.mode));
+
+		if (dm->use_float) {
+			if (dm->mode_demod == &fm_demod)
+				dm->mode_demod_f = &fm_demod_f;
+			else if (dm->mode_demod == &am_demod)
+				dm->mode_demod_f = &am_demod_f;
+			else if (dm->mode_demod == &usb_demod)
+				dm->mode_demod_f = &usb_demod_f;
+			else if (dm->mode_demod == &lsb_demod)
+				dm->mode_demod_f = &lsb_demod_f;
+			else
+				dm->mode_demod_f = &raw_demod_f;
+			if (dm->use_float == FLOAT_OUTPUT)
+				block_queue_set_sample_size(&out->queue, sizeof(float));
+		}
+	}
 
-	if (!dev_given) {
-		dongle.dev_index = verbose_device_search("0");
+	if (replayName) {
+		uint32_t wrate, wfreq, wframes;
+		int wbits, wchannels;
+		int16_t wformat;
+		if (strcmp(replayName, "-") == 0) {
+			dongle.replay_file = stdin;
+#ifdef _WIN32
+			_setmode(_fileno(stdin), _O_BINARY);
+#endif
+		} else {
+			dongle.replay_file = fopen(replayName, "rb");
+			if (!dongle.replay_file) {
+				fprintf(stderr, "Failed to open %s\n", replayName);
+				exit(1);
+			}
+			if (!waveReadHeader(dongle.replay_file, &wrate, &wfreq, &wbits, &wchannels, &wframes, &wformat, verbosity)) {
+				if (wchannels != 2 || wformat != 1 || (wbits != 8 && wbits != 16)) {
+					fprintf(stderr, "Replay needs a 2 channel wave file with 8 or 16 bit PCM\n");
+					exit(1);
+				}
+				dongle.replay_bits = wbits;
+				dongle.replay_rate = wrate;
+				if (!controller.freq_len)
+					controller.freqs[controller.freq_len++] = wfreq;
+			} else {
+				rewind(dongle.replay_file);	/* raw I/Q */
+			}
+		}
+		if ((controller.freq_len > 1 && !demod.scan.enabled) || cmd.filename) {
+			fprintf(stderr, "Replay doesn't support scanning or a command file\n");
+			exit(1);
+		}
+		if (!controller.freq_len)
+			controller.freq_len = 1;	/* frequency is meaningless here */
+		demod.queue.blocking = 1;
+		output.queue.blocking = 1;
+		profiling = 1;
+	}
+
+	for (i = 0; i < rx_num; i++) {
+		rx[i].controller->min_capture_rate = MinCaptureRate;
+		scan_setup(rx[i].demod, rx[i].controller);
+		cmd_group_setup(rx[i].demod, rx[i].controller);
+		sanity_checks(&rx[i]);
+		if (rx[i].controller->freq_len > 1) {
+			rx[i].demod->terminate_on_squelch = 0;}
+	}
+	if (dongle.replay_file && controller.freq_len > 1) {
+		fprintf(stderr, "Replay doesn't support scanning over several captures\n");
+		exit(1);
 	}
 
-	if (dongle.dev_index < 0) {
+	if (rx_num > 1 && argc - optind < rx_num) {
+		fprintf(stderr, "Please specify an output file for each of the %d devices.\n", rx_num);
 		exit(1);
 	}
+	for (i = 0; i < rx_num; i++) {
+		if (optind + i < argc) {
+			rx[i].output->filename = argv[optind + i];
+		} else {
+			rx[i].output->filename = "-";
+		}
+		if (i && strcmp(rx[i].output->filename, "-") == 0 && strcmp(rx[0].output->filename, "-") == 0) {
+			fprintf(stderr, "Only one device can write to stdout.\n");
+			exit(1);
+		}
+	}
 
-	r = rtlsdr_open(&dongle.dev, (uint32_t)dongle.dev_index);
-	if (r < 0) {
-		fprintf(stderr, "Failed to open rtlsdr device #%d.\n", dongle.dev_index);
+	/* the trigger helper is forked while we are small and single threaded,
+	 * before the level stream and output files are open: the trigger commands
+	 * don't inherit them */
+	if (cmd.filename && trigger_dispatch_init(&cmd.trig, cmd.triggerSink) < 0) {
+		fprintf(stderr, "Failed to set up trigger dispatch\n");
 		exit(1);
 	}
+
+	if (measTarget) {
+		if (meas_stream_open(&meas, measTarget, measFormat) < 0)
+			exit(1);
+		/* without -L and -C: a record per block */
+		if (!printLevels && !cmd.filename)
+			printLevels = 1;
+	}
+
+	ACTUAL_BUF_LENGTH = lcm_post[demod.post_downsample] * DEFAULT_BUF_LENGTH;
+
 #ifndef _WIN32
 	sigact.sa_handler = sighandler;
 	sigemptyset(&sigact.sa_mask);
@@ -2056,140 +3427,217 @@ int main(int argc, char **argv)
 
 	if (demod.deemph) {
 		double tc = (double)timeConstant * 1e-6;
-		demod.deemph_a = (int)round(1.0/((1.0-exp(-1.0/(demod.rate_out * tc)))));
+		for (i = 0; i < rx_num; i++) {
+			rx[i].demod->deemph_a = (int)round(1.0/((1.0-exp(-1.0/(rx[i].demod->rate_out * tc)))));}
 		if (verbosity)
 			fprintf(stderr, "using wbfm deemphasis filter with time constant %d us\n", timeConstant );
 	}
 
-	/* Set the tuner gain */
-	if (dongle.gain == AUTO_GAIN) {
-		verbose_auto_gain(dongle.dev);
-	} else {
-		dongle.gain = nearest_gain(dongle.dev, dongle.gain);
-		verbose_gain_set(dongle.dev, dongle.gain);
-	}
+	for (i = 0; i < rx_num && !dongle.replay_file; i++) {
+		struct dongle_state *dg = rx[i].dongle;
+		if (!i && !dev_given) {
+			dg->dev_index = verbose_device_search("0");
+		}
 
-	rtlsdr_set_agc_mode(dongle.dev, rtlagc);
+		if (dg->dev_index < 0) {
+			exit(1);
+		}
+
+		r = rtlsdr_open(&dg->dev, (uint32_t)dg->dev_index);
+		if (r < 0) {
+			fprintf(stderr, "Failed to open rtlsdr device #%d.\n", dg->dev_index);
+			exit(1);
+		}
 
-	rtlsdr_set_bias_tee(dongle.dev, enable_biastee);
-	if (enable_biastee)
-		fprintf(stderr, "activated bias-T on GPIO PIN 0\n");
+		/* Set the tuner gain */
+		if (dg->gain == AUTO_GAIN) {
+			verbose_auto_gain(dg->dev);
+		} else {
+			dg->gain = nearest_gain(dg->dev, dg->gain);
+			verbose_gain_set(dg->dev, dg->gain);
+		}
 
-	verbose_ppm_set(dongle.dev, dongle.ppm_error);
+		rtlsdr_set_agc_mode(dg->dev, rtlagc);
 
-	/* Set direct sampling with threshold */
-	rtlsdr_set_ds_mode(dongle.dev, ds_mode, ds_threshold);
+		rtlsdr_set_bias_tee(dg->dev, enable_biastee);
+		if (enable_biastee)
+			fprintf(stderr, "activated bias-T on GPIO PIN 0\n");
 
-	verbose_set_bandwidth(dongle.dev, dongle.bandwidth);
+		verbose_ppm_set(dg->dev, dg->ppm_error);
 
-	if (verbosity && dongle.bandwidth)
-	{
-		int r;
-		uint32_t in_bw, out_bw, last_bw = 0;
-		fprintf(stderr, "Supported bandwidth values in kHz:\n");
-		for ( in_bw = 1; in_bw < 3200; ++in_bw )
+		/* Set direct sampling with threshold */
+		rtlsdr_set_ds_mode(dg->dev, ds_mode, ds_threshold);
+
+		verbose_set_bandwidth(dg->dev, dg->bandwidth);
+
+		if (verbosity && dg->bandwidth && !i)
 		{
-			r = rtlsdr_set_and_get_tuner_bandwidth(dongle.dev, in_bw*1000, &out_bw, 0 /* =apply_bw */);
-			if ( r == 0 && out_bw != 0 && ( out_bw != last_bw || in_bw == 1 ) )
-				fprintf(stderr, "%s%.1f", (in_bw==1 ? "" : ", "), out_bw/1000.0 );
-			last_bw = out_bw;
+			int r;
+			uint32_t in_bw, out_bw, last_bw = 0;
+			fprintf(stderr, "Supported bandwidth values in kHz:\n");
+			for ( in_bw = 1; in_bw < 3200; ++in_bw )
+			{
+				r = rtlsdr_set_and_get_tuner_bandwidth(dg->dev, in_bw*1000, &out_bw, 0 /* =apply_bw */);
+				if ( r == 0 && out_bw != 0 && ( out_bw != last_bw || in_bw == 1 ) )
+					fprintf(stderr, "%s%.1f", (in_bw==1 ? "" : ", "), out_bw/1000.0 );
+				last_bw = out_bw;
+			}
+			fprintf(stderr,"\n");
 		}
-		fprintf(stderr,"\n");
-	}
 
-	if (rtlOpts) {
-		rtlsdr_set_opt_string(dongle.dev, rtlOpts, verbosity);
+		if (rtlOpts) {
+			rtlsdr_set_opt_string(dg->dev, rtlOpts, verbosity);
+		}
 	}
 
-	if (strcmp(output.filename, "-") == 0) { /* Write samples to stdout */
-		output.file = stdout;
+	for (i = 0; i < rx_num; i++) {
+		struct output_state *out = rx[i].output;
+		struct demod_state *dm = rx[i].demod;
+		if (strcmp(out->filename, "-") == 0) { /* Write samples to stdout */
+			out->file = stdout;
 #ifdef _WIN32
-		_setmode(_fileno(output.file), _O_BINARY);
+			_setmode(_fileno(out->file), _O_BINARY);
 #endif
-	} else {
-		const char * filename_to_open = output.filename;
-		if (writeWav) {
-			output.tempfilename = malloc( strlen(output.filename)+8 );
-			strcpy(output.tempfilename, output.filename);
-			strcat(output.tempfilename, ".tmp");
-			filename_to_open = output.tempfilename;
-		}
- 		output.file = fopen(filename_to_open, "wb");
-		if (!output.file) {
-			fprintf(stderr, "Failed to open %s\n", filename_to_open);
-			exit(1);
-		}
-		else
-		{
-			fprintf(stderr, "Open %s for write\n", filename_to_open);
+		} else {
+			const char * filename_to_open = out->filename;
 			if (writeWav) {
-				int nChan = (demod.mode_demod == &raw_demod) ? 2 : 1;
-				int srate = (demod.rate_out2 > 0) ? demod.rate_out2 : demod.rate_out;
-				uint32_t f = controller.freqs[0];	/* only 1st frequency!!! */
-				waveWriteHeader(srate, f, 16, nChan, output.file);
+				out->tempfilename = malloc( strlen(out->filename)+8 );
+				strcpy(out->tempfilename, out->filename);
+				strcat(out->tempfilename, ".tmp");
+				filename_to_open = out->tempfilename;
+			}
+			out->file = fopen(filename_to_open, "wb");
+			if (!out->file) {
+				fprintf(stderr, "Failed to open %s\n", filename_to_open);
+				exit(1);
+			}
+			else
+			{
+				fprintf(stderr, "Open %s for write\n", filename_to_open);
+				if (writeWav) {
+					int nChan = (dm->mode_demod == &raw_demod) ? 2 : 1;
+					int srate = (dm->rate_out2 > 0) ? dm->rate_out2 : dm->rate_out;
+					uint32_t f = rx[i].controller->freqs[0];	/* only 1st frequency!!! */
+					waveWriteHeader(srate, f, (dm->use_float == FLOAT_OUTPUT) ? 32 : 16, nChan, out->file);
+				}
 			}
 		}
+
+		/* no stdio buffering: every block reaches the pipe when it's ready */
+		if (low_latency)
+			setvbuf(out->file, NULL, _IONBF, 0);
 	}
 
 	//r = rtlsdr_set_testmode(dongle.dev, 1);
 
-	/* Reset endpoint before we start reading from it (mandatory) */
-	verbose_reset_buffer(dongle.dev);
-
-	pthread_create(&controller.thread, NULL, controller_thread_fn, (void *)(&controller));
+	for (i = 0; i < rx_num; i++) {
+		/* Reset endpoint before we start reading from it (mandatory) */
+		if (rx[i].dongle->dev)
+			verbose_reset_buffer(rx[i].dongle->dev);
+		pthread_create(&rx[i].controller->thread, NULL, controller_thread_fn, (void *)(rx[i].controller));
+	}
 	usleep(1000000); /* it looks, that startup of dongle level takes some time at startup! */
-	pthread_create(&output.thread, NULL, output_thread_fn, (void *)(&output));
-	pthread_create(&demod.thread, NULL, demod_thread_fn, (void *)(&demod));
-	pthread_create(&dongle.thread, NULL, dongle_thread_fn, (void *)(&dongle));
+
+	for (i = 0; i < rx_num; i++) {
+		struct dongle_state *dg = rx[i].dongle;
+		if (low_latency && !buf_len_given) {
+			/* capture rate is known from the controller's optimal_settings() now */
+			dg->buf_len = ((uint64_t)dg->rate * 2 * LOW_LATENCY_BLOCK_MS / 1000 + 511) / 512 * 512;
+			if (verbosity)
+				fprintf(stderr, "low latency: usb transfers of %u bytes = %.2f ms\n",
+					dg->buf_len, 1000.0 * dg->buf_len / 2 / dg->rate);
+		}
+		if (receiver_alloc_buffers(&rx[i]) < 0) {
+			fprintf(stderr, "Failed to allocate buffers\n");
+			exit(1);
+		}
+		build_demod_chain(rx[i].demod);
+
+		pthread_create(&rx[i].output->thread, NULL, output_thread_fn, (void *)(rx[i].output));
+		pthread_create(&rx[i].demod->thread, NULL, demod_thread_fn, (void *)(rx[i].demod));
+		pthread_create(&dg->thread, NULL, dg->replay_file ? replay_thread_fn : dongle_thread_fn, (void *)(dg));
+	}
 
 	while (!do_exit) {
 		usleep(100000);
+		/* a quiet channel: don't hold its last records */
+		meas_stream_tick(&meas, meas_time());
 	}
 
-	if (do_exit) {
+	if (demod.queue.closed) {
+		fprintf(stderr, "\nEnd of replay, exiting...\n");}
+	else if (do_exit) {
 		fprintf(stderr, "\nUser cancel, exiting...\n");}
 	else {
 		fprintf(stderr, "\nLibrary error %d, exiting...\n", r);}
 
-	rtlsdr_cancel_async(dongle.dev);
-	pthread_join(dongle.thread, NULL);
-	safe_cond_signal(&demod.ready, &demod.ready_m);
-	pthread_join(demod.thread, NULL);
-	safe_cond_signal(&output.ready, &output.ready_m);
-	pthread_join(output.thread, NULL);
-	safe_cond_signal(&controller.hop, &controller.hop_m);
-	pthread_join(controller.thread, NULL);
-
-	/* dongle_cleanup(&dongle); */
-	demod_cleanup(&demod);
-	output_cleanup(&output);
-	controller_cleanup(&controller);
+	cancel_all();
+	for (i = 0; i < rx_num; i++) {
+		/* a blocking producer or waiting consumer has to notice do_exit */
+		block_queue_wake(&rx[i].demod->queue);
+		block_queue_wake(&rx[i].output->queue);
+		pthread_join(rx[i].dongle->thread, NULL);
+		pthread_join(rx[i].demod->thread, NULL);
+		block_queue_wake(&rx[i].output->queue);
+		pthread_join(rx[i].output->thread, NULL);
+		safe_cond_signal(&rx[i].controller->hop, &rx[i].controller->hop_m);
+		pthread_join(rx[i].controller->thread, NULL);
+	}
+
+	if (profiling)
+		profile_report((double)dongle.rate);
+	if (dongle.replay_file && dongle.replay_file != stdin)
+		fclose(dongle.replay_file);
+
+	for (i = 0; i < rx_num; i++) {
+		struct output_state *out = rx[i].output;
+		if (rx_num > 1)
+			fprintf(stderr, "device #%d:\n", rx[i].dongle->dev_index);
+		if (low_latency)
+			latency_report(out);
+
+		/* dongle_cleanup(&dongle); */
+		demod_cleanup(rx[i].demod);
+		output_cleanup(out);
+		controller_cleanup(rx[i].controller);
+
+		if (out->file != stdout) {
+			if (writeWav) {
+				int r;
+				waveFinalizeHeader(out->file);
+				fclose(out->file);
+				remove(out->filename);	/* delete, in case file already exists */
+				r = rename( out->tempfilename, out->filename );	/* #include <stdio.h> */
+				if ( r )
+					fprintf( stderr, "%s: error %d '%s' renaming'%s' to '%s'\n"
+						, argv[0], errno, strerror(errno), out->tempfilename, out->filename );
+			} else {
+				fclose(out->file);
+			}
+		}
+	}
 
+	trigger_dispatch_close(&cmd.trig);
+	meas_stream_close(&meas);
+	if (measTarget && verbosity)
+		fprintf(stderr, "measurement stream: %u records, %u dropped\n", meas.records, meas.dropped);
+	if (cmd.filename && verbosity && (cmd.trig.dropped || cmd.trig.failed))
+		fprintf(stderr, "trigger events: %u posted, %u dropped, %u failed\n",
+			cmd.trig.posted, cmd.trig.dropped, cmd.trig.failed);
 	if (cmd.filename) {
 		int k;
 		/* output scan statistics */
-		for (k = 0; k < FREQUENCIES_LIMIT; k++) {
-			if (cmd.statNumLevels[k] > 0)
-				fprintf(stderr, "%.0f, %.1f, %.2f, %.1f\n", (double)(cmd.statFreq[k]), cmd.statMinLevel[k], cmd.statSumLevels[k] / cmd.statNumLevels[k], cmd.statMaxLevel[k] );
+		for (k = 0; k < cmd.numStats; k++) {
+			if (cmd.stats[k].numLevels > 0)
+				fprintf(stderr, "%.0f, %.1f, %.2f, %.1f\n", (double)(cmd.stats[k].freq), cmd.stats[k].minLevel, cmd.stats[k].sumLevels / cmd.stats[k].numLevels, cmd.stats[k].maxLevel );
 		}
 	}
+	cmd_cleanup(&cmd);
 
-	if (output.file != stdout) {
-		if (writeWav) {
-			int r;
-			waveFinalizeHeader(output.file);
-			fclose(output.file);
-			remove(output.filename);	/* delete, in case file already exists */
-			r = rename( output.tempfilename, output.filename );	/* #include <stdio.h> */
-			if ( r )
-				fprintf( stderr, "%s: error %d '%s' renaming'%s' to '%s'\n"
-					, argv[0], errno, strerror(errno), output.tempfilename, output.filename );
-		} else {
-			fclose(output.file);
-		}
+	for (i = 0; i < rx_num; i++) {
+		rtlsdr_close(rx[i].dongle->dev);
+		receiver_free(&rx[i]);
 	}
-
-	rtlsdr_close(dongle.dev);
 	return r >= 0 ? r : -r;
 }
 
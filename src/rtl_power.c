@@ -70,12 +70,21 @@
 #include <rtl_app_ver.h>
 #include "convenience/convenience.h"
 #include "convenience/rtl_convenience.h"
+#include "convenience/decimate.h"
+#include "convenience/executor.h"
+#include "convenience/fft.h"
+#include "convenience/powerfile.h"
 
 #define MAX(x, y) (((x) > (y)) ? (x) : (y))
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
 
 #define DEFAULT_BUF_LENGTH		(1 * 16384)
+#define MAXIMUM_BUF_LENGTH		(16 * DEFAULT_BUF_LENGTH)	/* longer captures are read in chunks */
 #define AUTO_GAIN				-100
 #define BUFFER_DUMP				(1<<12)
+#define FFT_BATCH_LENGTH		32768	/* complex values per fft_forward_batch() */
+#define PIPE_BUF_LENGTH			(1 * 16384)
+#define PIPE_BUF_NUMBER			8
 
 #define MAXIMUM_RATE			2800000
 #define MINIMUM_RATE			1000000
@@ -84,12 +93,10 @@ static volatile int do_exit = 0;
 static rtlsdr_dev_t *dev = NULL;
 FILE *file;
 
-int16_t* Sinewave;
-double* power_table;
-int N_WAVE, LOG2_N_WAVE;
 int next_power;
-int16_t *fft_buf;
-int *window_coefs;
+float *window_coefs;
+int segment_hop;	/* complex samples between fft segments */
+struct fft_plan fft_plan;
 
 struct tuning_state
 /* one per tuning range */
@@ -97,7 +104,7 @@ struct tuning_state
 	uint64_t freq;
 	int rate;
 	int bin_e;
-	int64_t *avg;  /* length == 2^bin_e */
+	double *avg;  /* length == 2^bin_e, fft power */
 	int samples;
 	int downsample;
 	int downsample_passes;  /* for the recursive filter */
@@ -107,6 +114,8 @@ struct tuning_state
 	/* having the iq buffer here is wasteful, but will avoid contention */
 	uint8_t *buf8;
 	int buf_len;
+	int chunks;  /* reads of buf_len per hop */
+	int buf_state;  /* -A: enum pipe_buf */
 	//int *comp_fir;
 	//pthread_rwlock_t buf_lock;
 	//pthread_mutex_t buf_mutex;
@@ -124,6 +133,41 @@ int comp_fir_size = 0;
 int peak_hold = 0;
 static enum time_modes time_mode = VERBOSE_TIME;
 
+struct fft_scratch
+/* one per fft thread */
+{
+	int16_t *fft_buf;
+	float *fft_work;	/* windowed segments of fft_buf, one batch */
+	struct cic5_state ds_cic[CIC_TABLE_MAX];
+	struct cfir_state droop;
+	int droop_passes;
+};
+
+int fft_threads = 1;
+struct executor fft_exec;
+struct fft_scratch *scratch;
+
+enum pipe_buf { PIPE_FREE, PIPE_FULL, PIPE_BUSY };
+
+struct pipe_state
+/* -A: the library hops through the ranges, the async stream fills their buffers */
+{
+	int	enabled;
+	pthread_t thread;
+	pthread_mutex_t m;
+	pthread_cond_t filled;
+	int	hop;		/* hop_index and sweep of the dwell being received */
+	uint32_t sweep;
+	struct tuning_state *ts;	/* its buffer, NULL: dwell dropped */
+	int	pos;
+	int	ended;		/* async read returned */
+};
+
+struct pipe_state pipe_s;
+
+int binary_format = 0;	/* enum power_format, 0: csv */
+struct power_file power_log;
+
 void usage(void)
 {
 	fprintf(stderr,
@@ -142,20 +186,26 @@ void usage(void)
 		"\t (buggy if a full sweep takes longer than the interval)\n"
 		"\t[-1 enables single-shot mode (default: off)]\n"
 		"\t[-e exit_timer (default: off/0)]\n"
+		"\t[-l capture time per hop, seconds (default: 16 kB or one fft)]\n"
 		//"\t[-s avg/iir smoothing (default: avg)]\n"
-		//"\t[-t threads (default: 1)]\n"
+		"\t[-t threads for the fft (default: 1, 0: one per cpu)]\n"
+		"\t[-A pipelined: capture the next range during the fft (default: off)]\n"
 		"\t[-d device_index or serial (default: 0)]\n"
 		"\t[-g tuner_gain (default: automatic)]\n"
 		"\t[-p ppm_error (default: 0)]\n"
 		"\t[-T enable bias-T on GPIO PIN 0 (works for rtl-sdr.com v3 dongles)]\n"
 		"\t[-D direct_sampling_mode (default: 0, 1 = I, 2 = Q, 3 = I below threshold, 4 = Q below threshold)]\n"
 		"\t[-D direct_sampling_threshold_frequency (default: 0 use tuner specific frequency threshold for 3 and 4)]\n"
+		"\t[-b f32/u16 binary log of float or quantized dB (default: csv)]\n"
+		"\t (index of the sweeps in filename.idx, see convenience/powerfile.h)\n"
 		"\tfilename (a '-' dumps samples to stdout)\n"
 		"\t (omitting the filename also uses stdout)\n"
 		"\n"
 		"Experimental options:\n"
 		"\t[-w window (default: rectangle)]\n"
 		"\t (hamming, blackman, blackman-harris, hann-poisson, bartlett, youssef)\n"
+		"\t[-o overlap of the fft segments (default: 0%%)]\n"
+		"\t (50%% or 75%% with a window: less variance from the same samples)\n"
 		// kaiser
 		"\t[-c crop_percent (default: 0%%, recommended: 20%%-50%%)]\n"
 		"\t (discards data at the edges, 100%% discards everything)\n"
@@ -220,23 +270,6 @@ static void sighandler(int signum)
 #define safe_cond_signal(n, m) pthread_mutex_lock(m); pthread_cond_signal(n); pthread_mutex_unlock(m)
 #define safe_cond_wait(n, m) pthread_mutex_lock(m); pthread_cond_wait(n, m); pthread_mutex_unlock(m)
 
-/* {length, coef, coef, coef}  and scaled by 2^15
-   for now, only length 9, optimal way to get +85% bandwidth */
-#define CIC_TABLE_MAX 10
-int cic_9_tables[][10] = {
-	{0,},
-	{9, -156,  -97, 2798, -15489, 61019, -15489, 2798,  -97, -156},
-	{9, -128, -568, 5593, -24125, 74126, -24125, 5593, -568, -128},
-	{9, -129, -639, 6187, -26281, 77511, -26281, 6187, -639, -129},
-	{9, -122, -612, 6082, -26353, 77818, -26353, 6082, -612, -122},
-	{9, -120, -602, 6015, -26269, 77757, -26269, 6015, -602, -120},
-	{9, -120, -582, 5951, -26128, 77542, -26128, 5951, -582, -120},
-	{9, -119, -580, 5931, -26094, 77505, -26094, 5931, -580, -119},
-	{9, -119, -578, 5921, -26077, 77484, -26077, 5921, -578, -119},
-	{9, -119, -577, 5917, -26067, 77473, -26067, 5917, -577, -119},
-	{9, -199, -362, 5303, -25505, 77489, -25505, 5303, -362, -199},
-};
-
 #if defined(_MSC_VER) && (_MSC_VER < 1800)
 double log2(double n)
 {
@@ -244,93 +277,7 @@ double log2(double n)
 }
 #endif
 
-/* FFT based on fix_fft.c by Roberts, Slaney and Bouras
-   http://www.jjj.de/fft/fftpage.html
-   16 bit ints for everything
-   -32768..+32768 maps to -1.0..+1.0
-*/
-
-void sine_table(int size)
-{
-	int i;
-	double d;
-	LOG2_N_WAVE = size;
-	N_WAVE = 1 << LOG2_N_WAVE;
-	Sinewave = malloc(sizeof(int16_t) * N_WAVE*3/4);
-	power_table = malloc(sizeof(double) * N_WAVE);
-	for (i=0; i<N_WAVE*3/4; i++)
-	{
-		d = (double)i * 2.0 * M_PI / N_WAVE;
-		Sinewave[i] = (int)round(32767*sin(d));
-		//printf("%i\n", Sinewave[i]);
-	}
-}
-
-static inline int16_t FIX_MPY(int16_t a, int16_t b)
-/* fixed point multiply and scale */
-{
-	int c = ((int)a * (int)b) >> 14;
-	b = c & 0x01;
-	return (c >> 1) + b;
-}
-
-int fix_fft(int16_t iq[], int m)
-/* interleaved iq[], 0 <= n < 2**m, changes in place */
-{
-	int mr, nn, i, j, l, k, istep, n, shift;
-	int16_t qr, qi, tr, ti, wr, wi;
-	n = 1 << m;
-	if (n > N_WAVE)
-		{return -1;}
-	mr = 0;
-	nn = n - 1;
-	/* decimation in time - re-order data */
-	for (m=1; m<=nn; ++m) {
-		l = n;
-		do
-			{l >>= 1;}
-		while (mr+l > nn);
-		mr = (mr & (l-1)) + l;
-		if (mr <= m)
-			{continue;}
-		// real = 2*m, imag = 2*m+1
-		tr = iq[2*m];
-		iq[2*m] = iq[2*mr];
-		iq[2*mr] = tr;
-		ti = iq[2*m+1];
-		iq[2*m+1] = iq[2*mr+1];
-		iq[2*mr+1] = ti;
-	}
-	l = 1;
-	k = LOG2_N_WAVE-1;
-	while (l < n) {
-		shift = 1;
-		istep = l << 1;
-		for (m=0; m<l; ++m) {
-			j = m << k;
-			wr =  Sinewave[j+N_WAVE/4];
-			wi = -Sinewave[j];
-			if (shift) {
-				wr >>= 1; wi >>= 1;}
-			for (i=m; i<n; i+=istep) {
-				j = i + l;
-				tr = FIX_MPY(wr,iq[2*j]) - FIX_MPY(wi,iq[2*j+1]);
-				ti = FIX_MPY(wr,iq[2*j+1]) + FIX_MPY(wi,iq[2*j]);
-				qr = iq[2*i];
-				qi = iq[2*i+1];
-				if (shift) {
-					qr >>= 1; qi >>= 1;}
-				iq[2*j] = qr - tr;
-				iq[2*j+1] = qi - ti;
-				iq[2*i] = qr + tr;
-				iq[2*i+1] = qi + ti;
-			}
-		}
-		--k;
-		l = istep;
-	}
-	return 0;
-}
+/* window functions, for the float fft of convenience/fft.h */
 
 double rectangle(int i, int length)
 {
@@ -441,15 +388,15 @@ void rms_power(struct tuning_state *ts)
 	ts->samples += 1;
 }
 
-void frequency_range(char *arg, double crop)
+void frequency_range(char *arg, double crop, double dwell)
 /* flesh out the tunes[] for scanning */
 // do we want the fewest ranges (easy) or the fewest bins (harder)?
 {
 	char *start, *stop, *step;
 	uint64_t upper, lower;
-	int i, j, max_size, bw_seen, bw_used, bin_e, buf_len;
-	int downsample, downsample_passes;
-	double bin_size;
+	int i, j, max_size, bw_seen, bw_used, bin_e, buf_len, max_len;
+	int downsample, downsample_passes, chunks;
+	double bin_size, total;
 	struct tuning_state *ts;
 	/* hacky string parsing */
 	start = arg;
@@ -506,7 +453,23 @@ void frequency_range(char *arg, double crop)
 		exit(1);
 	}
 	buf_len = 2 * (1<<bin_e) * downsample;
-	if (buf_len < DEFAULT_BUF_LENGTH) {
+	chunks = 1;
+	if (dwell > 0.0) {
+		/* read for the integration time, at least one segment.
+		 * the buffer stays bounded: longer times are integrated in chunks */
+		max_len = MAX(buf_len, MAXIMUM_BUF_LENGTH);
+		total = MAX((double)buf_len, dwell * bw_used * 2);
+		if (total / max_len > (double)(1<<20)) {
+			fprintf(stderr, "Error: capture time per hop too long.\n");
+			exit(1);
+		}
+		chunks = (int)ceil(total / max_len);
+		buf_len = MAX(buf_len, (int)(total / chunks));
+		buf_len = (buf_len + 511) & ~511;
+		if (chunks > 1) {
+			/* whole transfers of the -A stream */
+			buf_len = (buf_len + DEFAULT_BUF_LENGTH - 1) / DEFAULT_BUF_LENGTH * DEFAULT_BUF_LENGTH;}
+	} else if (buf_len < DEFAULT_BUF_LENGTH) {
 		buf_len = DEFAULT_BUF_LENGTH;
 	}
 	/* build the array */
@@ -519,13 +482,13 @@ void frequency_range(char *arg, double crop)
 		ts->crop = crop;
 		ts->downsample = downsample;
 		ts->downsample_passes = downsample_passes;
-		ts->avg = (int64_t*)malloc((1<<bin_e) * sizeof(int64_t));
+		ts->avg = (double*)malloc((1<<bin_e) * sizeof(double));
 		if (!ts->avg) {
 			fprintf(stderr, "Error: malloc.\n");
 			exit(1);
 		}
 		for (j=0; j<(1<<bin_e); j++) {
-			ts->avg[j] = 0L;
+			ts->avg[j] = 0.0;
 		}
 		ts->buf8 = (uint8_t*)malloc(buf_len * sizeof(uint8_t));
 		if (!ts->buf8) {
@@ -533,6 +496,7 @@ void frequency_range(char *arg, double crop)
 			exit(1);
 		}
 		ts->buf_len = buf_len;
+		ts->chunks = chunks;
 	}
 	/* report */
 	fprintf(stderr, "Number of frequency hops: %i\n", tune_count);
@@ -544,6 +508,8 @@ void frequency_range(char *arg, double crop)
 	  (int)((double)(tune_count * (1<<bin_e)) * (1.0-crop)));
 	fprintf(stderr, "FFT bin size: %0.2fHz\n", bin_size);
 	fprintf(stderr, "Buffer size: %i bytes (%0.2fms)\n", buf_len, 1000 * 0.5 * (float)buf_len / (float)bw_used);
+	if (chunks > 1) {
+		fprintf(stderr, "Reads per hop: %i\n", chunks);}
 }
 
 void retune(rtlsdr_dev_t *d, uint64_t freq)
@@ -558,33 +524,6 @@ void retune(rtlsdr_dev_t *d, uint64_t freq)
 		fprintf(stderr, "Error: bad retune.\n");}
 }
 
-void fifth_order(int16_t *data, int length)
-/* for half of interleaved data */
-{
-	int i;
-	int a, b, c, d, e, f;
-	a = data[0];
-	b = data[2];
-	c = data[4];
-	d = data[6];
-	e = data[8];
-	f = data[10];
-	/* a downsample should improve resolution, so don't fully shift */
-	/* ease in instead of being stateful */
-	data[0] = ((a+b)*10 + (c+d)*5 + d + f) >> 4;
-	data[2] = ((b+c)*10 + (a+d)*5 + e + f) >> 4;
-	data[4] = (a + (b+e)*5 + (c+d)*10 + f) >> 4;
-	for (i=12; i<length; i+=4) {
-		a = c;
-		b = d;
-		c = e;
-		d = f;
-		e = data[i-2];
-		f = data[i];
-		data[i/2] = (a + (b+e)*5 + (c+d)*10 + f) >> 4;
-	}
-}
-
 void remove_dc(int16_t *data, int length)
 /* works on interleaved data */
 {
@@ -602,139 +541,249 @@ void remove_dc(int16_t *data, int length)
 	}
 }
 
-void generic_fir(int16_t *data, int length, int *fir)
-/* Okay, not at all generic.  Assumes length 9, fix that eventually. */
+void process_tune(void *arg, int worker)
+/* everything after the read, runs on any fft thread */
 {
-	int d, temp, sum;
-	int hist[9] = {0,};
-	/* cheat on the beginning, let it go unfiltered */
-	for (d=0; d<18; d+=2) {
-		hist[d/2] = data[d];
+	struct tuning_state *ts = arg;
+	struct fft_scratch *sc = &scratch[worker];
+	int j, j2, k, k0, bin_e, bin_len, buf_len, ds, ds_p, segments, batch, count;
+	int16_t *src;
+	float *w;
+	bin_e = ts->bin_e;
+	bin_len = 1 << bin_e;
+	buf_len = ts->buf_len;
+	/* rms */
+	if (bin_len == 1) {
+		rms_power(ts);
+		return;
 	}
-	for (d=18; d<length; d+=2) {
-		temp = data[d];
-		sum = 0;
-		sum += (hist[0] + hist[8]) * fir[1];
-		sum += (hist[1] + hist[7]) * fir[2];
-		sum += (hist[2] + hist[6]) * fir[3];
-		sum += (hist[3] + hist[5]) * fir[4];
-		sum +=            hist[4]  * fir[5];
-		data[d] = (int16_t)(sum >> 15) ;
-		hist[0] = hist[1];
-		hist[1] = hist[2];
-		hist[2] = hist[3];
-		hist[3] = hist[4];
-		hist[4] = hist[5];
-		hist[5] = hist[6];
-		hist[6] = hist[7];
-		hist[7] = hist[8];
-		hist[8] = temp;
+	/* prep for fft */
+	for (j=0; j<buf_len; j++) {
+		sc->fft_buf[j] = (int16_t)ts->buf8[j] - 127;
+	}
+	ds = ts->downsample;
+	ds_p = ts->downsample_passes;
+	if (boxcar && ds > 1) {
+		j=2, j2=0;
+		while (j < buf_len) {
+			sc->fft_buf[j2]   += sc->fft_buf[j];
+			sc->fft_buf[j2+1] += sc->fft_buf[j+1];
+			sc->fft_buf[j] = 0;
+			sc->fft_buf[j+1] = 0;
+			j += 2;
+			if (j % (ds*2) == 0) {
+				j2 += 2;}
+		}
+	} else if (ds_p) {  /* recursive */
+		/* each buffer is a fresh capture: no state from the previous tune */
+		j2 = buf_len;
+		for (j=0; j < ds_p && j < CIC_TABLE_MAX; j++) {
+			cic5_init(&sc->ds_cic[j]);
+			j2 = cic5_decimate(&sc->ds_cic[j], sc->fft_buf, j2);
+		}
+		/* droop compensation */
+		if (comp_fir_size == 9 && ds_p <= CIC_TABLE_MAX) {
+			if (sc->droop_passes != ds_p) {
+				cfir_free(&sc->droop);
+				cfir_init(&sc->droop, &cic_9_tables[ds_p][1], cic_9_tables[ds_p][0], 15);
+				sc->droop_passes = ds_p;
+			}
+			cfir_reset(&sc->droop);
+			cfir_filter(&sc->droop, sc->fft_buf, j2);
+		}
+	}
+	remove_dc(sc->fft_buf, buf_len / ds);
+	remove_dc(sc->fft_buf+1, (buf_len / ds) - 1);
+	/* window function and fft. segments start every segment_hop samples,
+	 * overlapping (welch) when that is shorter than a segment */
+	segments = ((buf_len / ds) / 2 - bin_len) / segment_hop + 1;
+	batch = MAX(1, FFT_BATCH_LENGTH / bin_len);
+	for (k0=0; k0<segments; k0+=batch) {
+		count = MIN(batch, segments - k0);
+		for (k=0; k<count; k++) {
+			src = sc->fft_buf + 2 * (k0 + k) * segment_hop;
+			w = sc->fft_work + 2 * k * bin_len;
+			for (j=0; j<bin_len; j++) {
+				w[j*2]   = src[j*2]   * window_coefs[j];
+				w[j*2+1] = src[j*2+1] * window_coefs[j];
+			}
+		}
+		fft_forward_batch(&fft_plan, sc->fft_work, count);
+		for (k=0; k<count; k++) {
+			w = sc->fft_work + 2 * k * bin_len;
+			if (!peak_hold) {
+				for (j=0; j<bin_len; j++) {
+					ts->avg[j] += w[j*2] * w[j*2] + w[j*2+1] * w[j*2+1];
+				}
+			} else {
+				for (j=0; j<bin_len; j++) {
+					ts->avg[j] = MAX(w[j*2] * w[j*2] + w[j*2+1] * w[j*2+1], ts->avg[j]);
+				}
+			}
+			ts->samples += ds;
+		}
 	}
-}
-
-void downsample_iq(int16_t *data, int length)
-{
-	fifth_order(data, length);
-	//remove_dc(data, length);
-	fifth_order(data+1, length-1);
-	//remove_dc(data+1, length-1);
-}
-
-int64_t real_conj(int16_t real, int16_t imag)
-/* real(n * conj(n)) */
-{
-	return ((int64_t)real*(int64_t)real + (int64_t)imag*(int64_t)imag);
 }
 
 void scanner(void)
 {
-	int i, j, j2, n_read, offset, bin_e, bin_len, buf_len, ds, ds_p;
+	int i, c, n_read, buf_len;
 	uint64_t f;
-	int32_t w;
 	struct tuning_state *ts;
-	bin_e = tunes[0].bin_e;
-	bin_len = 1 << bin_e;
 	buf_len = tunes[0].buf_len;
 	for (i=0; i<tune_count; i++) {
 		if (do_exit >= 2)
-			{return;}
+			{break;}
 		ts = &tunes[i];
 		f = rtlsdr_get_center_freq64(dev);
 		if (f != ts->freq) {
 			retune(dev, ts->freq);}
-		rtlsdr_read_sync(dev, ts->buf8, buf_len, &n_read);
-		if (n_read != buf_len) {
-			fprintf(stderr, "Error: dropped samples.\n");}
-		/* rms */
-		if (bin_len == 1) {
-			rms_power(ts);
-			continue;
-		}
-		/* prep for fft */
-		for (j=0; j<buf_len; j++) {
-			fft_buf[j] = (int16_t)ts->buf8[j] - 127;
-		}
-		ds = ts->downsample;
-		ds_p = ts->downsample_passes;
-		if (boxcar && ds > 1) {
-			j=2, j2=0;
-			while (j < buf_len) {
-				fft_buf[j2]   += fft_buf[j];
-				fft_buf[j2+1] += fft_buf[j+1];
-				fft_buf[j] = 0;
-				fft_buf[j+1] = 0;
-				j += 2;
-				if (j % (ds*2) == 0) {
-					j2 += 2;}
-			}
-		} else if (ds_p) {  /* recursive */
-			for (j=0; j < ds_p; j++) {
-				downsample_iq(fft_buf, buf_len >> j);
-			}
-			/* droop compensation */
-			if (comp_fir_size == 9 && ds_p <= CIC_TABLE_MAX) {
-				generic_fir(fft_buf, buf_len >> j, cic_9_tables[ds_p]);
-				generic_fir(fft_buf+1, (buf_len >> j)-1, cic_9_tables[ds_p]);
+		for (c=0; c<ts->chunks; c++) {
+			if (c && fft_threads != 1) {
+				/* buf8 and avg of the range are still in the fft */
+				executor_wait(&fft_exec);}
+			rtlsdr_read_sync(dev, ts->buf8, buf_len, &n_read);
+			if (n_read != buf_len) {
+				fprintf(stderr, "Error: dropped samples.\n");}
+			if (fft_threads == 1) {
+				process_tune(ts, 0);
+				continue;
 			}
+			/* the next read overlaps this fft. same tune, same thread:
+			 * its averages stay in that cpu's cache */
+			executor_submit(&fft_exec, process_tune, ts, i);
 		}
-		remove_dc(fft_buf, buf_len / ds);
-		remove_dc(fft_buf+1, (buf_len / ds) - 1);
-		/* window function and fft */
-		for (offset=0; offset<(buf_len/ds); offset+=(2*bin_len)) {
-			// todo, let rect skip this
-			for (j=0; j<bin_len; j++) {
-				w =  (int32_t)fft_buf[offset+j*2];
-				w *= (int32_t)(window_coefs[j]);
-				//w /= (int32_t)(ds);
-				fft_buf[offset+j*2]   = (int16_t)w;
-				w =  (int32_t)fft_buf[offset+j*2+1];
-				w *= (int32_t)(window_coefs[j]);
-				//w /= (int32_t)(ds);
-				fft_buf[offset+j*2+1] = (int16_t)w;
-			}
-			fix_fft(fft_buf+offset, bin_e);
-			if (!peak_hold) {
-				for (j=0; j<bin_len; j++) {
-					ts->avg[j] += real_conj(fft_buf[offset+j*2], fft_buf[offset+j*2+1]);
-				}
-			} else {
-				for (j=0; j<bin_len; j++) {
-					ts->avg[j] = MAX(real_conj(fft_buf[offset+j*2], fft_buf[offset+j*2+1]), ts->avg[j]);
-				}
-			}
-			ts->samples += ds;
+	}
+	/* buf8 and avg are reused by the next pass or the csv output */
+	if (fft_threads != 1) {
+		executor_wait(&fft_exec);}
+}
+
+static void pipe_callback(unsigned char *buf, uint32_t len, void *ctx)
+{
+	struct pipe_state *p = ctx;
+	struct tuning_state *ts;
+	rtlsdr_block_tag_t tag;
+	uint32_t n;
+	if (do_exit >= 2) {
+		safe_cond_signal(&p->filled, &p->m);}
+	/* samples from before a hop or of the settling time */
+	if (rtlsdr_get_block_tag(dev, &tag) < 0 || !tag.settled
+	    || tag.hop_index < 0 || tag.hop_index >= tune_count) {
+		return;}
+	pthread_mutex_lock(&p->m);
+	/* a single range is never retuned: its capture may start at any block */
+	if (tune_count > 1 ? (tag.hop_index != p->hop || tag.sweep != p->sweep) : !p->ts) {
+		/* next dwell. dropped while the range's last capture is in use */
+		p->hop = tag.hop_index;
+		p->sweep = tag.sweep;
+		p->pos = 0;
+		ts = &tunes[tag.hop_index];
+		p->ts = (ts->buf_state == PIPE_FREE) ? ts : NULL;
+	}
+	ts = p->ts;
+	if (!ts) {
+		pthread_mutex_unlock(&p->m);
+		return;
+	}
+	n = MIN(len, (uint32_t)(ts->buf_len - p->pos));
+	memcpy(ts->buf8 + p->pos, buf, n);
+	p->pos += n;
+	if (p->pos == ts->buf_len) {
+		ts->buf_state = PIPE_FULL;
+		p->ts = NULL;
+		pthread_cond_signal(&p->filled);
+	}
+	pthread_mutex_unlock(&p->m);
+}
+
+static void *pipe_thread_fn(void *arg)
+{
+	struct pipe_state *p = arg;
+	uint32_t len = PIPE_BUF_LENGTH;
+	/* whole transfers per dwell */
+	while (len > 512 && tunes[0].buf_len % len) {
+		len /= 2;}
+	rtlsdr_read_async(dev, pipe_callback, p, PIPE_BUF_NUMBER, len);
+	pthread_mutex_lock(&p->m);
+	p->ended = 1;
+	pthread_cond_signal(&p->filled);
+	pthread_mutex_unlock(&p->m);
+	return 0;
+}
+
+static int pipe_schedule(void)
+/* one dwell of buf_len per range */
+{
+	rtlsdr_hop_entry_t *e;
+	int i, r;
+	e = calloc(tune_count, sizeof(rtlsdr_hop_entry_t));
+	if (!e) {
+		return -1;}
+	for (i=0; i<tune_count; i++) {
+		e[i].freq = tunes[i].freq;
+		e[i].gain = RTLSDR_HOP_KEEP_GAIN;
+		e[i].dwell = (uint32_t)(tunes[i].buf_len / 2);
+		/* as retune(): 5 ms and the dump of BUFFER_DUMP bytes */
+		e[i].settle = (uint32_t)(tunes[i].rate / 200 + BUFFER_DUMP / 2);
+		tunes[i].buf_state = PIPE_FREE;
+	}
+	r = rtlsdr_set_hop_schedule(dev, e, tune_count);
+	free(e);
+	return r;
+}
+
+static int pipe_wait(struct tuning_state *ts)
+{
+	int r;
+	pthread_mutex_lock(&pipe_s.m);
+	while (ts->buf_state != PIPE_FULL && !pipe_s.ended && do_exit < 2) {
+		pthread_cond_wait(&pipe_s.filled, &pipe_s.m);}
+	r = (ts->buf_state == PIPE_FULL) ? 0 : -1;
+	if (!r) {
+		ts->buf_state = PIPE_BUSY;}
+	pthread_mutex_unlock(&pipe_s.m);
+	return r;
+}
+
+static void pipe_process(void *arg, int worker)
+{
+	struct tuning_state *ts = arg;
+	process_tune(ts, worker);
+	/* the stream may capture the range's next dwell */
+	pthread_mutex_lock(&pipe_s.m);
+	ts->buf_state = PIPE_FREE;
+	pthread_mutex_unlock(&pipe_s.m);
+}
+
+void scanner_pipelined(void)
+/* the ffts run while the stream captures the following ranges.
+ * the chunks of a long capture time are taken from consecutive sweeps */
+{
+	int i = 0, c;
+	for (c=0; c<tunes[0].chunks; c++) {
+		for (i=0; i<tune_count; i++) {
+			if (pipe_wait(&tunes[i]) < 0) {
+				break;}
+			executor_submit(&fft_exec, pipe_process, &tunes[i], i);
 		}
+		if (i < tune_count) {
+			break;}
+	}
+	/* avg is read by the output */
+	executor_wait(&fft_exec);
+	if (i < tune_count) {
+		if (pipe_s.ended) {
+			fprintf(stderr, "Error: sample stream stopped.\n");}
+		do_exit = 2;
 	}
 }
 
-void csv_dbm(struct tuning_state *ts)
+void fix_fft_order(struct tuning_state *ts)
 {
-	int i, len, ds, i1, i2, bw2, bin_count;
-	int64_t tmp;
-	double dbm;
+	int i, len;
+	double tmp;
 	len = 1 << ts->bin_e;
-	ds = ts->downsample;
-	/* fix FFT stuff quirks */
 	if (ts->bin_e > 0) {
 		/* nuke DC component (not effective for all windows) */
 		ts->avg[0] = ts->avg[1];
@@ -745,29 +794,79 @@ void csv_dbm(struct tuning_state *ts)
 			ts->avg[i+len/2] = tmp;
 		}
 	}
-	/* Hz low, Hz high, Hz step, samples, dbm, dbm, ... */
+}
+
+void tune_span(struct tuning_state *ts, struct power_tune *pt)
+/* Hz low, Hz high, Hz step of the logged bins */
+{
+	int len, ds, bw2, bin_count;
+	len = 1 << ts->bin_e;
+	ds = ts->downsample;
 	bin_count = (int)((double)len * (1.0 - ts->crop));
 	bw2 = (int)(((double)ts->rate * (double)bin_count) / (len * 2 * ds));
-	fprintf(file, "%.0f, %.0f, %.2f, %i, ", (double)(ts->freq - bw2), (double)(ts->freq + bw2),
-		(double)ts->rate / (double)(len*ds), ts->samples);
+	pt->hz_low = (double)(ts->freq - bw2);
+	pt->hz_high = (double)(ts->freq + bw2);
+	pt->hz_step = (double)ts->rate / (double)(len*ds);
+}
+
+void csv_dbm(struct tuning_state *ts)
+{
+	int i, len, i1, i2;
+	double dbm, norm;
+	struct power_tune pt;
+	len = 1 << ts->bin_e;
+	/* dB scale of the former 16 bit fft: window * 256, output / len */
+	norm = ts->bin_e ? 65536.0 / ((double)len * (double)len) : 1.0;
+	/* fix FFT stuff quirks */
+	fix_fft_order(ts);
+	/* Hz low, Hz high, Hz step, samples, dbm, dbm, ... */
+	tune_span(ts, &pt);
+	fprintf(file, "%.0f, %.0f, %.2f, %i, ", pt.hz_low, pt.hz_high, pt.hz_step, ts->samples);
 	// something seems off with the dbm math
 	i1 = 0 + (int)((double)len * ts->crop * 0.5);
 	i2 = (len-1) - (int)((double)len * ts->crop * 0.5);
 	for (i=i1; i<=i2; i++) {
-		dbm  = (double)ts->avg[i];
+		dbm  = ts->avg[i] * norm;
 		dbm /= (double)ts->rate;
 		dbm /= (double)ts->samples;
 		dbm  = 10 * log10(dbm);
 		fprintf(file, "%.2f, ", dbm);
 	}
-	dbm = (double)ts->avg[i2] / ((double)ts->rate * (double)ts->samples);
+	dbm = ts->avg[i2] * norm / ((double)ts->rate * (double)ts->samples);
 	if (ts->bin_e == 0) {
 		dbm = ((double)ts->avg[0] / \
 		((double)ts->rate * (double)ts->samples));}
 	dbm  = 10 * log10(dbm);
 	fprintf(file, "%.2f\n", dbm);
 	for (i=0; i<len; i++) {
-		ts->avg[i] = 0L;
+		ts->avg[i] = 0.0;
+	}
+	ts->samples = 0;
+}
+
+int logged_bins(struct tuning_state *ts)
+{
+	int len = 1 << ts->bin_e;
+	return len - 2 * (int)((double)len * ts->crop * 0.5);
+}
+
+void binary_dbm(struct tuning_state *ts, int tune, float *db)
+/* same bins as csv_dbm(), without the repeated last one */
+{
+	int i, len, i1, i2;
+	double norm, scale;
+	len = 1 << ts->bin_e;
+	norm = ts->bin_e ? 65536.0 / ((double)len * (double)len) : 1.0;
+	scale = norm / ((double)ts->rate * (double)ts->samples);
+	fix_fft_order(ts);
+	i1 = 0 + (int)((double)len * ts->crop * 0.5);
+	i2 = (len-1) - (int)((double)len * ts->crop * 0.5);
+	for (i=i1; i<=i2; i++) {
+		db[i-i1] = (float)(10 * log10(ts->avg[i] * scale));
+	}
+	power_file_put(&power_log, tune, (uint32_t)ts->samples, db);
+	for (i=0; i<len; i++) {
+		ts->avg[i] = 0.0;
 	}
 	ts->samples = 0;
 }
@@ -786,25 +885,30 @@ int main(int argc, char **argv)
 	int dev_given = 0;
 	int ppm_error = 0;
 	int interval = 10;
-	int fft_threads = 1;
 	int smoothing = 0;
 	int single = 0;
 	int direct_sampling = 0;
 	int offset_tuning = 0;
 	int enable_biastee = 0;
+	int pipelined = 0;
 	enum rtlsdr_ds_mode ds_mode = RTLSDR_DS_IQ;
 	uint32_t ds_temp, ds_threshold = 0;
 	double crop = 0.0;
+	double overlap = 0.0;
+	double dwell = 0.0;
 	char *freq_optarg;
 	time_t next_tick;
 	time_t time_now;
 	time_t exit_time = 0;
 	char t_str[512];
+	char *index_path = NULL;
+	struct power_tune *plan;
+	float *db = NULL;
 	struct tm *cal_time;
 	double (*window_fn)(int, int) = rectangle;
 	freq_optarg = "";
 
-	while ((opt = getopt(argc, argv, "f:i:s:t:d:g:p:e:w:c:F:1EPOhTD:")) != -1) {
+	while ((opt = getopt(argc, argv, "f:i:s:t:d:g:p:e:w:c:o:l:b:F:1EPOAhTD:")) != -1) {
 		switch (opt) {
 		case 'f': // lower:upper:bin_size
 			freq_optarg = strdup(optarg);
@@ -822,6 +926,22 @@ int main(int argc, char **argv)
 		case 'c':
 			crop = atofp(optarg);
 			break;
+		case 'o':
+			overlap = atofp(optarg);
+			break;
+		case 'l':
+			dwell = atof(optarg);
+			break;
+		case 'b':
+			if (strcmp("f32",  optarg) == 0) {
+				binary_format = POWER_F32;}
+			if (strcmp("u16",  optarg) == 0) {
+				binary_format = POWER_U16;}
+			if (!binary_format) {
+				fprintf(stderr, "Unknown binary format %s.\n", optarg);
+				exit(1);
+			}
+			break;
 		case 'i':
 			interval = (int)round(atoft(optarg));
 			break;
@@ -881,6 +1001,9 @@ int main(int argc, char **argv)
 		case 'O':
 			offset_tuning = 1;
 			break;
+		case 'A':
+			pipelined = 1;
+			break;
 		case 'F':
 			boxcar = 0;
 			comp_fir_size = atoi(optarg);
@@ -905,7 +1028,12 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
-	frequency_range(freq_optarg, crop);
+	if ((overlap < 0.0) || (overlap > 0.9)) {
+		fprintf(stderr, "Overlap value outside of 0 to 0.9.\n");
+		exit(1);
+	}
+
+	frequency_range(freq_optarg, crop, dwell);
 
 	if (tune_count == 0) {
 		usage();}
@@ -985,39 +1113,105 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (binary_format) {
+		/* header with the tune plan, index next to a file */
+		plan = malloc(tune_count * sizeof(struct power_tune));
+		db = malloc(logged_bins(&tunes[0]) * sizeof(float));
+		if (!plan || !db) {
+			fprintf(stderr, "Error: malloc.\n");
+			exit(1);
+		}
+		for (i=0; i<tune_count; i++) {
+			tune_span(&tunes[i], &plan[i]);}
+		if (file != stdout) {
+			index_path = malloc(strlen(filename) + 5);
+			if (!index_path) {
+				fprintf(stderr, "Error: malloc.\n");
+				exit(1);
+			}
+			sprintf(index_path, "%s.idx", filename);
+		}
+		if (power_file_open(&power_log, file, index_path, binary_format,
+		    plan, tune_count, logged_bins(&tunes[0])) < 0) {
+			exit(1);}
+		free(plan);
+		free(index_path);
+	}
+
 	/* Reset endpoint before we start reading from it (mandatory) */
 	verbose_reset_buffer(dev);
 
 	/* actually do stuff */
 	rtlsdr_set_sample_rate(dev, (uint32_t)tunes[0].rate);
-	sine_table(tunes[0].bin_e);
+	if (tunes[0].bin_e && fft_plan_init(&fft_plan, 1 << tunes[0].bin_e) < 0) {
+		fprintf(stderr, "Error: can't setup fft of 2^%i bins.\n", tunes[0].bin_e);
+		exit(1);
+	}
 	next_tick = time(NULL) + interval;
 	if (exit_time) {
 		exit_time = time(NULL) + exit_time;}
-	fft_buf = malloc(tunes[0].buf_len * sizeof(int16_t));
+	if (fft_threads != 1 || pipelined) {
+		/* one per cpu: each pinned to its own */
+		if (executor_init(&fft_exec, fft_threads, fft_threads <= 0) < 0) {
+			exit(1);}
+		fft_threads = fft_exec.workers;
+		if (fft_threads == 1 && !pipelined) {
+			executor_free(&fft_exec);}
+		else {
+			fprintf(stderr, "Using %i fft threads\n", fft_threads);}
+	}
 	length = 1 << tunes[0].bin_e;
-	window_coefs = malloc(length * sizeof(int));
+	segment_hop = MAX(1, length - (int)(length * overlap));
+	scratch = calloc(fft_threads, sizeof(struct fft_scratch));
+	for (i=0; i<fft_threads; i++) {
+		scratch[i].fft_buf = malloc(tunes[0].buf_len * sizeof(int16_t));
+		scratch[i].fft_work = malloc(2 * MAX(FFT_BATCH_LENGTH, length) * sizeof(float));
+	}
+	window_coefs = malloc(length * sizeof(float));
 	for (i=0; i<length; i++) {
-		window_coefs[i] = (int)(256*window_fn(i, length));
+		window_coefs[i] = (float)window_fn(i, length);
+	}
+	if (pipelined) {
+		if (pipe_schedule() < 0) {
+			fprintf(stderr, "Error: can't set the hop schedule.\n");
+			exit(1);
+		}
+		pipe_s.enabled = 1;
+		pipe_s.hop = -1;
+		pthread_mutex_init(&pipe_s.m, NULL);
+		pthread_cond_init(&pipe_s.filled, NULL);
+		pthread_create(&pipe_s.thread, NULL, pipe_thread_fn, &pipe_s);
 	}
 	while (!do_exit) {
-		scanner();
+		if (pipe_s.enabled) {
+			scanner_pipelined();}
+		else {
+			scanner();}
 		time_now = time(NULL);
 		if (time_now < next_tick) {
 			continue;}
-		// time, Hz low, Hz high, Hz step, samples, dbm, dbm, ...
-		cal_time = localtime(&time_now);
-		if (time_mode == VERBOSE_TIME) {
-			strftime(t_str, 512, "%Y-%m-%d, %H:%M:%S", cal_time);
-		}
-		if (time_mode == EPOCH_TIME) {
-			snprintf(t_str, 512, "%u, %s", (unsigned)time_now, dev_label);
-		}
-		for (i=0; i<tune_count; i++) {
-			fprintf(file, "%s, ", t_str);
-			csv_dbm(&tunes[i]);
+		if (binary_format) {
+			for (i=0; i<tune_count; i++) {
+				binary_dbm(&tunes[i], i, db);}
+			if (power_file_sweep(&power_log, (double)time_now) < 0) {
+				fprintf(stderr, "Error: can't write the log.\n");
+				do_exit = 1;
+			}
+		} else {
+			// time, Hz low, Hz high, Hz step, samples, dbm, dbm, ...
+			cal_time = localtime(&time_now);
+			if (time_mode == VERBOSE_TIME) {
+				strftime(t_str, 512, "%Y-%m-%d, %H:%M:%S", cal_time);
+			}
+			if (time_mode == EPOCH_TIME) {
+				snprintf(t_str, 512, "%u, %s", (unsigned)time_now, dev_label);
+			}
+			for (i=0; i<tune_count; i++) {
+				fprintf(file, "%s, ", t_str);
+				csv_dbm(&tunes[i]);
+			}
+			fflush(file);
 		}
-		fflush(file);
 		while (time(NULL) >= next_tick) {
 			next_tick += interval;}
 		if (single) {
@@ -1033,12 +1227,30 @@ int main(int argc, char **argv)
 	else {
 		fprintf(stderr, "\nLibrary error %d, exiting...\n", r);}
 
+	if (binary_format) {
+		power_file_close(&power_log);
+		free(db);
+	}
 	if (file != stdout) {
 		fclose(file);}
 
+	if (pipe_s.enabled) {
+		rtlsdr_cancel_async(dev);
+		pthread_join(pipe_s.thread, NULL);
+		pthread_cond_destroy(&pipe_s.filled);
+		pthread_mutex_destroy(&pipe_s.m);
+	}
 	rtlsdr_close(dev);
-	free(fft_buf);
+	if (fft_exec.workers) {
+		executor_free(&fft_exec);}
+	for (i=0; i<fft_threads; i++) {
+		free(scratch[i].fft_buf);
+		free(scratch[i].fft_work);
+		cfir_free(&scratch[i].droop);
+	}
+	free(scratch);
 	free(window_coefs);
+	fft_plan_free(&fft_plan);
 	//for (i=0; i<tune_count; i++) {
 	//	free(tunes[i].avg);
 	//	free(tunes[i].buf8);